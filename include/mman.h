@@ -17,8 +17,9 @@
 #define _PHOENIX_MMAN_H_
 
 
+/* MAP_PRIVATE is the default, writes to a private object mapping go to a private copy of the page */
 enum { MAP_NONE = 0x0, MAP_NEEDSCOPY = 0x1, MAP_UNCACHED = 0x2, MAP_DEVICE = 0x4, MAP_NOINHERIT = 0x8,
-	MAP_SHARED = 0x0, MAP_PRIVATE = 0x0, MAP_FIXED = 0x0, MAP_ANONYMOUS = 0x0 };
+	MAP_SHARED = 0x10, MAP_ANONYMOUS = 0x20, MAP_PRIVATE = 0x0, MAP_FIXED = 0x0 };
 
 
 enum { PROT_NONE = 0x0, PROT_READ = 0x1, PROT_WRITE = 0x2, PROT_EXEC = 0x4, PROT_USER = 0x8 };
@@ -35,6 +35,15 @@ enum {
 } type;
 
 
+/*
+ * Message flags
+ */
+
+
+/* Lend whole pages spanned by input data instead of copying partially used ones */
+enum { MSG_ZEROCOPY = 0x1 };
+
+
 #pragma pack(push, 8)
 
 
@@ -134,9 +143,40 @@ typedef struct _msg_t {
 		void *data;
 	} o;
 
+	/* MSG_* flags, has to be initialized by sender */
+	unsigned int flags;
 } msg_t;
 
 
+/*
+ * Asynchronous message ring
+ *
+ * Process puts indices of filled entries to sq and advances sqtail, kernel consumes them
+ * advancing sqhead. Indices of completed entries are put by kernel to cq at cqtail,
+ * process consumes them advancing cqhead. Size is a power of 2 and applies to both queues.
+ */
+
+
+typedef struct _msgentry_t {
+	u32 port;
+	int err;
+	msg_t msg;
+} msgentry_t;
+
+
+typedef struct _msgring_t {
+	volatile unsigned int sqhead;
+	volatile unsigned int sqtail;
+	volatile unsigned int cqhead;
+	volatile unsigned int cqtail;
+
+	unsigned int size;
+	unsigned int *sq;
+	unsigned int *cq;
+	msgentry_t *entries;
+} msgring_t;
+
+
 #pragma pack(pop)
 
 
@@ -109,4 +109,12 @@
 	ID(sys_getpgid) \
 	ID(sys_setpgrp) \
 	ID(sys_getpgrp) \
-	ID(sys_setsid)
+	ID(sys_setsid) \
+	\
+	ID(schedinfo) \
+	ID(futexWait) \
+	ID(futexWake) \
+	ID(msgRingCreate) \
+	ID(msgRingEnter) \
+	ID(mmapOid) \
+	ID(mmapFaultAround)
@@ -44,6 +44,18 @@ typedef struct _threadinfo_t {
 } threadinfo_t;
 
 
+typedef struct _schedinfo_t {
+	unsigned int cpu;
+	unsigned int nready;
+	unsigned int switches;
+	unsigned int steals;
+	unsigned int migrations;
+	unsigned int handoffs;
+	unsigned int ticks;
+	unsigned int ticksAvoided;
+} schedinfo_t;
+
+
 typedef struct _entryinfo_t {
 	void *vaddr;
 	size_t size;
@@ -65,6 +77,16 @@ typedef struct _pageinfo_t {
 } pageinfo_t;
 
 
+typedef struct _slabinfo_t {
+	char name[16];
+	unsigned int objsz;
+	unsigned int perslab;
+	unsigned int slabs;
+	unsigned int used;
+	unsigned int cached;
+} slabinfo_t;
+
+
 typedef struct _meminfo_t {
 	struct {
 		unsigned int alloc, free, boot, sz;
@@ -77,6 +99,11 @@ typedef struct _meminfo_t {
 		int mapsz, kmapsz;
 		entryinfo_t *kmap, *map;
 	} entry;
+
+	struct {
+		int cachesz;
+		slabinfo_t *cache;
+	} slab;
 } meminfo_t;
 
 
@@ -43,6 +43,14 @@ extern void _etext(void);
 
 #define TT2S_CACHING_ATTR	TT2S_CACHED
 
+#define PMAP_ASIDMASK       0xff
+
+/* Larger ranges invalidate whole ASID instead of each page */
+#define PMAP_INVALMAX       32
+
+#define TT1S_SECTION        0x002
+#define TT1S_TYPE_MASK      0x003
+
 /* Page dirs & tables are write-back no write-allocate inner/outer cachable */
 #define TTBR_CACHE_CONF (1 | (1 << 6) | (3 << 3))
 
@@ -53,14 +61,12 @@ struct {
 	u32 excptab[0x400];
 	u32 sptab[0x400];
 	u8 heap[SIZE_PAGE];
-	pmap_t *asid_map[256];
-	u8 asids[256];
 	addr_t minAddr;
 	addr_t maxAddr;
 	u32 start;
 	u32 end;
 	spinlock_t lock;
-	u8 asidptr;
+	u32 asid;
 } __attribute__((aligned(0x4000))) pmap_common;
 
 
@@ -103,50 +109,67 @@ static const u16 attrMap[] = {
 };
 
 
-static void _pmap_asidAlloc(pmap_t *pmap)
+/* Section descriptors hold the same attributes as small pages at other bit positions */
+static inline u32 _pmap_sectionAttr(u32 attr)
 {
-	pmap_t *evicted = NULL;
+	return TT1S_SECTION | ((attr & TT2S_EXECNEVER) << 4) | (attr & 0xc) | ((attr & 0xff0) << 6);
+}
 
-	while (!++pmap_common.asidptr || (evicted = pmap_common.asid_map[pmap_common.asidptr]) != NULL) {
-		if (evicted != NULL) {
-			if ((hal_cpuGetContextId() & 0xff) == pmap_common.asids[evicted->asid_ix])
-				continue;
 
-			evicted->asid_ix = 0;
-			break;
-		}
-	}
+static inline u32 _pmap_pageAttr(u32 sect)
+{
+	return TT2S_SMALLPAGE | ((sect >> 4) & TT2S_EXECNEVER) | (sect & 0xc) | ((sect >> 6) & 0xff0);
+}
 
-	pmap_common.asid_map[pmap_common.asidptr] = pmap;
-	pmap->asid_ix = pmap_common.asidptr;
 
-	hal_cpuInvalASID(pmap_common.asids[pmap->asid_ix]);
+static inline int _pmap_isSection(u32 pde)
+{
+	return (pde & TT1S_TYPE_MASK) == TT1S_SECTION;
+}
+
+
+/* Loads reserved ASID 0 with kernel page directory, no user translation can be walked in meanwhile */
+static void _pmap_switchKernel(void)
+{
 	hal_cpuDataSyncBarrier();
+	hal_cpuSetContextId(0);
+	hal_cpuInstrBarrier();
+	hal_cpuSetUserTT(((addr_t)pmap_common.kpdir - VADDR_KERNEL + pmap_common.minAddr) | TTBR_CACHE_CONF);
 	hal_cpuInstrBarrier();
 }
 
 
-static void _pmap_asidDealloc(pmap_t *pmap)
+/*
+ * ASIDs are handed out in generations, the generation is kept above the 8-bit
+ * ASID in pmap->asid and pmap_common.asid. ASID 0 is reserved for switching.
+ * An address space keeps its ASID for as long as the generation lasts, when
+ * the ASID space runs out a new generation starts with a single TLB flush and
+ * address spaces of older generations get new ASIDs when switched to.
+ */
+static void _pmap_asidAlloc(pmap_t *pmap)
 {
-	pmap_t *last;
-	addr_t tmp;
-
-	if (pmap->asid_ix != 0) {
-		if (pmap->asid_ix != pmap_common.asidptr) {
-			pmap_common.asid_map[pmap->asid_ix] = last = pmap_common.asid_map[pmap_common.asidptr];
-			last->asid_ix = pmap->asid_ix;
-			tmp = pmap_common.asids[last->asid_ix];
-			pmap_common.asids[last->asid_ix] = pmap_common.asids[pmap_common.asidptr];
-			pmap_common.asids[pmap_common.asidptr] = tmp;
-		}
-
-		pmap_common.asid_map[pmap_common.asidptr] = NULL;
+	if (!(++pmap_common.asid & PMAP_ASIDMASK)) {
+		pmap_common.asid++;
 
-		if (!--pmap_common.asidptr)
-			pmap_common.asidptr--;
+		/* Outgoing ASID is handed out again in the new generation, speculative walks
+		 * mustn't refill its entries after the flush */
+		_pmap_switchKernel();
 
-		pmap->asid_ix = 0;
+		hal_cpuDataSyncBarrier();
+		hal_cpuInvalTLB();
+		hal_cpuBranchInval();
+		hal_cpuICacheInval();
+		hal_cpuDataSyncBarrier();
+		hal_cpuInstrBarrier();
 	}
+
+	pmap->asid = pmap_common.asid;
+}
+
+
+static inline int _pmap_asidValid(pmap_t *pmap)
+{
+	return !((pmap->asid ^ pmap_common.asid) & ~PMAP_ASIDMASK);
 }
 
 
@@ -155,7 +178,7 @@ int pmap_create(pmap_t *pmap, pmap_t *kpmap, page_t *p, void *vaddr)
 {
 	pmap->pdir = vaddr;
 	pmap->addr = p->addr;
-	pmap->asid_ix = 0;
+	pmap->asid = 0;
 
 	hal_memset(pmap->pdir, 0, (VADDR_KERNEL) >> 18);
 	hal_memcpy(&pmap->pdir[VADDR_KERNEL >> 20], &kpmap->pdir[VADDR_KERNEL >> 20], (VADDR_MAX - VADDR_KERNEL + 1) >> 18);
@@ -166,25 +189,20 @@ int pmap_create(pmap_t *pmap, pmap_t *kpmap, page_t *p, void *vaddr)
 }
 
 
-void pmap_moved(pmap_t *pmap)
-{
-	hal_spinlockSet(&pmap_common.lock);
-	pmap_common.asid_map[pmap->asid_ix] = pmap;
-	hal_spinlockClear(&pmap_common.lock);
-}
-
-
 addr_t pmap_destroy(pmap_t *pmap, int *i)
 {
 	int max = ((VADDR_USR_MAX + SIZE_PAGE - 1) & ~(SIZE_PAGE - 1)) >> 20;
 
-	hal_spinlockSet(&pmap_common.lock);
-	if (pmap->asid_ix != 0)
-		_pmap_asidDealloc(pmap);
-	hal_spinlockClear(&pmap_common.lock);
+	/* ASID isn't reused before generation changes, the page directory mustn't stay loaded */
+	if (*i == 0) {
+		hal_spinlockSet(&pmap_common.lock);
+		if (hal_cpuGetUserTT() == (pmap->addr | TTBR_CACHE_CONF))
+			_pmap_switchKernel();
+		hal_spinlockClear(&pmap_common.lock);
+	}
 
 	while (*i < max) {
-		if (pmap->pdir[*i] != NULL) {
+		if (pmap->pdir[*i] != NULL && !_pmap_isSection(pmap->pdir[*i])) {
 			*i += 4;
 			return pmap->pdir[*i - 4] & ~0xfff;
 		}
@@ -197,29 +215,20 @@ addr_t pmap_destroy(pmap_t *pmap, int *i)
 
 void _pmap_switch(pmap_t *pmap)
 {
-	if (pmap->asid_ix == 0)
+	if (!_pmap_asidValid(pmap))
 		_pmap_asidAlloc(pmap);
 
 	else if (hal_cpuGetUserTT() == (pmap->addr | TTBR_CACHE_CONF))
 		return;
 
+	/* Translations are tagged and the caches are physically tagged, no flush is needed */
 	hal_cpuDataSyncBarrier();
 
 	hal_cpuSetContextId(0);
 	hal_cpuInstrBarrier();
 	hal_cpuSetUserTT(pmap->addr | TTBR_CACHE_CONF);
 	hal_cpuInstrBarrier();
-	hal_cpuSetContextId((u32)pmap->pdir | pmap_common.asids[pmap->asid_ix]);
-
-	hal_cpuInvalTLB();
-
-	hal_cpuDataSyncBarrier();
-	hal_cpuInstrBarrier();
-
-	hal_cpuBranchInval();
-	hal_cpuICacheInval();
-
-	hal_cpuDataSyncBarrier();
+	hal_cpuSetContextId((u32)pmap->pdir | (pmap->asid & PMAP_ASIDMASK));
 	hal_cpuInstrBarrier();
 }
 
@@ -264,7 +273,7 @@ static void _pmap_addTable(pmap_t *pmap, int pdi, addr_t pa)
 
 	hal_cpuDataSyncBarrier();
 
-	hal_cpuInvalASID(pmap_common.asids[pmap->asid_ix]);
+	hal_cpuInvalASID(pmap->asid & PMAP_ASIDMASK);
 	hal_cpuDataSyncBarrier();
 	hal_cpuInstrBarrier();
 }
@@ -276,91 +285,280 @@ static void _pmap_mapScratch(addr_t pa, unsigned char asid)
 }
 
 
+/* Function replaces four sections of superpage with page table replicating their mapping */
+static void _pmap_splitSections(pmap_t *pmap, int pdi, addr_t pa, unsigned char asid)
+{
+	unsigned int i;
+	u32 pde;
+
+	pdi &= ~3;
+
+	_pmap_mapScratch(pa, asid);
+
+	for (i = 0; i < 0x400; i++) {
+		pde = pmap->pdir[pdi + (i >> 8)];
+		pmap_common.sptab[i] = ((pde & ~0xfffff) + ((i & 0xff) << 12)) | _pmap_pageAttr(pde);
+	}
+
+	_pmap_addTable(pmap, pdi, pa);
+}
+
+
+static void _pmap_invalPage(pmap_t *pmap, void *va, addr_t pa, int attr, unsigned char asid)
+{
+	int i;
+
+	/* Invalidate cache for this pa to prevent corrupting it later when cache lines get evicted.
+	 * First map it into our address space if necessary. */
+	if (hal_cpuGetUserTT() != (pmap->addr | TTBR_CACHE_CONF)) {
+		_pmap_mapScratch(pa, asid);
+		va = pmap_common.sptab;
+	}
+
+	for (i = 0; i < SIZE_PAGE / SIZE_CACHE_LINE; ++i)
+		hal_cpuInvalDataCache((char *)va + i * SIZE_CACHE_LINE);
+
+	if (attr & PGHD_EXEC) {
+		hal_cpuBranchInval();
+		hal_cpuICacheInval();
+	}
+
+	hal_cpuDataSyncBarrier();
+	hal_cpuInstrBarrier();
+}
+
+
+/* Function invalidates translations of range with one barrier sequence */
+static void _pmap_invalRange(void *vaddr, void *end, unsigned char asid)
+{
+	hal_cpuDataSyncBarrier();
+
+	if (end - vaddr > PMAP_INVALMAX * SIZE_PAGE) {
+		/* Kernel translations are global */
+		if ((u32)vaddr < VADDR_USR_MAX)
+			hal_cpuInvalASID(asid);
+		else
+			hal_cpuInvalTLB();
+	}
+	else {
+		for (; vaddr < end; vaddr += SIZE_PAGE)
+			hal_cpuInvalVA(((u32)vaddr & ~0xfff) | asid);
+	}
+
+	hal_cpuICacheInval();
+	hal_cpuDataSyncBarrier();
+	hal_cpuInstrBarrier();
+}
+
+
 /* Functions maps page at specified address */
 int pmap_enter(pmap_t *pmap, addr_t pa, void *va, int attr, page_t *alloc)
 {
-	int pdi, i = 0;
-	unsigned char asid;
+	return pmap_enterRange(pmap, pa, va, SIZE_PAGE, attr, alloc);
+}
 
-	pdi = (u32)va >> 20;
+
+/* Function maps physically contiguous range, page tables are filled in place and invalidated once */
+int pmap_enterRange(pmap_t *pmap, addr_t pa, void *va, size_t size, int attr, page_t *alloc)
+{
+	unsigned int pdi, pti;
+	unsigned char asid;
+	void *end = va + size, *v;
+	addr_t a;
 
 	hal_spinlockSet(&pmap_common.lock);
-	asid = pmap_common.asids[pmap->asid_ix];
+	asid = pmap->asid & PMAP_ASIDMASK;
+
+	/* Missing page tables are added before any entry is written, alloc covers one of them */
+	for (v = va; v < end; v = (void *)((pdi + 1) << 20)) {
+		pdi = (u32)v >> 20;
+
+		if (pmap->pdir[pdi] && !_pmap_isSection(pmap->pdir[pdi]))
+			continue;
 
-	/* If no page table is allocated add new one */
-	if (!pmap->pdir[pdi]) {
 		if (alloc == NULL) {
 			hal_spinlockClear(&pmap_common.lock);
 			return -EFAULT;
 		}
 
-		_pmap_mapScratch(alloc->addr, asid);
-		hal_memset(pmap_common.sptab, 0, SIZE_PAGE);
-		_pmap_addTable(pmap, pdi, alloc->addr);
+		/* Superpage is split into page table */
+		if (pmap->pdir[pdi]) {
+			_pmap_splitSections(pmap, pdi, alloc->addr, asid);
+		}
+		else {
+			_pmap_mapScratch(alloc->addr, asid);
+			hal_memclr(pmap_common.sptab, SIZE_PAGE);
+			_pmap_addTable(pmap, pdi, alloc->addr);
+		}
+
+		alloc = NULL;
 	}
-	else {
-		_pmap_mapScratch(pmap->pdir[pdi], asid);
+
+	/* One page holds tables of four consecutive sections */
+	for (v = va, a = pa; v < end;) {
+		_pmap_mapScratch(pmap->pdir[(u32)v >> 20], asid);
+
+		for (pti = ((u32)v >> 12) & 0x3ff; (pti < 1024) && (v < end); pti++, v += SIZE_PAGE, a += SIZE_PAGE)
+			pmap_common.sptab[pti] = (attr & PGHD_PRESENT) ? ((a & ~0xfff) | attrMap[attr & 0x1f]) : 0;
+	}
+
+	_pmap_invalRange(va, end, asid);
+
+	if ((attr & PGHD_PRESENT) && (attr & (PGHD_EXEC | PGHD_NOT_CACHED | PGHD_DEV))) {
+		for (v = va; v < end; v += SIZE_PAGE, pa += SIZE_PAGE)
+			_pmap_invalPage(pmap, v, pa, attr, asid);
 	}
 
-	/* Write entry into page table */
-	_pmap_writeEntry(pmap_common.sptab, va, pa, attr, asid);
+	hal_spinlockClear(&pmap_common.lock);
+	return EOK;
+}
+
+
+/* Function maps superpage as four consecutive sections, fails if page table covers it */
+int pmap_enterSuper(pmap_t *pmap, addr_t pa, void *va, int attr)
+{
+	unsigned int pdi, i;
+	unsigned char asid;
+
+	if (((pa | (u32)va) & (SIZE_SUPERPAGE - 1)) || ((u32)va >= VADDR_USR_MAX) || !(attr & PGHD_PRESENT))
+		return -EINVAL;
+
+	pdi = (u32)va >> 20;
+
+	hal_spinlockSet(&pmap_common.lock);
+	asid = pmap->asid & PMAP_ASIDMASK;
 
-	if (!(attr & PGHD_PRESENT)) {
+	if (pmap->pdir[pdi] && !_pmap_isSection(pmap->pdir[pdi])) {
 		hal_spinlockClear(&pmap_common.lock);
-		return EOK;
+		return -EEXIST;
 	}
 
+	for (i = 0; i < 4; i++)
+		pmap->pdir[pdi + i] = (pa + (i << 20)) | _pmap_sectionAttr(attrMap[attr & 0x1f]);
+
+	hal_cpuDataSyncBarrier();
+	hal_cpuInvalASID(asid);
+	hal_cpuDataSyncBarrier();
+	hal_cpuInstrBarrier();
+
 	if (attr & PGHD_EXEC || attr & PGHD_NOT_CACHED || attr & PGHD_DEV) {
-		/* Invalidate cache for this pa to prevent corrupting it later when cache lines get evicted.
-		 * First map it into our address space if necessary. */
-		if (hal_cpuGetUserTT() != (pmap->addr | TTBR_CACHE_CONF)) {
-			_pmap_mapScratch(pa, asid);
-			va = pmap_common.sptab;
+		for (i = 0; i < SIZE_SUPERPAGE; i += SIZE_PAGE)
+			_pmap_invalPage(pmap, va + i, pa + i, attr, asid);
+	}
+
+	hal_spinlockClear(&pmap_common.lock);
+	return EOK;
+}
+
+
+int pmap_remove(pmap_t *pmap, void *vaddr)
+{
+	return pmap_removeRange(pmap, vaddr, SIZE_PAGE);
+}
+
+
+/* Function unmaps range walking each page table once, translations are invalidated at the end */
+int pmap_removeRange(pmap_t *pmap, void *vaddr, size_t size)
+{
+	unsigned int pdi, pti;
+	unsigned char asid;
+	void *end = vaddr + size, *lo = end, *hi = vaddr;
+
+	hal_spinlockSet(&pmap_common.lock);
+	asid = pmap->asid & PMAP_ASIDMASK;
+
+	while (vaddr < end) {
+		pdi = (u32)vaddr >> 20;
+
+		if (!pmap->pdir[pdi]) {
+			vaddr = (void *)((pdi + 1) << 20);
+			continue;
 		}
 
-		for (i = 0; i < SIZE_PAGE / SIZE_CACHE_LINE; ++i)
-			hal_cpuInvalDataCache((char *)va + i * SIZE_CACHE_LINE);
+		/* Removing any page of superpage drops all its sections, the rest is faulted in pages */
+		if (_pmap_isSection(pmap->pdir[pdi])) {
+			pdi &= ~3;
+			pmap->pdir[pdi] = pmap->pdir[pdi + 1] = pmap->pdir[pdi + 2] = pmap->pdir[pdi + 3] = 0;
 
-		if (attr & PGHD_EXEC) {
-			hal_cpuBranchInval();
-			hal_cpuICacheInval();
+			if (lo > (void *)(pdi << 20))
+				lo = (void *)(pdi << 20);
+
+			vaddr = hi = (void *)((pdi + 4) << 20);
+			continue;
 		}
 
-		hal_cpuDataSyncBarrier();
-		hal_cpuInstrBarrier();
+		_pmap_mapScratch(pmap->pdir[pdi], asid);
+
+		for (pti = ((u32)vaddr >> 12) & 0x3ff; (pti < 1024) && (vaddr < end); pti++, vaddr += SIZE_PAGE) {
+			if (pmap_common.sptab[pti] != 0) {
+				pmap_common.sptab[pti] = 0;
+
+				if (lo > vaddr)
+					lo = vaddr;
+				hi = vaddr + SIZE_PAGE;
+			}
+		}
 	}
 
+	if (lo < hi)
+		_pmap_invalRange(lo, hi, asid);
+
 	hal_spinlockClear(&pmap_common.lock);
 	return EOK;
 }
 
 
-int pmap_remove(pmap_t *pmap, void *vaddr)
+int pmap_protect(pmap_t *pmap, void *vaddr, size_t size, int attr)
 {
 	unsigned int pdi, pti;
-	addr_t addr;
 	unsigned char asid;
-
-	pdi = (u32)vaddr >> 20;
-	pti = ((u32)vaddr >> 12) & 0x3ff;
+	void *end = vaddr + size;
+	int changed = 0, whole;
 
 	hal_spinlockSet(&pmap_common.lock);
-	if (!(addr = pmap->pdir[pdi])) {
-		hal_spinlockClear(&pmap_common.lock);
-		return EOK;
-	}
+	asid = pmap->asid & PMAP_ASIDMASK;
 
-	/* Map page table corresponding to vaddr */
-	asid = pmap_common.asids[pmap->asid_ix];
-	_pmap_mapScratch(addr, asid);
+	while (vaddr < end) {
+		pdi = (u32)vaddr >> 20;
 
-	if (pmap_common.sptab[pti] == 0) {
-		hal_spinlockClear(&pmap_common.lock);
-		return EOK;
+		if (!pmap->pdir[pdi]) {
+			vaddr = (void *)((pdi + 1) << 20);
+			continue;
+		}
+
+		/* Superpage changes as a whole or is dropped when range covers it partially */
+		if (_pmap_isSection(pmap->pdir[pdi])) {
+			pdi &= ~3;
+			whole = !((u32)vaddr & (SIZE_SUPERPAGE - 1)) && (end - vaddr >= SIZE_SUPERPAGE);
+
+			for (pti = 0; pti < 4; pti++)
+				pmap->pdir[pdi + pti] = whole ? ((pmap->pdir[pdi + pti] & ~0xfffff) | _pmap_sectionAttr(attrMap[attr & 0x1f])) : 0;
+
+			vaddr = (void *)((pdi + 4) << 20);
+			changed = 1;
+			continue;
+		}
+
+		/* One page holds tables of four consecutive sections */
+		_pmap_mapScratch(pmap->pdir[pdi], asid);
+
+		for (pti = ((u32)vaddr >> 12) & 0x3ff; (pti < 1024) && (vaddr < end); pti++, vaddr += SIZE_PAGE) {
+			if (pmap_common.sptab[pti] != 0) {
+				pmap_common.sptab[pti] = (pmap_common.sptab[pti] & ~0xfff) | attrMap[attr & 0x1f];
+				changed = 1;
+			}
+		}
+	}
+
+	if (changed) {
+		hal_cpuDataSyncBarrier();
+		hal_cpuInvalASID(asid);
+		hal_cpuDataSyncBarrier();
+		hal_cpuInstrBarrier();
 	}
 
-	_pmap_writeEntry(pmap_common.sptab, vaddr, 0, 0, asid);
 	hal_spinlockClear(&pmap_common.lock);
+
 	return EOK;
 }
 
@@ -381,7 +579,13 @@ addr_t pmap_resolve(pmap_t *pmap, void *vaddr)
 		return 0;
 	}
 
-	asid = pmap_common.asids[pmap->asid_ix];
+	/* Section entry is returned in small page format */
+	if (_pmap_isSection(addr)) {
+		hal_spinlockClear(&pmap_common.lock);
+		return ((addr & ~0xfffff) + (pti & 0xff) * SIZE_PAGE) | _pmap_pageAttr(addr);
+	}
+
+	asid = pmap->asid & PMAP_ASIDMASK;
 	_pmap_mapScratch(addr, asid);
 	addr = pmap_common.sptab[pti];
 	hal_spinlockClear(&pmap_common.lock);
@@ -522,13 +726,9 @@ void _pmap_init(pmap_t *pmap, void **vstart, void **vend)
 	int i;
 	void *v;
 
-	pmap_common.asidptr = 0;
-	pmap->asid_ix = 0;
-
-	for (i = 0; i < sizeof(pmap_common.asid_map) / sizeof(pmap_common.asid_map[0]); ++i) {
-		pmap_common.asid_map[i] = NULL;
-		pmap_common.asids[i] = i;
-	}
+	/* First generation starts at 1, so ASID 0 of a new pmap is never valid */
+	pmap_common.asid = PMAP_ASIDMASK + 1;
+	pmap->asid = 0;
 
 	hal_spinlockCreate(&pmap_common.lock, "pmap_common.lock");
 
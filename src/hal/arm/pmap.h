@@ -25,6 +25,9 @@
 /* (MOD) */
 #define VADDR_SCRATCHPAD_TTL 0xfff00000
 
+/* Superpage is four 1MB sections sharing one page table page when split */
+#define SIZE_SUPERPAGE (SIZE_PAGE << 10)
+
 
 /* Architecure dependent page attributes */
 #define PGHD_PRESENT    0x20
@@ -68,7 +71,7 @@ typedef struct _page_t {
 
 
 typedef struct _pmap_t {
-	u8 asid_ix;
+	u32 asid;      /* ASID generation and ASID */
 	u32 *pdir;
 	addr_t addr;   /* physical address of pdir */
 	void *start;
@@ -85,7 +88,9 @@ static inline int pmap_belongs(pmap_t *pmap, void *addr)
 extern int pmap_create(pmap_t *pmap, pmap_t *kpmap, page_t *p, void *vaddr);
 
 
-extern void pmap_moved(pmap_t *pmap);
+static inline void pmap_moved(pmap_t *pmap)
+{
+}
 
 
 extern addr_t pmap_destroy(pmap_t *pmap, int *i);
@@ -97,10 +102,26 @@ extern void pmap_switch(pmap_t *pmap);
 extern int pmap_enter(pmap_t *pmap, addr_t addr, void *vaddr, int attrs, page_t *alloc);
 
 
+/* Function maps physically contiguous range, fails with -EFAULT if more page tables are needed than given */
+extern int pmap_enterRange(pmap_t *pmap, addr_t addr, void *vaddr, size_t size, int attrs, page_t *alloc);
+
+
+/* Function maps SIZE_SUPERPAGE aligned region with one translation, fails if a page table covers it */
+extern int pmap_enterSuper(pmap_t *pmap, addr_t addr, void *vaddr, int attrs);
+
+
 /* Function removes mapping for given address */
 extern int pmap_remove(pmap_t *pmap, void *vaddr);
 
 
+/* Function removes mappings in range, translations are invalidated once */
+extern int pmap_removeRange(pmap_t *pmap, void *vaddr, size_t size);
+
+
+/* Function changes attributes of pages mapped in range, TLB is flushed once */
+extern int pmap_protect(pmap_t *pmap, void *vaddr, size_t size, int attr);
+
+
 extern addr_t pmap_resolve(pmap_t *pmap, void *vaddr);
 
 
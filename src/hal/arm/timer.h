@@ -24,6 +24,9 @@
 #define TIMER_US2CYC(x) (66 * x)
 #define TIMER_CYC2US(x) (x / 66)
 
+/* Longest interval which can be passed to hal_setWakeup */
+#define TIMER_MAXWAKEUP 0xffffffffU
+
 
 extern time_t hal_getTimer(void);
 
@@ -17,6 +17,7 @@
 #define _HAL_PMAP_H_
 
 #define SIZE_PAGE  0x200
+#define SIZE_SUPERPAGE SIZE_PAGE
 
 /* TODO */
 /* Predefined virutal adresses */
@@ -107,6 +108,24 @@ extern int pmap_enter(pmap_t *pmap, addr_t pa, void *vaddr, int attr, page_t *al
 extern int pmap_remove(pmap_t *pmap, void *vaddr);
 
 
+static inline int pmap_removeRange(pmap_t *pmap, void *vaddr, size_t size)
+{
+	return 0;
+}
+
+
+static inline int pmap_protect(pmap_t *pmap, void *vaddr, size_t size, int attr)
+{
+	return 0;
+}
+
+
+static inline int pmap_enterSuper(pmap_t *pmap, addr_t pa, void *vaddr, int attr)
+{
+	return -1;
+}
+
+
 static inline addr_t pmap_resolve(pmap_t *pmap, void *vaddr)
 {
 	return (addr_t)vaddr;
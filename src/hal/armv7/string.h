@@ -20,33 +20,53 @@
 #include "cpu.h"
 
 
+/* Words are copied when source and destination are equally misaligned, bulk goes in 32 byte blocks */
 static inline void hal_memcpy(void *dst, const void *src, unsigned int l)
 {
 	__asm__ volatile
 	(" \
 		mov r1, %2; \
 		mov r3, %1; \
-		mov r4, %0; \
-		orr r2, r3, r4; \
-		ands r2, #3; \
-		bne 2f; \
+		mov r12, %0; \
+		eor r2, r3, r12; \
+		tst r2, #3; \
+		bne 4f; \
 	1: \
-		cmp r1, #4; \
-		ittt hs; \
-		ldrhs r2, [r3], #4; \
-		strhs r2, [r4], #4; \
-		subshs r1, #4; \
-		bhs 1b; \
+		tst r12, #3; \
+		beq 2f; \
+		cmp r1, #0; \
+		beq 5f; \
+		ldrb r2, [r3], #1; \
+		strb r2, [r12], #1; \
+		sub r1, r1, #1; \
+		b 1b; \
 	2: \
+		cmp r1, #32; \
+		blo 3f; \
+		ldmia r3!, {r2, r4, r5, r6}; \
+		stmia r12!, {r2, r4, r5, r6}; \
+		ldmia r3!, {r2, r4, r5, r6}; \
+		stmia r12!, {r2, r4, r5, r6}; \
+		sub r1, r1, #32; \
+		b 2b; \
+	3: \
+		cmp r1, #4; \
+		blo 4f; \
+		ldr r2, [r3], #4; \
+		str r2, [r12], #4; \
+		sub r1, r1, #4; \
+		b 3b; \
+	4: \
 		cmp r1, #0; \
-		ittt ne; \
-		ldrbne r2, [r3], #1; \
-		strbne r2, [r4], #1; \
-		subsne r1, #1; \
-		bne 2b"
+		beq 5f; \
+		ldrb r2, [r3], #1; \
+		strb r2, [r12], #1; \
+		sub r1, r1, #1; \
+		b 4b; \
+	5:"
 	:
 	: "r" (dst), "r" (src), "r" (l)
-	: "r1", "r2", "r3", "r4", "memory", "cc");
+	: "r1", "r2", "r3", "r4", "r5", "r6", "r12", "memory", "cc");
 }
 
 
@@ -89,24 +109,84 @@ static inline void hal_memset(void *dst, int v, unsigned int l)
 		mov r3, %1; \
 		orr r3, r3, r3, lsl #8; \
 		orr r3, r3, r3, lsl #16; \
-		mov r4, %0; \
-		ands r2, r4, #3; \
-		bne 2f; \
+		mov r4, r3; \
+		mov r5, r3; \
+		mov r6, r3; \
+		mov r12, %0; \
 	1: \
-		cmp r1, #4; \
-		itt hs; \
-		strhs r3, [r4], #4; \
-		subshs r1, #4; \
-		bhs 1b; \
+		tst r12, #3; \
+		beq 2f; \
+		cmp r1, #0; \
+		beq 5f; \
+		strb r3, [r12], #1; \
+		sub r1, r1, #1; \
+		b 1b; \
 	2: \
+		cmp r1, #32; \
+		blo 3f; \
+		stmia r12!, {r3, r4, r5, r6}; \
+		stmia r12!, {r3, r4, r5, r6}; \
+		sub r1, r1, #32; \
+		b 2b; \
+	3: \
+		cmp r1, #4; \
+		blo 4f; \
+		str r3, [r12], #4; \
+		sub r1, r1, #4; \
+		b 3b; \
+	4: \
 		cmp r1, #0; \
-		itt ne; \
-		strbne r3, [r4], #1; \
-		subsne r1, #1; \
-		bne 2b"
+		beq 5f; \
+		strb r3, [r12], #1; \
+		sub r1, r1, #1; \
+		b 4b; \
+	5:"
 	:
 	: "r" (dst), "r" (v & 0xff), "r" (l)
-	: "r1", "r2", "r3", "r4", "memory", "cc");
+	: "r1", "r3", "r4", "r5", "r6", "r12", "memory", "cc");
+}
+
+
+/* Function copies n bytes, n has to be a multiple of 32 and both addresses 8 byte aligned */
+static inline void hal_pagecpy(void *dst, const void *src, unsigned int l)
+{
+	__asm__ volatile
+	(" \
+		mov r3, %1; \
+		mov r12, %0; \
+		add r1, r12, %2; \
+	1: \
+		ldmia r3!, {r2, r4, r5, r6}; \
+		stmia r12!, {r2, r4, r5, r6}; \
+		ldmia r3!, {r2, r4, r5, r6}; \
+		stmia r12!, {r2, r4, r5, r6}; \
+		cmp r12, r1; \
+		bne 1b"
+	:
+	: "r" (dst), "r" (src), "r" (l)
+	: "r1", "r2", "r3", "r4", "r5", "r6", "r12", "memory", "cc");
+}
+
+
+/* Function clears n bytes, n has to be a multiple of 32 and dst 8 byte aligned */
+static inline void hal_memclr(void *dst, unsigned int l)
+{
+	__asm__ volatile
+	(" \
+		mov r1, #0; \
+		mov r2, #0; \
+		mov r3, #0; \
+		mov r4, #0; \
+		mov r5, %0; \
+		add r12, r5, %1; \
+	1: \
+		stmia r5!, {r1-r4}; \
+		stmia r5!, {r1-r4}; \
+		cmp r5, r12; \
+		bne 1b"
+	:
+	: "r" (dst), "r" (l)
+	: "r1", "r2", "r3", "r4", "r5", "r12", "memory", "cc");
 }
 
 
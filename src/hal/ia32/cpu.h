@@ -337,6 +337,36 @@ static inline void hal_cpuEnableInterrupts(void)
 }
 
 
+/* Function disables interrupts and returns previous flags for hal_cpuRestoreInterrupts() */
+static inline u32 hal_cpuSaveInterrupts(void)
+{
+	u32 eflags;
+
+	__asm__ volatile
+	(" \
+		pushf; \
+		popl %0; \
+		cli"
+	:"=r" (eflags)
+	:
+	:"memory");
+
+	return eflags;
+}
+
+
+static inline void hal_cpuRestoreInterrupts(u32 eflags)
+{
+	__asm__ volatile
+	(" \
+		pushl %0; \
+		popf"
+	:
+	:"r" (eflags)
+	:"memory", "cc");
+}
+
+
 /* performance */
 
 
@@ -370,10 +400,16 @@ static inline void hal_cpuGetCycles(void *cb)
 /* memory management */
 
 
+/* Function invalidates translation of vaddr, whole TLB is flushed for NULL */
 static inline void hal_cpuFlushTLB(void *vaddr)
 {
 	unsigned long tmpreg;
 
+	if (vaddr != NULL) {
+		__asm__ volatile ("invlpg (%0)"::"r" (vaddr):"memory");
+		return;
+	}
+
 	do {
 
 		__asm__ volatile
@@ -404,6 +440,19 @@ static inline void hal_cpuSwitchSpace(addr_t cr3)
 }
 
 
+static inline addr_t hal_cpuGetSpace(void)
+{
+	addr_t cr3;
+
+	__asm__ volatile
+	(" \
+		movl %%cr3, %0"
+	:"=r" (cr3));
+
+	return cr3;
+}
+
+
 /* bit operations */
 
 
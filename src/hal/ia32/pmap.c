@@ -29,6 +29,14 @@ extern void _end(void);
 extern void _etext(void);
 
 
+/* Last page directory entry points at the directory, page tables of loaded address space are seen below it */
+#define PMAP_RECURSIVE  1023
+#define PMAP_PTABLES    ((addr_t *)((u32)PMAP_RECURSIVE << 22))
+
+/* Larger ranges flush whole TLB instead of each page */
+#define PMAP_INVALMAX   32
+
+
 __attribute__((aligned(SIZE_PAGE)))
 struct {
 	u8 heap[SIZE_PAGE];
@@ -56,6 +64,8 @@ int pmap_create(pmap_t *pmap, pmap_t *kpmap, page_t *p, void *vaddr)
 	for (i = 0; i < pages; vaddr += (SIZE_PAGE << 10), ++i)
 		pmap->pdir[(u32) vaddr >> 22] = kpmap->pdir[(u32) vaddr >> 22];
 
+	pmap->pdir[PMAP_RECURSIVE] = (pmap->cr3 & ~0xfff) | PTHD_WRITE | PTHD_PRESENT;
+
 	return EOK;
 }
 
@@ -65,7 +75,7 @@ addr_t pmap_destroy(pmap_t *pmap, int *i)
 	int kernel = ((VADDR_KERNEL + SIZE_PAGE) & ~(SIZE_PAGE - 1)) >> 22;
 
 	while (*i < kernel) {
-		if (pmap->pdir[*i] != NULL)
+		if (pmap->pdir[*i] != NULL && !(pmap->pdir[*i] & PTHD_SUPER))
 			return pmap->pdir[(*i)++] & ~0xfff;
 		(*i)++;
 	}
@@ -80,41 +90,163 @@ void pmap_switch(pmap_t *pmap)
 }
 
 
+/* Function maps page table at scratch window, called with pmap_common.lock held */
+static void _pmap_mapScratch(addr_t pt)
+{
+	addr_t *ptable = (addr_t *)(syspage->ptable + VADDR_KERNEL);
+
+	ptable[((u32)pmap_common.ptable >> 12) & 0x000003ff] = (pt & ~0xfff) | (PGHD_WRITE | PGHD_PRESENT);
+	hal_cpuFlushTLB(pmap_common.ptable);
+}
+
+
+/*
+ * Kernel page tables are shared by all page directories and user ones of loaded directory are
+ * seen through the recursive entry, both are edited in place with interrupts disabled so the
+ * directory stays loaded. Only other address spaces need scratch window and pmap_common.lock.
+ */
+static int _pmap_begin(pmap_t *pmap, void *vaddr, u32 *eflags)
+{
+	*eflags = hal_cpuSaveInterrupts();
+
+	if (((u32)vaddr >= VADDR_KERNEL) || (hal_cpuGetSpace() == pmap->cr3))
+		return 1;
+
+	hal_cpuRestoreInterrupts(*eflags);
+	hal_spinlockSet(&pmap_common.lock);
+
+	return 0;
+}
+
+
+static void _pmap_end(int loaded, u32 eflags)
+{
+	if (loaded)
+		hal_cpuRestoreInterrupts(eflags);
+	else
+		hal_spinlockClear(&pmap_common.lock);
+}
+
+
+/* Function returns page table of pdi, table of address space not loaded is mapped at scratch window */
+static addr_t *_pmap_ptable(pmap_t *pmap, unsigned int pdi, int loaded)
+{
+	if (loaded)
+		return PMAP_PTABLES + (pdi << 10);
+
+	_pmap_mapScratch(pmap->pdir[pdi]);
+
+	return pmap_common.ptable;
+}
+
+
+/* Function invalidates translations of range in loaded address space */
+static void _pmap_invalRange(void *vaddr, void *end)
+{
+	if (end - vaddr > PMAP_INVALMAX * SIZE_PAGE) {
+		hal_cpuFlushTLB(NULL);
+		return;
+	}
+
+	for (; vaddr < end; vaddr += SIZE_PAGE)
+		hal_cpuFlushTLB(vaddr);
+}
+
+
+/* Function changes page directory entry, its translations and recursive view are invalidated if loaded */
+static void _pmap_setPde(pmap_t *pmap, unsigned int pdi, addr_t pde)
+{
+	pmap->pdir[pdi] = pde;
+
+	if (hal_cpuGetSpace() == pmap->cr3) {
+		hal_cpuFlushTLB((void *)(pdi << 22));
+		hal_cpuFlushTLB(PMAP_PTABLES + (pdi << 10));
+	}
+}
+
+
 /* Functions maps page at specified address */
 int pmap_enter(pmap_t *pmap, addr_t pa, void *va, int attr, page_t *alloc)
 {
-	unsigned int pdi, pti;
-	addr_t addr, *ptable;
+	return pmap_enterRange(pmap, pa, va, SIZE_PAGE, attr, alloc);
+}
 
-	pdi = (u32)va >> 22;
-	pti = ((u32)va >> 12) & 0x000003ff;
 
-	/* If no page table is allocated add new one */
-	if (!pmap->pdir[pdi]) {
+/* Function maps physically contiguous range, page tables are filled in place and TLB is flushed once */
+int pmap_enterRange(pmap_t *pmap, addr_t pa, void *vaddr, size_t size, int attr, page_t *alloc)
+{
+	unsigned int pdi, pti, i;
+	addr_t super, *ptable;
+	void *end = vaddr + size, *v;
+	u32 eflags;
+	int loaded;
+
+	/* Missing page tables are added before any entry is written, alloc covers one of them */
+	for (v = vaddr; v < end; v = (void *)((pdi + 1) << 22)) {
+		pdi = (u32)v >> 22;
+
+		if (pmap->pdir[pdi] && !(pmap->pdir[pdi] & PTHD_SUPER))
+			continue;
+
 		if (alloc == NULL)
 			return -EFAULT;
-		pmap->pdir[pdi] = ((alloc->addr & ~0xfff) | (attr & 0xfff) | PTHD_USER | PTHD_WRITE | PTHD_PRESENT);
-	}
 
-	hal_spinlockSet(&pmap_common.lock);
+		hal_spinlockSet(&pmap_common.lock);
+
+		/* Superpage is replicated in page table before it is linked, its PSE bit means PAT in page table entry */
+		if ((super = pmap->pdir[pdi]) != 0) {
+			_pmap_mapScratch(alloc->addr);
+
+			for (i = 0; i < 1024; i++)
+				pmap_common.ptable[i] = ((super & ~(SIZE_SUPERPAGE - 1)) + (i << 12)) | (super & 0x7f);
+
+			_pmap_setPde(pmap, pdi, (alloc->addr & ~0xfff) | PTHD_USER | PTHD_WRITE | PTHD_PRESENT);
+		}
+		else {
+			_pmap_setPde(pmap, pdi, (alloc->addr & ~0xfff) | (attr & 0xfff & ~PTHD_SUPER) | PTHD_USER | PTHD_WRITE | PTHD_PRESENT);
+		}
 
-	/* Map selected page table to specified virtual address */
-	addr = pmap->pdir[pdi];
-	if ((u32)pmap_common.ptable < VADDR_KERNEL) {
 		hal_spinlockClear(&pmap_common.lock);
-		return -EFAULT;
+
+		alloc = NULL;
 	}
 
-	/* Map selected page table */
-	ptable = (addr_t *)(syspage->ptable + VADDR_KERNEL);
-	ptable[((u32)pmap_common.ptable >> 12) & 0x000003ff] = (addr & ~0xfff) | (PGHD_WRITE | PGHD_PRESENT | PGHD_USER);
+	loaded = _pmap_begin(pmap, vaddr, &eflags);
 
-	hal_cpuFlushTLB(pmap_common.ptable);
+	for (v = vaddr; v < end;) {
+		ptable = _pmap_ptable(pmap, (u32)v >> 22, loaded);
 
-	/* And at last map page or only changle attributes of map entry */
-	pmap_common.ptable[pti] = ((pa & ~0xfff) | (attr & 0xfff) | PGHD_PRESENT);
+		for (pti = ((u32)v >> 12) & 0x000003ff; (pti < 1024) && (v < end); pti++, v += SIZE_PAGE, pa += SIZE_PAGE)
+			ptable[pti] = ((pa & ~0xfff) | (attr & 0xfff) | PGHD_PRESENT);
+	}
+
+	/* Translations of address space that isn't loaded can't be cached */
+	if (loaded)
+		_pmap_invalRange(vaddr, end);
 
-	hal_cpuFlushTLB(va);
+	_pmap_end(loaded, eflags);
+
+	return EOK;
+}
+
+
+/* Function maps 4MB page with single page directory entry */
+int pmap_enterSuper(pmap_t *pmap, addr_t pa, void *va, int attr)
+{
+	unsigned int pdi = (u32)va >> 22;
+
+	/* Kernel page tables are shared by all page directories */
+	if (((pa | (u32)va) & (SIZE_SUPERPAGE - 1)) || ((u32)va >= VADDR_KERNEL) || !(attr & PGHD_PRESENT))
+		return -EINVAL;
+
+	hal_spinlockSet(&pmap_common.lock);
+
+	if (pmap->pdir[pdi] && !(pmap->pdir[pdi] & PTHD_SUPER)) {
+		hal_spinlockClear(&pmap_common.lock);
+		return -EEXIST;
+	}
+
+	_pmap_setPde(pmap, pdi, (pa & ~(SIZE_SUPERPAGE - 1)) | (attr & 0xfff) | PTHD_SUPER | PGHD_PRESENT);
 
 	hal_spinlockClear(&pmap_common.lock);
 
@@ -123,37 +255,101 @@ int pmap_enter(pmap_t *pmap, addr_t pa, void *va, int attr, page_t *alloc)
 
 
 int pmap_remove(pmap_t *pmap, void *vaddr)
+{
+	return pmap_removeRange(pmap, vaddr, SIZE_PAGE);
+}
+
+
+/* Function unmaps range walking each page table once, TLB is flushed once at the end */
+int pmap_removeRange(pmap_t *pmap, void *vaddr, size_t size)
 {
 	unsigned int pdi, pti;
-	addr_t addr, *ptable;
+	addr_t *ptable;
+	void *start = vaddr, *end = vaddr + size;
+	u32 eflags;
+	int loaded, changed = 0;
 
-	pdi = (u32)vaddr >> 22;
-	pti = ((u32)vaddr >> 12) & 0x000003ff;
+	loaded = _pmap_begin(pmap, vaddr, &eflags);
 
-	/* no page table is allocated => page is not mapped */
-	if (!pmap->pdir[pdi])
-		return EOK;
+	while (vaddr < end) {
+		pdi = (u32)vaddr >> 22;
 
-	hal_spinlockSet(&pmap_common.lock);
+		/* no page table is allocated => pages are not mapped */
+		if (!pmap->pdir[pdi]) {
+			vaddr = (void *)((pdi + 1) << 22);
+			continue;
+		}
 
-	/* Map selected page table to specified virtual address */
-	addr = pmap->pdir[pdi];
-	if ((u32)pmap_common.ptable < VADDR_KERNEL) {
-		hal_spinlockClear(&pmap_common.lock);
-		return -EFAULT;
+		/* Removing any page of superpage drops it, the rest is faulted in pages */
+		if (pmap->pdir[pdi] & PTHD_SUPER) {
+			_pmap_setPde(pmap, pdi, 0);
+			vaddr = (void *)((pdi + 1) << 22);
+			continue;
+		}
+
+		ptable = _pmap_ptable(pmap, pdi, loaded);
+
+		for (pti = ((u32)vaddr >> 12) & 0x000003ff; (pti < 1024) && (vaddr < end); pti++, vaddr += SIZE_PAGE) {
+			if (ptable[pti]) {
+				ptable[pti] = 0;
+				changed = 1;
+			}
+		}
 	}
 
-	/* Map selected page table */
-	ptable = (addr_t *)(syspage->ptable + VADDR_KERNEL);
-	ptable[((u32)pmap_common.ptable >> 12) & 0x000003ff] = (addr & ~0xfff) | (PGHD_WRITE | PGHD_PRESENT);
+	if (loaded && changed)
+		_pmap_invalRange(start, end);
 
-	hal_cpuFlushTLB(pmap_common.ptable);
+	_pmap_end(loaded, eflags);
 
-	/* Unmap page */
-	pmap_common.ptable[pti] = 0;
+	return EOK;
+}
 
-	hal_cpuFlushTLB(vaddr);
-	hal_spinlockClear(&pmap_common.lock);
+
+int pmap_protect(pmap_t *pmap, void *vaddr, size_t size, int attr)
+{
+	unsigned int pdi, pti;
+	addr_t *ptable;
+	void *start = vaddr, *end = vaddr + size;
+	u32 eflags;
+	int loaded, changed = 0;
+
+	loaded = _pmap_begin(pmap, vaddr, &eflags);
+
+	while (vaddr < end) {
+		pdi = (u32)vaddr >> 22;
+
+		if (!pmap->pdir[pdi]) {
+			vaddr = (void *)((pdi + 1) << 22);
+			continue;
+		}
+
+		/* Superpage changes as a whole or is dropped when range covers it partially */
+		if (pmap->pdir[pdi] & PTHD_SUPER) {
+			if (!((u32)vaddr & (SIZE_SUPERPAGE - 1)) && (end - vaddr >= SIZE_SUPERPAGE))
+				_pmap_setPde(pmap, pdi, (pmap->pdir[pdi] & ~0xfff) | (attr & 0xfff) | PTHD_SUPER | PGHD_PRESENT);
+			else
+				_pmap_setPde(pmap, pdi, 0);
+
+			vaddr = (void *)((pdi + 1) << 22);
+			continue;
+		}
+
+		/* Page table is mapped once and all its entries in range are updated */
+		ptable = _pmap_ptable(pmap, pdi, loaded);
+
+		for (pti = ((u32)vaddr >> 12) & 0x000003ff; (pti < 1024) && (vaddr < end); pti++, vaddr += SIZE_PAGE) {
+			if (ptable[pti] & PGHD_PRESENT) {
+				ptable[pti] = (ptable[pti] & ~0xfff) | (attr & 0xfff) | PGHD_PRESENT;
+				changed = 1;
+			}
+		}
+	}
+
+	if (loaded && changed)
+		_pmap_invalRange(start, end);
+
+	_pmap_end(loaded, eflags);
 
 	return EOK;
 }
@@ -163,7 +359,9 @@ int pmap_remove(pmap_t *pmap, void *vaddr)
 addr_t pmap_resolve(pmap_t *pmap, void *vaddr)
 {
 	unsigned int pdi, pti;
-	addr_t addr, *ptable;
+	addr_t addr;
+	u32 eflags;
+	int loaded;
 
 	pdi = (u32)vaddr >> 22;
 	pti = ((u32)vaddr >> 12) & 0x000003ff;
@@ -171,22 +369,13 @@ addr_t pmap_resolve(pmap_t *pmap, void *vaddr)
 	if (!pmap->pdir[pdi])
 		return 0;
 
-	hal_spinlockSet(&pmap_common.lock);
+	/* Superpage entry is returned in page table entry format */
+	if ((addr = pmap->pdir[pdi]) & PTHD_SUPER)
+		return ((addr & ~(SIZE_SUPERPAGE - 1)) + (pti << 12)) | (addr & 0x7f);
 
-	/* Map page table corresponding to vaddr at specified virtual address */
-	addr = pmap->pdir[pdi];
-
-	ptable = (addr_t *)(syspage->ptable + VADDR_KERNEL);
-	ptable[((u32)pmap_common.ptable >> 12) & 0x000003ff] = (addr & ~0xfff) | (PGHD_WRITE | PGHD_PRESENT);
-	hal_cpuFlushTLB(pmap_common.ptable);
-
-	addr = (addr_t)pmap_common.ptable[pti];
-	hal_spinlockClear(&pmap_common.lock);
-
-	/*if (((*paddr) & PGHD_PRESENT) == 0)
-		return -ENOMEM;
-
-	*paddr = ((*paddr) & ~0xfff) | ((u32)vaddr & 0xfff);*/
+	loaded = _pmap_begin(pmap, vaddr, &eflags);
+	addr = _pmap_ptable(pmap, pdi, loaded)[pti];
+	_pmap_end(loaded, eflags);
 
 	return addr;
 }
@@ -332,6 +521,9 @@ int _pmap_kernelSpaceExpand(pmap_t *pmap, void **start, void *end, page_t *dp)
 	if (vaddr < (void *)VADDR_KERNEL)
 		vaddr = (void *)VADDR_KERNEL;
 
+	if (end > (void *)PMAP_PTABLES)
+		end = (void *)PMAP_PTABLES;
+
 	for (; vaddr < end; vaddr += (SIZE_PAGE << 10)) {
 		if (pmap_enter(pmap, 0, vaddr, ~PGHD_PRESENT, NULL) < 0) {
 			if (pmap_enter(pmap, 0, vaddr, ~PGHD_PRESENT, dp) < 0) {
@@ -411,9 +603,10 @@ void _pmap_init(pmap_t *pmap, void **vstart, void **vend)
 	pmap->pdir = VADDR_KERNEL + (void *)syspage->pdir;
 	pmap->pdir[0] = 0;
 	pmap->cr3 = syspage->pdir;
+	pmap->pdir[PMAP_RECURSIVE] = (pmap->cr3 & ~0xfff) | PTHD_WRITE | PTHD_PRESENT;
 
 	pmap->start = (void *)VADDR_KERNEL;
-	pmap->end = (void *)VADDR_MAX;
+	pmap->end = (void *)PMAP_PTABLES;
 
 	hal_cpuFlushTLB(NULL);
 
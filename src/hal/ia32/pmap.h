@@ -20,6 +20,9 @@
 #define SIZE_PAGE      0x1000
 #define SIZE_PDIR      SIZE_PAGE
 
+/* 4MB PSE page mapped by a single page directory entry */
+#define SIZE_SUPERPAGE (SIZE_PAGE << 10)
+
 
 /* Predefined virtual adresses */
 #define VADDR_KERNEL   0xc0000000   /* base virtual address of kernel space */
@@ -41,6 +44,7 @@
 #define PTHD_PRESENT  0x01
 #define PTHD_USER     0x04
 #define PTHD_WRITE    0x02
+#define PTHD_SUPER    0x80
 
 
 /* Page flags */
@@ -104,10 +108,26 @@ extern void pmap_switch(pmap_t *pmap);
 extern int pmap_enter(pmap_t *pmap, addr_t addr, void *vaddr, int attrs, page_t *alloc);
 
 
+/* Function maps physically contiguous range, fails with -EFAULT if more page tables are needed than given */
+extern int pmap_enterRange(pmap_t *pmap, addr_t addr, void *vaddr, size_t size, int attrs, page_t *alloc);
+
+
+/* Function maps SIZE_SUPERPAGE aligned region with one translation, fails if a page table covers it */
+extern int pmap_enterSuper(pmap_t *pmap, addr_t addr, void *vaddr, int attrs);
+
+
 /* Function removes mapping for given address */
 extern int pmap_remove(pmap_t *pmap, void *vaddr);
 
 
+/* Function removes mappings in range, TLB is flushed once */
+extern int pmap_removeRange(pmap_t *pmap, void *vaddr, size_t size);
+
+
+/* Function changes attributes of pages mapped in range, TLB is flushed once */
+extern int pmap_protect(pmap_t *pmap, void *vaddr, size_t size, int attr);
+
+
 extern addr_t pmap_resolve(pmap_t *pmap, void *vaddr);
 
 
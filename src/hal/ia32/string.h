@@ -22,23 +22,30 @@
 #include "cpu.h"
 
 
+/* Destination is aligned first, so string moves run on aligned stores */
 static inline void hal_memcpy(void *to, const void *from, unsigned int n)
 {
 	__asm__ volatile
 	(" \
 		cld; \
-		movl %0, %%ecx; \
-		movl %%ecx, %%edx; \
+		cmpl $16, %%ecx; \
+		jb 1f; \
+		movl %%edi, %%edx; \
+		negl %%edx; \
 		andl $3, %%edx; \
+		subl %%edx, %%ecx; \
+		xchgl %%edx, %%ecx; \
+		rep; movsb; \
+		movl %%edx, %%ecx; \
 		shrl $2, %%ecx; \
-		movl %1, %%edi; \
-		movl %2, %%esi; \
+		andl $3, %%edx; \
 		rep; movsl; \
 		movl %%edx, %%ecx; \
+	1: \
 		rep; movsb"
+	: "+D" (to), "+S" (from), "+c" (n)
 	:
-	: "g" (n), "g" (to), "g" (from)
-	: "ecx", "edx", "esi", "edi", "cc", "memory");
+	: "edx", "cc", "memory");
 }
 
 
@@ -47,27 +54,56 @@ static inline void hal_memset(void *where, u8 v, unsigned int n)
 	__asm__ volatile
 	(" \
 		cld; \
-		movl %0, %%ecx; \
-		movl %%ecx, %%edx; \
+		cmpl $16, %%ecx; \
+		jb 1f; \
+		movl %%edi, %%edx; \
+		negl %%edx; \
 		andl $3, %%edx; \
+		subl %%edx, %%ecx; \
+		xchgl %%edx, %%ecx; \
+		rep; stosb; \
+		movl %%edx, %%ecx; \
 		shrl $2, %%ecx; \
-		\
-		xorl %%eax, %%eax; \
-		movb %1, %%al; \
-		movl %%eax, %%ebx; \
-		shll $8, %%ebx; \
-		orl %%ebx, %%eax; \
-		movl %%eax, %%ebx; \
-		shll $16, %%ebx; \
-		orl %%ebx, %%eax; \
-		\
-		movl %2, %%edi; \
+		andl $3, %%edx; \
 		rep; stosl; \
 		movl %%edx, %%ecx; \
+	1: \
 		rep; stosb"
-	: "+d" (n)
-	: "m" (v), "m" (where)
-	: "eax", "ebx", "cc", "ecx", "edi" ,"memory");
+	: "+D" (where), "+c" (n)
+	: "a" (0x01010101U * v)
+	: "edx", "cc", "memory");
+}
+
+
+/* Function copies n bytes, n has to be a multiple of 32 and both addresses 8 byte aligned */
+static inline void hal_pagecpy(void *to, const void *from, unsigned int n)
+{
+	n >>= 2;
+
+	__asm__ volatile
+	(" \
+		cld; \
+		rep; movsl"
+	: "+D" (to), "+S" (from), "+c" (n)
+	:
+	: "cc", "memory");
+}
+
+
+/* Function clears n bytes, n has to be a multiple of 32 and where 8 byte aligned */
+static inline void hal_memclr(void *where, unsigned int n)
+{
+	__asm__ volatile
+	(" \
+		cld; \
+		xorl %%eax, %%eax; \
+		movl %0, %%ecx; \
+		shrl $2, %%ecx; \
+		movl %1, %%edi; \
+		rep; stosl"
+	:
+	: "g" (n), "g" (where)
+	: "eax", "ecx", "edi", "cc", "memory");
 }
 
 
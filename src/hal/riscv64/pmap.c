@@ -153,6 +153,40 @@ int pmap_remove(pmap_t *pmap, void *vaddr)
 }
 
 
+/* Range is entered page by page until Sv39 tables are walked in place */
+int pmap_enterRange(pmap_t *pmap, addr_t pa, void *vaddr, size_t size, int attr, page_t *alloc)
+{
+	void *end = vaddr + size;
+	int err;
+
+	for (; vaddr < end; vaddr += SIZE_PAGE, pa += SIZE_PAGE) {
+		if ((err = pmap_enter(pmap, pa, vaddr, attr, alloc)) < 0)
+			return err;
+		alloc = NULL;
+	}
+
+	return EOK;
+}
+
+
+int pmap_removeRange(pmap_t *pmap, void *vaddr, size_t size)
+{
+	return EOK;
+}
+
+
+int pmap_protect(pmap_t *pmap, void *vaddr, size_t size, int attr)
+{
+	return EOK;
+}
+
+
+int pmap_enterSuper(pmap_t *pmap, addr_t pa, void *vaddr, int attr)
+{
+	return -EINVAL;
+}
+
+
 /* Functions returs physical address associated with specified virtual address */
 addr_t pmap_resolve(pmap_t *pmap, void *vaddr)
 {
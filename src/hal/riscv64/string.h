@@ -28,6 +28,35 @@ extern void *hal_memcpy(void *to, const void *from, unsigned int n);
 extern void hal_memset(void *where, u8 v, unsigned int n);
 
 
+/* Function copies n bytes, n has to be a multiple of 32 and both addresses 8 byte aligned */
+static inline void hal_pagecpy(void *to, const void *from, unsigned int n)
+{
+	u64 *d = to, *end = to + n;
+	const u64 *s = from;
+
+	for (; d < end; d += 4, s += 4) {
+		d[0] = s[0];
+		d[1] = s[1];
+		d[2] = s[2];
+		d[3] = s[3];
+	}
+}
+
+
+/* Function clears n bytes, n has to be a multiple of 32 and where 8 byte aligned */
+static inline void hal_memclr(void *where, unsigned int n)
+{
+	u64 *p = where, *end = where + n;
+
+	for (; p < end; p += 4) {
+		p[0] = 0;
+		p[1] = 0;
+		p[2] = 0;
+		p[3] = 0;
+	}
+}
+
+
 static inline void hal_memsetw(void *where, u16 v, unsigned int n)
 {
 #if 0
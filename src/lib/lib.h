@@ -24,6 +24,7 @@
 #include "strtoul.h"
 #include "rb.h"
 #include "list.h"
+#include "wheel.h"
 
 
 #define max(a, b) ({ \
@@ -0,0 +1,206 @@
+/*
+ * Phoenix-RTOS
+ *
+ * Operating system kernel
+ *
+ * Standard routines - hierarchical timing wheel
+ *
+ * Copyright 2018 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#include HAL
+#include "lib.h"
+
+
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+
+
+static unsigned int wheel_slotAfter(u32 mask, unsigned int from)
+{
+	u32 m;
+
+	/* First non-empty slot at or after given index, wrapping around */
+	if ((m = mask & (~0U << from)) == 0)
+		m = mask;
+
+	return hal_cpuGetFirstBit(m);
+}
+
+
+/* Returns first tick at which a non-empty slot is going to be processed */
+static time_t wheel_nextTick(wheel_t *wheel, unsigned int *level)
+{
+	time_t next = (time_t)-1, t;
+	unsigned int l, sh, c, s;
+
+	for (l = 0; l < WHEEL_LEVELS; l++) {
+		if (!wheel->mask[l])
+			continue;
+
+		sh = l * WHEEL_BITS;
+		c = (wheel->tick >> sh) & WHEEL_MASK;
+
+		if (l == 0) {
+			s = wheel_slotAfter(wheel->mask[l], c);
+			t = wheel->tick + ((s - c) & WHEEL_MASK);
+		}
+		else {
+			/* Current slot of upper level has been already cascaded */
+			s = wheel_slotAfter(wheel->mask[l], (c + 1) & WHEEL_MASK);
+			t = ((wheel->tick >> sh) + ((s - c - 1) & WHEEL_MASK) + 1) << sh;
+		}
+
+		/* On tie prefer upper level - its slot is cascaded before the finest one is processed */
+		if (t <= next) {
+			next = t;
+			*level = l;
+		}
+	}
+
+	return next;
+}
+
+
+static void wheel_cascade(wheel_t *wheel)
+{
+	unsigned int l, sh, idx;
+	wheelnode_t *node, *list;
+
+	for (l = 1; l < WHEEL_LEVELS; l++) {
+		sh = l * WHEEL_BITS;
+
+		if (wheel->tick & (((time_t)1 << sh) - 1))
+			break;
+
+		idx = (wheel->tick >> sh) & WHEEL_MASK;
+
+		if ((list = wheel->slots[l][idx]) == NULL)
+			continue;
+
+		wheel->slots[l][idx] = NULL;
+		wheel->mask[l] &= ~(1 << idx);
+
+		while ((node = list) != NULL) {
+			LIST_REMOVE(&list, node);
+			lib_wheelInsert(wheel, node, node->expires);
+		}
+	}
+}
+
+
+void lib_wheelInsert(wheel_t *wheel, wheelnode_t *node, time_t expires)
+{
+	time_t t, tick = wheel->tick;
+	unsigned int l, sh, idx;
+
+	node->expires = expires;
+
+	if ((t = expires >> wheel->shift) < tick)
+		t = tick;
+
+	/* Find the finest level which still reaches the deadline */
+	for (l = 0; l < WHEEL_LEVELS - 1; l++) {
+		sh = l * WHEEL_BITS;
+
+		if ((t >> sh) - (tick >> sh) < WHEEL_SLOTS)
+			break;
+	}
+
+	sh = l * WHEEL_BITS;
+
+	if ((t >> sh) - (tick >> sh) < WHEEL_SLOTS)
+		idx = (t >> sh) & WHEEL_MASK;
+	else
+		idx = ((tick >> sh) + WHEEL_SLOTS - 1) & WHEEL_MASK;
+
+	node->slot = &wheel->slots[l][idx];
+	LIST_ADD(node->slot, node);
+	wheel->mask[l] |= 1 << idx;
+}
+
+
+void lib_wheelRemove(wheel_t *wheel, wheelnode_t *node)
+{
+	unsigned int n = node->slot - &wheel->slots[0][0];
+
+	LIST_REMOVE(node->slot, node);
+
+	if (*node->slot == NULL)
+		wheel->mask[n >> WHEEL_BITS] &= ~(1 << (n & WHEEL_MASK));
+
+	node->slot = NULL;
+}
+
+
+wheelnode_t *lib_wheelExpire(wheel_t *wheel, time_t now)
+{
+	wheelnode_t *node, **slot;
+	time_t target = now >> wheel->shift, next;
+	unsigned int l;
+
+	for (;;) {
+		slot = &wheel->slots[0][wheel->tick & WHEEL_MASK];
+
+		if ((node = *slot) != NULL) {
+			do {
+				if (node->expires <= now) {
+					lib_wheelRemove(wheel, node);
+					return node;
+				}
+			} while ((node = node->next) != *slot);
+		}
+
+		if (wheel->tick >= target)
+			return NULL;
+
+		wheel->tick++;
+		wheel_cascade(wheel);
+
+		/* Skip empty slots */
+		if ((next = wheel_nextTick(wheel, &l)) > target)
+			next = target;
+
+		if (next > wheel->tick) {
+			wheel->tick = next;
+			wheel_cascade(wheel);
+		}
+	}
+}
+
+
+time_t lib_wheelNext(wheel_t *wheel)
+{
+	wheelnode_t *node, *slot;
+	time_t next;
+	unsigned int l;
+
+	if ((next = wheel_nextTick(wheel, &l)) == (time_t)-1)
+		return 0;
+
+	if (l != 0)
+		return next << wheel->shift;
+
+	/* Finest level slot - find exact deadline */
+	node = slot = wheel->slots[0][next & WHEEL_MASK];
+	next = node->expires;
+
+	while ((node = node->next) != slot) {
+		if (node->expires < next)
+			next = node->expires;
+	}
+
+	return next;
+}
+
+
+void lib_wheelInit(wheel_t *wheel, unsigned int shift, time_t now)
+{
+	hal_memset(wheel, 0, sizeof(*wheel));
+
+	wheel->shift = shift;
+	wheel->tick = now >> shift;
+}
@@ -0,0 +1,80 @@
+/*
+ * Phoenix-RTOS
+ *
+ * Operating system kernel
+ *
+ * Standard routines - hierarchical timing wheel
+ *
+ * Copyright 2018 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _LIB_WHEEL_H_
+#define _LIB_WHEEL_H_
+
+#include HAL
+
+
+/*
+ * Wheel geometry. Wheel covers (1 << (WHEEL_LEVELS * WHEEL_BITS)) units of its
+ * resolution, timeouts beyond that range are parked in the last slot and
+ * re-inserted when it is cascaded.
+ */
+
+#ifndef WHEEL_LEVELS
+#define WHEEL_LEVELS 5
+#endif
+
+#ifndef WHEEL_BITS
+#define WHEEL_BITS 5
+#endif
+
+#if WHEEL_BITS > 5
+#error "WHEEL_BITS can't exceed 5 - slot masks are 32-bit"
+#endif
+
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+
+
+#define lib_wheelof(type, node_field, node) ({					\
+	long _off = (long) &(((type *) 0)->node_field);				\
+	wheelnode_t *tmpnode = (node);					\
+	(type *) ((tmpnode == NULL) ? NULL : ((void *) tmpnode - _off));	\
+})
+
+
+typedef struct _wheelnode_t {
+	struct _wheelnode_t *next;
+	struct _wheelnode_t *prev;
+	struct _wheelnode_t **slot;
+	time_t expires;
+} wheelnode_t;
+
+
+typedef struct _wheel_t {
+	unsigned int shift;
+	time_t tick;
+	u32 mask[WHEEL_LEVELS];
+	wheelnode_t *slots[WHEEL_LEVELS][WHEEL_SLOTS];
+} wheel_t;
+
+
+extern void lib_wheelInit(wheel_t *wheel, unsigned int shift, time_t now);
+
+
+extern void lib_wheelInsert(wheel_t *wheel, wheelnode_t *node, time_t expires);
+
+
+extern void lib_wheelRemove(wheel_t *wheel, wheelnode_t *node);
+
+
+extern wheelnode_t *lib_wheelExpire(wheel_t *wheel, time_t now);
+
+
+extern time_t lib_wheelNext(wheel_t *wheel);
+
+
+#endif
@@ -152,7 +152,15 @@ int main(void)
 	test_proc_conditional();
 	test_vm_alloc();
 	test_vm_kmalloc();
+	test_vm_slab();
+	test_vm_zerofault(&main_common.kmap);
+	test_vm_copy(&main_common.kmap);
+	test_vm_shm(&main_common.kmap);
 	test_proc_exit();
+	test_proc_schedule();
+	test_proc_futex();
+	test_proc_msg();
+	test_proc_xfer();
 	*/
 
 	proc_start(main_initthr, NULL, (const char *)"init");
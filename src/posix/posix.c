@@ -58,6 +58,7 @@ struct {
 	rbtree_t pid;
 	lock_t lock;
 	id_t fresh;
+	vm_cache_t *files;
 } posix_common;
 
 
@@ -106,7 +107,7 @@ static int posix_fileDeref(open_file_t *f)
 		if (f->type != ftUnixSocket)
 			err = proc_close(f->oid, f->status);
 		proc_lockDone(&f->lock);
-		vm_kfree(f);
+		vm_cacheFree(posix_common.files, f);
 	}
 	else {
 		proc_lockClear(&f->lock);
@@ -121,7 +122,7 @@ static void posix_putUnusedFile(process_info_t *p, int fd)
 
 	f = p->fds[fd].file;
 	proc_lockDone(&f->lock);
-	vm_kfree(f);
+	vm_cacheFree(posix_common.files, f);
 	p->fds[fd].file = NULL;
 }
 
@@ -161,7 +162,7 @@ int posix_newFile(process_info_t *p, int fd)
 		return -ENFILE;
 	}
 
-	if ((f = p->fds[fd].file = vm_kmalloc(sizeof(open_file_t))) == NULL) {
+	if ((f = p->fds[fd].file = vm_cacheAlloc(posix_common.files)) == NULL) {
 		proc_lockClear(&p->lock);
 		return -ENOMEM;
 	}
@@ -278,7 +279,7 @@ int posix_clone(int ppid)
 		hal_memset(p->fds, 0, (p->maxfd + 1) * sizeof(fildes_t));
 
 		for (i = 0; i < 3; ++i) {
-			if ((f = p->fds[i].file = vm_kmalloc(sizeof(open_file_t))) == NULL)
+			if ((f = p->fds[i].file = vm_cacheAlloc(posix_common.files)) == NULL)
 				return -ENOMEM;
 
 			proc_lockInit(&f->lock);
@@ -431,7 +432,7 @@ int posix_open(const char *filename, int oflag, char *ustack)
 	do {
 		while (p->fds[fd].file != NULL && fd++ < p->maxfd);
 
-		if (fd > p->maxfd || (f = p->fds[fd].file = vm_kmalloc(sizeof(open_file_t))) == NULL) {
+		if (fd > p->maxfd || (f = p->fds[fd].file = vm_cacheAlloc(posix_common.files)) == NULL) {
 			err = -EBADF;
 			break;
 		}
@@ -503,7 +504,7 @@ int posix_open(const char *filename, int oflag, char *ustack)
 		proc_lockSet(&p->lock);
 		p->fds[fd].file = NULL;
 		proc_lockDone(&f->lock);
-		vm_kfree(f);
+		vm_cacheFree(posix_common.files, f);
 
 	} while (0);
 
@@ -738,13 +739,13 @@ int posix_pipe(int fildes[2])
 	if (proc_create(pipesrv.port, pxBufferedPipe, O_RDONLY | O_WRONLY, oid, pipesrv, NULL, &oid) < 0)
 		return -EIO;
 
-	if ((fo = vm_kmalloc(sizeof(open_file_t))) == NULL) {
+	if ((fo = vm_cacheAlloc(posix_common.files)) == NULL) {
 		/* FIXME: destroy pipe */
 		return -ENOMEM;
 	}
 
-	if ((fi = vm_kmalloc(sizeof(open_file_t))) == NULL) {
-		vm_kfree(fo);
+	if ((fi = vm_cacheAlloc(posix_common.files)) == NULL) {
+		vm_cacheFree(posix_common.files, fo);
 		/* FIXME: destroy pipe */
 		return -ENOMEM;
 	}
@@ -760,8 +761,8 @@ int posix_pipe(int fildes[2])
 	if (fildes[0] > p->maxfd || fildes[1] > p->maxfd) {
 		proc_lockClear(&p->lock);
 
-		vm_kfree(fo);
-		vm_kfree(fi);
+		vm_cacheFree(posix_common.files, fo);
+		vm_cacheFree(posix_common.files, fi);
 
 		return -EMFILE;
 	}
@@ -1305,6 +1306,7 @@ void ioctl_pack(msg_t *msg, unsigned long request, void *data, id_t id)
 	ioctl_in_t *ioctl = (ioctl_in_t *)msg->i.raw;
 
 	msg->type = mtDevCtl;
+	msg->flags = 0;
 	msg->i.data = NULL;
 	msg->i.size = 0;
 	msg->o.data = NULL;
@@ -1923,6 +1925,7 @@ int posix_poll(struct pollfd *fds, nfds_t nfds, int timeout_ms)
 			if (err)
 				break;
 
+			hal_memset(&msg, 0, sizeof(msg));
 			msg.type = mtRead;
 
 			hal_memcpy(&msg.i.io.oid, &q->oid, sizeof(oid_t));
@@ -2112,4 +2115,5 @@ void posix_init(void)
 	lib_rbInit(&posix_common.pid, pinfo_cmp, NULL);
 	unix_sockets_init();
 	posix_common.fresh = 0;
+	posix_common.files = vm_cacheCreate("open_file", sizeof(open_file_t), NULL);
 }
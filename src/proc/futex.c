@@ -0,0 +1,172 @@
+/*
+ * Phoenix-RTOS
+ *
+ * Operating system kernel
+ *
+ * Futexes
+ *
+ * Copyright 2018 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#include HAL
+#include "../../include/errno.h"
+#include "../lib/lib.h"
+#include "../vm/vm.h"
+#include "proc.h"
+
+#define FUTEX_BUCKETS 64
+
+
+typedef struct _futex_waiter_t {
+	struct _futex_waiter_t *next;
+	struct _futex_waiter_t *prev;
+
+	void *key;
+	offs_t offs;
+
+	thread_t *queue;
+	int woken;
+} futex_waiter_t;
+
+
+typedef struct {
+	lock_t lock;
+	futex_waiter_t *waiters;
+} futex_bucket_t;
+
+
+struct {
+	futex_bucket_t buckets[FUTEX_BUCKETS];
+} futex_common;
+
+
+/*
+ * Futex is identified by vm object and offset for memory shared between maps,
+ * by map and virtual address for private memory and by address alone in kernel
+ */
+static int futex_key(volatile u32 *uaddr, void **key, offs_t *offs)
+{
+#ifndef NOMMU
+	process_t *process;
+	vm_object_t *o;
+	int err;
+#endif
+
+	if ((ptr_t)uaddr & (sizeof(u32) - 1))
+		return -EINVAL;
+
+#ifndef NOMMU
+	if ((process = proc_current()->process) != NULL) {
+		if ((ptr_t)uaddr >= VADDR_USR_MAX)
+			return -EFAULT;
+
+		if ((err = vm_mapKey(process->mapp, (void *)uaddr, &o, offs)) < 0)
+			return err;
+
+		*key = (o != NULL) ? (void *)o : (void *)process->mapp;
+		return EOK;
+	}
+#endif
+
+	*key = NULL;
+	*offs = (ptr_t)uaddr;
+
+	return EOK;
+}
+
+
+static futex_bucket_t *futex_bucket(void *key, offs_t offs)
+{
+	unsigned int h;
+
+	h = ((ptr_t)key >> 4) ^ (unsigned int)(offs >> 2) ^ (unsigned int)(offs >> 12);
+
+	return futex_common.buckets + (h % FUTEX_BUCKETS);
+}
+
+
+int proc_futexWait(volatile u32 *uaddr, u32 val, time_t timeout)
+{
+	futex_bucket_t *b;
+	futex_waiter_t w;
+	int err;
+
+	if ((err = futex_key(uaddr, &w.key, &w.offs)) < 0)
+		return err;
+
+	b = futex_bucket(w.key, w.offs);
+	w.queue = NULL;
+	w.woken = 0;
+
+	proc_lockSet(&b->lock);
+
+	/* Value is compared under bucket lock so wakeup issued after userspace change can't be lost */
+	if (*uaddr != val) {
+		proc_lockClear(&b->lock);
+		return -EAGAIN;
+	}
+
+	LIST_ADD(&b->waiters, &w);
+
+	proc_threadUnprotect();
+	err = proc_lockWait(&w.queue, &b->lock, timeout);
+	proc_threadProtect();
+
+	if (w.woken)
+		err = EOK;
+	else
+		LIST_REMOVE(&b->waiters, &w);
+
+	proc_lockClear(&b->lock);
+
+	return err;
+}
+
+
+int proc_futexWake(volatile u32 *uaddr, unsigned int n)
+{
+	futex_bucket_t *b;
+	futex_waiter_t *w, *next;
+	void *key;
+	offs_t offs;
+	int err;
+	unsigned int woken = 0;
+
+	if ((err = futex_key(uaddr, &key, &offs)) < 0)
+		return err;
+
+	b = futex_bucket(key, offs);
+
+	proc_lockSet(&b->lock);
+
+	for (w = b->waiters; w != NULL && woken < n; w = next) {
+		next = (w->next != b->waiters) ? w->next : NULL;
+
+		if (w->key != key || w->offs != offs)
+			continue;
+
+		LIST_REMOVE(&b->waiters, w);
+		w->woken = 1;
+		proc_threadWakeup(&w->queue);
+		woken++;
+	}
+
+	proc_lockClear(&b->lock);
+
+	return woken;
+}
+
+
+void _futex_init(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < FUTEX_BUCKETS; i++) {
+		proc_lockInit(&futex_common.buckets[i].lock);
+		futex_common.buckets[i].waiters = NULL;
+	}
+}
@@ -0,0 +1,30 @@
+/*
+ * Phoenix-RTOS
+ *
+ * Operating system kernel
+ *
+ * Futexes
+ *
+ * Copyright 2018 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _PROC_FUTEX_H_
+#define _PROC_FUTEX_H_
+
+#include HAL
+
+
+extern int proc_futexWait(volatile u32 *uaddr, u32 val, time_t timeout);
+
+
+extern int proc_futexWake(volatile u32 *uaddr, unsigned int n);
+
+
+extern void _futex_init(void);
+
+
+#endif
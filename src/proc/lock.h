@@ -20,12 +20,13 @@
 
 
 typedef struct _lock_t {
+	/* Linkage in list of locks held by owner */
+	struct _lock_t *next;
+	struct _lock_t *prev;
+
 	spinlock_t spinlock;
 	volatile char v;
-	volatile struct _thread_t *owner;
-
-	/* Saved original priority of mutex holder to be restored once mutex is released */
-	unsigned int priority;
+	struct _thread_t *owner;
 	struct _thread_t *queue;
 } lock_t;
 
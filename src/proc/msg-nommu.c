@@ -53,7 +53,8 @@ int proc_send(u32 port, msg_t *msg)
 	else {
 		LIST_ADD(&p->kmessages, &kmsg);
 
-		proc_threadWakeup(&p->threads);
+		/* Switch straight into receiver blocked on the port */
+		err = proc_threadHandoff(&p->threads, &kmsg.threads, &p->spinlock);
 
 		while (!(responded = kmsg.responded))
 			err = proc_threadWait(&kmsg.threads, &p->spinlock, 0);
@@ -127,7 +128,9 @@ int proc_respond(u32 port, msg_t *msg, unsigned int rid)
 	kmsg->responded = 1;
 	kmsg->src = proc_current()->process;
 	LIST_REMOVE(&p->received, kmsg);
-	proc_threadWakeup(&kmsg->threads);
+
+	/* Switch straight back to sender */
+	proc_threadHandoff(&kmsg->threads, NULL, &p->spinlock);
 	hal_spinlockClear(&p->spinlock);
 	port_put(p, 0);
 
@@ -135,6 +138,23 @@ int proc_respond(u32 port, msg_t *msg, unsigned int rid)
 }
 
 
+int proc_msgRingCreate(unsigned int *h)
+{
+	return -ENOSYS;
+}
+
+
+int proc_msgRingEnter(unsigned int h, msgring_t *ring, unsigned int wait)
+{
+	return -ENOSYS;
+}
+
+
+void proc_msgRingDestroy(kring_t *kring)
+{
+}
+
+
 void _msg_init(vm_map_t *kmap, vm_object_t *kernel)
 {
 	msg_common.kmap = kmap;
@@ -25,15 +25,87 @@
 struct {
 	vm_map_t *kmap;
 	vm_object_t *kernel;
+	vm_cache_t *kmsgs;
 } msg_common;
 
 
+/* Maps n source pages into destination, physically contiguous runs are entered at once */
+static int msg_mapPages(vm_map_t *srcmap, void *vaddr, vm_map_t *dstmap, void *w, unsigned int n, unsigned int attr)
+{
+	unsigned int i, run;
+	page_t *p = NULL, *q;
+
+	for (i = 0; i < n; i += run, p = q) {
+		if ((p == NULL) && (p = _page_get(pmap_resolve(&srcmap->pmap, vaddr + i * SIZE_PAGE))) == NULL)
+			return -EFAULT;
+
+		for (run = 1, q = NULL; i + run < n; run++) {
+			if ((q = _page_get(pmap_resolve(&srcmap->pmap, vaddr + (i + run) * SIZE_PAGE))) == NULL || q->addr != p->addr + run * SIZE_PAGE)
+				break;
+		}
+
+		if (page_mapRange(&dstmap->pmap, w + i * SIZE_PAGE, p->addr, run * SIZE_PAGE, attr) < 0)
+			return -ENOMEM;
+	}
+
+	return EOK;
+}
+
+
+/*
+ * Maps all pages spanned by input data into destination read only, including partially used
+ * first and last ones which would be otherwise copied to bounce pages. Receiver can see what
+ * shares these pages with the data. Output is never lent, receiver could write past it.
+ */
+static void *msg_lend(struct _kmsg_layout_t *ml, void *data, size_t size, vm_map_t *srcmap, vm_map_t *dstmap, unsigned int attr, unsigned int prot)
+{
+	void *w, *vaddr;
+	unsigned int n;
+
+	vaddr = (void *)FLOOR((unsigned long)data);
+	n = (CEIL((unsigned long)data + size) - (unsigned long)vaddr) / SIZE_PAGE;
+
+	if ((ml->w = w = vm_mapFind(dstmap, (void *)0, n * SIZE_PAGE, MAP_NOINHERIT, prot)) == NULL)
+		return NULL;
+
+	if (msg_mapPages(srcmap, vaddr, dstmap, w, n, attr) < 0)
+		return NULL;
+
+	return w + ((unsigned long)data & (SIZE_PAGE - 1));
+}
+
+
+/*
+ * Sender pages are mapped lazily and may still be shared copy-on-write after fork,
+ * fault them in before they're resolved. Buffers written by the receiver get their
+ * private copies here.
+ */
+static int msg_fault(vm_map_t *srcmap, void *data, size_t size, int dir)
+{
+	void *vaddr;
+	int prot = PROT_READ | PROT_USER;
+
+	if (dir)
+		prot |= PROT_WRITE;
+
+	for (vaddr = (void *)FLOOR((unsigned long)data); vaddr < data + size; vaddr += SIZE_PAGE) {
+		if (!dir && pmap_resolve(&srcmap->pmap, vaddr))
+			continue;
+
+		if (vm_mapForce(srcmap, vaddr, prot) != EOK)
+			return -EFAULT;
+	}
+
+	return EOK;
+}
+
+
 static void *msg_map(int dir, kmsg_t *kmsg, void *data, size_t size, process_t *from, process_t *to)
 {
 	void *w = NULL, *vaddr;
 	u64 boffs, eoffs;
-	unsigned int n = 0, i, attr, prot;
-	page_t *ep = NULL, *nep = NULL, *bp = NULL, *nbp = NULL, *p;
+	unsigned int n = 0, attr, prot;
+	page_t *ep = NULL, *nep = NULL, *bp = NULL, *nbp = NULL;
 	vm_map_t *srcmap, *dstmap;
 	struct _kmsg_layout_t *ml = dir ? &kmsg->o : &kmsg->i;
 	int flags;
@@ -72,9 +144,6 @@ static void *msg_map(int dir, kmsg_t *kmsg, void *data, size_t size, process_t *
 	if (srcmap == dstmap && pmap_belongs(&dstmap->pmap, data))
 		return data;
 
-	if ((ml->w = w = vm_mapFind(dstmap, (void *)0, (!!boffs + !!eoffs + n) * SIZE_PAGE, MAP_NOINHERIT, prot)) == NULL)
-		return NULL;
-
 	if (pmap_belongs(&srcmap->pmap, data))
 		flags = vm_mapFlags(srcmap, data);
 	else
@@ -83,12 +152,24 @@ static void *msg_map(int dir, kmsg_t *kmsg, void *data, size_t size, process_t *
 	if (flags < 0)
 		return NULL;
 
+	/* Pin before pages are resolved, reclaim could take them meanwhile */
+	if ((from != NULL) && pmap_belongs(&srcmap->pmap, data) &&
+	    ((vm_mapPin(srcmap, data, size, &ml->pins) < 0) || (msg_fault(srcmap, data, size, dir) < 0)))
+		return NULL;
+
 	if (flags & MAP_DEVICE)
 		attr |= PGHD_DEV;
 
 	if (flags & MAP_UNCACHED)
 		attr |= PGHD_NOT_CACHED;
 
+	/* Kernel buffers are never lent, only sender's own user pages */
+	if ((kmsg->msg.flags & MSG_ZEROCOPY) && !dir && (from != NULL) && pmap_belongs(&srcmap->pmap, data))
+		return msg_lend(ml, data, size, srcmap, dstmap, attr, prot);
+
+	if ((ml->w = w = vm_mapFind(dstmap, (void *)0, (!!boffs + !!eoffs + n) * SIZE_PAGE, MAP_NOINHERIT, prot)) == NULL)
+		return NULL;
+
 	if (boffs > 0) {
 		ml->boffs = boffs;
 		bp = _page_get(pmap_resolve(&srcmap->pmap, data));
@@ -112,11 +193,8 @@ static void *msg_map(int dir, kmsg_t *kmsg, void *data, size_t size, process_t *
 	/* Map pages */
 	vaddr = (void *)CEIL((unsigned long)data);
 
-	for (i = 0; i < n; i++, vaddr += SIZE_PAGE) {
-		p = _page_get(pmap_resolve(&srcmap->pmap, vaddr));
-		if (page_map(&dstmap->pmap, w + (i + !!boffs) * SIZE_PAGE, p->addr, attr) < 0)
-			return NULL;
-	}
+	if (msg_mapPages(srcmap, vaddr, dstmap, w + !!boffs * SIZE_PAGE, n, attr) < 0)
+		return NULL;
 
 // lib_printf("w=%p bp->addr=%p %p\n", w, nbp->addr, vaddr);
 
@@ -153,6 +231,7 @@ static void *msg_map(int dir, kmsg_t *kmsg, void *data, size_t size, process_t *
 static void msg_release(kmsg_t *kmsg)
 {
 	process_t *process;
+	vm_map_t *map;
 
 	if (kmsg->i.bp != NULL) {
 		vm_pageFree(kmsg->i.bp);
@@ -169,11 +248,13 @@ static void msg_release(kmsg_t *kmsg)
 	}
 
 	if (kmsg->i.w != NULL) {
-		if ((process = proc_current()->process) != NULL)
-			vm_munmap(process->mapp, kmsg->i.w, CEIL((unsigned long)kmsg->msg.i.data + kmsg->msg.i.size) - FLOOR((unsigned long)kmsg->msg.i.data));
+		map = ((process = proc_current()->process) != NULL) ? process->mapp : msg_common.kmap;
+		vm_munmap(map, kmsg->i.w, CEIL((unsigned long)kmsg->msg.i.data + kmsg->msg.i.size) - FLOOR((unsigned long)kmsg->msg.i.data));
 		kmsg->i.w = NULL;
 	}
 
+	vm_objectUnpin(&kmsg->i.pins);
+
 	if (kmsg->o.bp != NULL) {
 		vm_pageFree(kmsg->o.bp);
 		vm_munmap(msg_common.kmap, kmsg->o.bvaddr, SIZE_PAGE);
@@ -189,10 +270,12 @@ static void msg_release(kmsg_t *kmsg)
 	}
 
 	if (kmsg->o.w != NULL) {
-		if ((process = proc_current()->process) != NULL)
-			vm_munmap(process->mapp, kmsg->o.w, CEIL((unsigned long)kmsg->msg.o.data + kmsg->msg.o.size) - FLOOR((unsigned long)kmsg->msg.o.data));
+		map = ((process = proc_current()->process) != NULL) ? process->mapp : msg_common.kmap;
+		vm_munmap(map, kmsg->o.w, CEIL((unsigned long)kmsg->msg.o.data + kmsg->msg.o.size) - FLOOR((unsigned long)kmsg->msg.o.data));
 		kmsg->o.w = NULL;
 	}
+
+	vm_objectUnpin(&kmsg->o.pins);
 }
 
 
@@ -300,6 +383,25 @@ static int msg_opack(kmsg_t *kmsg)
 }
 
 
+/* Note: always called with port spinlock set */
+static void _msg_done(kmsg_t *kmsg, int responded)
+{
+	kring_t *kring;
+
+	if ((kring = kmsg->ring) == NULL) {
+		kmsg->responded = responded;
+		proc_threadWakeup(&kmsg->threads);
+		return;
+	}
+
+	hal_spinlockSet(&kring->spinlock);
+	kmsg->responded = responded;
+	LIST_ADD(&kring->completed, kmsg);
+	proc_threadWakeup(&kring->waitq);
+	hal_spinlockClear(&kring->spinlock);
+}
+
+
 int proc_send(u32 port, msg_t *msg)
 {
 	port_t *p;
@@ -317,6 +419,7 @@ int proc_send(u32 port, msg_t *msg)
 	kmsg.src = sender->process;
 	kmsg.threads = NULL;
 	kmsg.responded = 0;
+	kmsg.ring = NULL;
 
 	kmsg.msg.pid = (sender->process != NULL) ? sender->process->id : 0;
 	kmsg.msg.priority = sender->priority;
@@ -331,7 +434,8 @@ int proc_send(u32 port, msg_t *msg)
 	else {
 		LIST_ADD(&p->kmessages, &kmsg);
 
-		proc_threadWakeup(&p->threads);
+		/* Switch straight into receiver blocked on the port */
+		err = proc_threadHandoff(&p->threads, &kmsg.threads, &p->spinlock);
 
 		while (!(responded = kmsg.responded))
 			err = proc_threadWait(&kmsg.threads, &p->spinlock, 0);
@@ -355,6 +459,7 @@ int proc_recv(u32 port, msg_t *msg, unsigned int *rid)
 {
 	port_t *p;
 	kmsg_t *kmsg;
+	process_t *from;
 	int ipacked = 0, opacked = 0, closed;
 
 	if ((p = proc_portGet(port)) == NULL)
@@ -371,9 +476,8 @@ int proc_recv(u32 port, msg_t *msg, unsigned int *rid)
 	if (p->closed) {
 		/* Port is being removed */
 		if (kmsg != NULL) {
-			kmsg->responded = -1;
 			LIST_REMOVE(&p->kmessages, kmsg);
-			proc_threadWakeup(&kmsg->threads);
+			_msg_done(kmsg, -1);
 		}
 
 		hal_spinlockClear(&p->spinlock);
@@ -397,6 +501,7 @@ int proc_recv(u32 port, msg_t *msg, unsigned int *rid)
 	kmsg->i.evaddr = NULL;
 	kmsg->i.eoffs = 0;
 	kmsg->i.ep = NULL;
+	kmsg->i.pins = NULL;
 
 	kmsg->o.bvaddr = NULL;
 	kmsg->o.boffs = 0;
@@ -405,17 +510,21 @@ int proc_recv(u32 port, msg_t *msg, unsigned int *rid)
 	kmsg->o.evaddr = NULL;
 	kmsg->o.eoffs = 0;
 	kmsg->o.ep = NULL;
+	kmsg->o.pins = NULL;
 
 	if ((kmsg->msg.i.data > (void *)kmsg->msg.i.raw) && (kmsg->msg.i.data < (void *)kmsg->msg.i.raw + sizeof(kmsg->msg.i.raw)))
 		ipacked = 1;
 
 	/* Map data in receiver space */
 	/* Don't map if msg is packed */
+	/* Ring messages are in kernel memory already */
+	from = (kmsg->ring != NULL) ? NULL : kmsg->src;
+
 	if (!ipacked)
-		kmsg->msg.i.data = msg_map(0, kmsg, kmsg->msg.i.data, kmsg->msg.i.size, kmsg->src, proc_current()->process);
+		kmsg->msg.i.data = msg_map(0, kmsg, kmsg->msg.i.data, kmsg->msg.i.size, from, proc_current()->process);
 
 	if (!(opacked = msg_opack(kmsg)))
-		kmsg->msg.o.data = msg_map(1, kmsg, kmsg->msg.o.data, kmsg->msg.o.size, kmsg->src, proc_current()->process);
+		kmsg->msg.o.data = msg_map(1, kmsg, kmsg->msg.o.data, kmsg->msg.o.size, from, proc_current()->process);
 
 	if ((kmsg->msg.i.size && kmsg->msg.i.data == NULL) ||
 		(kmsg->msg.o.size && kmsg->msg.o.data == NULL) ||
@@ -425,8 +534,7 @@ int proc_recv(u32 port, msg_t *msg, unsigned int *rid)
 
 		hal_spinlockSet(&p->spinlock);
 		LIST_REMOVE(&p->received, kmsg);
-		kmsg->responded = -1;
-		proc_threadWakeup(&kmsg->threads);
+		_msg_done(kmsg, -1);
 		hal_spinlockClear(&p->spinlock);
 
 		port_put(p, 0);
@@ -474,10 +582,18 @@ int proc_respond(u32 port, msg_t *msg, unsigned int rid)
 	hal_memcpy(kmsg->msg.o.raw, msg->o.raw, sizeof(msg->o.raw));
 
 	hal_spinlockSet(&p->spinlock);
-	kmsg->responded = 1;
 	kmsg->src = proc_current()->process;
 	LIST_REMOVE(&p->received, kmsg);
-	proc_threadWakeup(&kmsg->threads);
+
+	if (kmsg->ring == NULL) {
+		kmsg->responded = 1;
+
+		/* Switch straight back to sender */
+		proc_threadHandoff(&kmsg->threads, NULL, &p->spinlock);
+	}
+	else {
+		_msg_done(kmsg, 1);
+	}
 	hal_spinlockClear(&p->spinlock);
 	port_put(p, 0);
 
@@ -485,8 +601,285 @@ int proc_respond(u32 port, msg_t *msg, unsigned int rid)
 }
 
 
+/*
+ * Asynchronous message ring
+ */
+
+
+int proc_msgRingCreate(unsigned int *h)
+{
+	process_t *process;
+	resource_t *r;
+
+	process = proc_current()->process;
+
+	if ((r = resource_alloc(process, h, rtRing)) == NULL)
+		return -ENOMEM;
+
+	hal_spinlockCreate(&r->ring->spinlock, "kring.spinlock");
+	r->ring->completed = NULL;
+	r->ring->waitq = NULL;
+	r->ring->inflight = 0;
+	resource_put(process, r);
+
+	return EOK;
+}
+
+
+static void msg_ringPost(msgring_t *ring, unsigned int idx, int err)
+{
+	ring->entries[idx].err = err;
+	ring->cq[ring->cqtail & (ring->size - 1)] = idx;
+	ring->cqtail++;
+}
+
+
+/* Copies message data to kernel pages, whole pages may be lent to receiver so the tail is cleared */
+static void *msg_ringCopy(struct _kmsg_buf_t *b, void *data, size_t size)
+{
+	if ((b->page = vm_pageAlloc(size, PAGE_OWNER_KERNEL | PAGE_KERNEL_HEAP)) == NULL)
+		return NULL;
+
+	if ((b->vaddr = vm_mmap(msg_common.kmap, NULL, b->page, 1 << b->page->idx, PROT_READ | PROT_WRITE, msg_common.kernel, -1, MAP_NONE)) == NULL) {
+		vm_pageFree(b->page);
+		b->page = NULL;
+		return NULL;
+	}
+
+	hal_memcpy(b->vaddr, data, size);
+	hal_memset(b->vaddr + size, 0, CEIL(size) - size);
+
+	return b->vaddr;
+}
+
+
+static void msg_ringFree(kmsg_t *kmsg)
+{
+	if (kmsg->ibuf.page != NULL) {
+		vm_munmap(msg_common.kmap, kmsg->ibuf.vaddr, 1 << kmsg->ibuf.page->idx);
+		vm_pageFree(kmsg->ibuf.page);
+		kmsg->ibuf.page = NULL;
+	}
+
+	if (kmsg->obuf.page != NULL) {
+		vm_munmap(msg_common.kmap, kmsg->obuf.vaddr, 1 << kmsg->obuf.page->idx);
+		vm_pageFree(kmsg->obuf.page);
+		kmsg->obuf.page = NULL;
+	}
+}
+
+
+static int msg_ringSubmit(kring_t *kring, msgentry_t *e, unsigned int idx)
+{
+	port_t *p;
+	kmsg_t *kmsg;
+	thread_t *sender;
+	int err = EOK;
+
+	if ((p = proc_portGet(e->port)) == NULL)
+		return -EINVAL;
+
+	if ((kmsg = vm_cacheAlloc(msg_common.kmsgs)) == NULL) {
+		port_put(p, 0);
+		return -ENOMEM;
+	}
+
+	sender = proc_current();
+
+	hal_memcpy(&kmsg->msg, &e->msg, sizeof(msg_t));
+	kmsg->src = sender->process;
+	kmsg->threads = NULL;
+	kmsg->responded = 0;
+	kmsg->ring = kring;
+	kmsg->port = p;
+	kmsg->idx = idx;
+
+	kmsg->msg.pid = (sender->process != NULL) ? sender->process->id : 0;
+	kmsg->msg.priority = sender->priority;
+
+	kmsg->ibuf.page = NULL;
+	kmsg->obuf.page = NULL;
+	kmsg->odata = e->msg.o.data;
+
+	msg_ipack(kmsg);
+
+	/*
+	 * Sender keeps running and may unmap, fork or exit before the message is received,
+	 * data which isn't packed into the message is copied now and output copied back on reap
+	 */
+	if ((kmsg->msg.i.data == e->msg.i.data) && (kmsg->msg.i.data != NULL) && kmsg->msg.i.size &&
+	    ((kmsg->msg.i.data = msg_ringCopy(&kmsg->ibuf, e->msg.i.data, e->msg.i.size)) == NULL))
+		err = -ENOMEM;
+
+	if (!msg_opack(kmsg) && (kmsg->msg.o.data != NULL) && kmsg->msg.o.size &&
+	    ((kmsg->msg.o.data = msg_ringCopy(&kmsg->obuf, e->msg.o.data, e->msg.o.size)) == NULL))
+		err = -ENOMEM;
+
+	if (err == EOK) {
+		hal_spinlockSet(&p->spinlock);
+
+		if (!p->closed) {
+			hal_spinlockSet(&kring->spinlock);
+			kring->inflight++;
+			hal_spinlockClear(&kring->spinlock);
+
+			LIST_ADD(&p->kmessages, kmsg);
+			proc_threadWakeup(&p->threads);
+			hal_spinlockClear(&p->spinlock);
+
+			return EOK;
+		}
+
+		hal_spinlockClear(&p->spinlock);
+		err = -EINVAL;
+	}
+
+	msg_ringFree(kmsg);
+	port_put(p, 0);
+	vm_cacheFree(msg_common.kmsgs, kmsg);
+
+	return err;
+}
+
+
+static int msg_ringReap(kring_t *kring, msgring_t *ring)
+{
+	kmsg_t *kmsg;
+	msgentry_t *e;
+	int n = 0;
+
+	while (ring->cqtail - ring->cqhead < ring->size) {
+		hal_spinlockSet(&kring->spinlock);
+		if ((kmsg = kring->completed) != NULL) {
+			LIST_REMOVE(&kring->completed, kmsg);
+			kring->inflight--;
+		}
+		hal_spinlockClear(&kring->spinlock);
+
+		if (kmsg == NULL)
+			break;
+
+		e = ring->entries + kmsg->idx;
+		hal_memcpy(e->msg.o.raw, kmsg->msg.o.raw, sizeof(e->msg.o.raw));
+
+		/* Output goes where it was when the message was submitted */
+		if (kmsg->obuf.page != NULL)
+			hal_memcpy(kmsg->odata, kmsg->obuf.vaddr, kmsg->msg.o.size);
+
+		/* If msg.o.data has been packed to msg.o.raw */
+		else if ((kmsg->msg.o.data > (void *)kmsg->msg.o.raw) && (kmsg->msg.o.data < (void *)kmsg->msg.o.raw + sizeof(kmsg->msg.o.raw)))
+			hal_memcpy(kmsg->odata, kmsg->msg.o.data, kmsg->msg.o.size);
+
+		msg_ringFree(kmsg);
+
+		msg_ringPost(ring, kmsg->idx, kmsg->responded < 0 ? -EINVAL : EOK);
+		n++;
+
+		port_put(kmsg->port, 0);
+		vm_cacheFree(msg_common.kmsgs, kmsg);
+	}
+
+	return n;
+}
+
+
+int proc_msgRingEnter(unsigned int h, msgring_t *ring, unsigned int wait)
+{
+	process_t *process;
+	resource_t *r;
+	kring_t *kring;
+	unsigned int idx, n = 0;
+	int err = EOK;
+
+	process = proc_current()->process;
+
+	if ((r = resource_get(process, h)) == NULL)
+		return -EINVAL;
+
+	if (r->type != rtRing || !ring->size || (ring->size & (ring->size - 1))) {
+		resource_put(process, r);
+		return -EINVAL;
+	}
+
+	kring = r->ring;
+
+	/* Submit new entries leaving room in completion queue for all messages in flight */
+	while (ring->sqhead != ring->sqtail && kring->inflight + (ring->cqtail - ring->cqhead) < ring->size) {
+		if ((idx = ring->sq[ring->sqhead & (ring->size - 1)]) >= ring->size) {
+			resource_put(process, r);
+			return -EINVAL;
+		}
+
+		ring->sqhead++;
+
+		/* Entry which can't be sent completes immediately */
+		if ((err = msg_ringSubmit(kring, ring->entries + idx, idx)) < 0) {
+			msg_ringPost(ring, idx, err);
+			n++;
+		}
+	}
+
+	err = EOK;
+
+	/* Reap completions, wait for them if requested */
+	for (;;) {
+		n += msg_ringReap(kring, ring);
+
+		if (n >= wait || ring->cqtail - ring->cqhead >= ring->size)
+			break;
+
+		proc_threadUnprotect();
+		hal_spinlockSet(&kring->spinlock);
+		while (kring->completed == NULL && kring->inflight && err != -EINTR)
+			err = proc_threadWait(&kring->waitq, &kring->spinlock, 0);
+		idx = kring->inflight;
+		hal_spinlockClear(&kring->spinlock);
+		proc_threadProtect();
+
+		if (!idx || err == -EINTR)
+			break;
+	}
+
+	resource_put(process, r);
+
+	return (err == -EINTR && !n) ? err : n;
+}
+
+
+void proc_msgRingDestroy(kring_t *kring)
+{
+	kmsg_t *kmsg;
+
+	/* Messages in flight are still used by receivers - wait for them to respond */
+	hal_spinlockSet(&kring->spinlock);
+	for (;;) {
+		if ((kmsg = kring->completed) != NULL) {
+			LIST_REMOVE(&kring->completed, kmsg);
+			kring->inflight--;
+			hal_spinlockClear(&kring->spinlock);
+
+			msg_ringFree(kmsg);
+			port_put(kmsg->port, 0);
+			vm_cacheFree(msg_common.kmsgs, kmsg);
+
+			hal_spinlockSet(&kring->spinlock);
+			continue;
+		}
+
+		if (!kring->inflight)
+			break;
+
+		proc_threadWait(&kring->waitq, &kring->spinlock, 0);
+	}
+	hal_spinlockClear(&kring->spinlock);
+
+	hal_spinlockDestroy(&kring->spinlock);
+}
+
+
 void _msg_init(vm_map_t *kmap, vm_object_t *kernel)
 {
 	msg_common.kmap = kmap;
 	msg_common.kernel = kernel;
+	msg_common.kmsgs = vm_cacheCreate("kmsg", sizeof(kmsg_t), NULL);
 }
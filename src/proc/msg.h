@@ -35,6 +35,18 @@ typedef struct _kmsg_t {
 	process_t *src;
 	volatile int responded;
 #ifndef NOMMU
+	/* Asynchronous messages complete to ring instead of waking sender */
+	struct _kring_t *ring;
+	struct _port_t *port;
+	unsigned int idx;
+
+	/* Ring messages carry copies of data, sender may unmap its buffers before they're received */
+	struct _kmsg_buf_t {
+		void *vaddr;
+		page_t *page;
+	} ibuf, obuf;
+	void *odata;
+
 	struct _kmsg_layout_t {
 		void *bvaddr;
 		u64 boffs;
@@ -44,11 +56,22 @@ typedef struct _kmsg_t {
 		void *evaddr;
 		u64 eoffs;
 		page_t *ep;
+
+		/* Sender's objects, their pages can't be reclaimed while mapped here */
+		struct _vm_pin_t *pins;
 	} i, o;
 #endif
 } kmsg_t;
 
 
+typedef struct _kring_t {
+	spinlock_t spinlock;
+	kmsg_t *completed;
+	thread_t *waitq;
+	unsigned int inflight;
+} kring_t;
+
+
 /*
  * Message passing
  */
@@ -63,6 +86,15 @@ extern int proc_recv(u32 port, msg_t *msg, unsigned int *rid);
 extern int proc_respond(u32 port, msg_t *msg, unsigned int rid);
 
 
+extern int proc_msgRingCreate(unsigned int *h);
+
+
+extern int proc_msgRingEnter(unsigned int h, msgring_t *ring, unsigned int wait);
+
+
+extern void proc_msgRingDestroy(kring_t *kring);
+
+
 extern void _msg_init(vm_map_t *kmap, vm_object_t *kernel);
 
 
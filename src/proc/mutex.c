@@ -114,8 +114,5 @@ int proc_mutexCopy(resource_t *dst, resource_t *src)
 	proc_lockInit(dst->lock);
 	dst->type = rtLock;
 
-	if (src != NULL)
-		dst->lock->priority = src->lock->priority;
-
 	return EOK;
 }
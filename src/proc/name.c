@@ -443,7 +443,7 @@ int proc_write(oid_t oid, size_t offs, void *buf, size_t sz, unsigned mode)
 }
 
 
-int proc_size(oid_t oid)
+static int proc_getattr(oid_t oid, int type)
 {
 	int err;
 	msg_t *msg = vm_kmalloc(sizeof(msg_t));
@@ -455,7 +455,7 @@ int proc_size(oid_t oid)
 
 	msg->type = mtGetAttr;
 	hal_memcpy(&msg->i.attr.oid, &oid, sizeof(oid_t));
-	msg->i.attr.type = 3; /* atSize */
+	msg->i.attr.type = type;
 
 	err = proc_send(oid.port, msg);
 
@@ -467,6 +467,18 @@ int proc_size(oid_t oid)
 }
 
 
+int proc_size(oid_t oid)
+{
+	return proc_getattr(oid, 3); /* atSize */
+}
+
+
+int proc_mtime(oid_t oid)
+{
+	return proc_getattr(oid, 9); /* atMTime */
+}
+
+
 void _name_init(void)
 {
 	proc_lockInit(&name_common.dcache_lock);
@@ -88,6 +88,9 @@ extern int proc_open(oid_t oid, unsigned mode);
 extern int proc_size(oid_t oid);
 
 
+extern int proc_mtime(oid_t oid);
+
+
 extern int proc_write(oid_t oid, size_t offs, void *buf, size_t sz, unsigned mode);
 
 
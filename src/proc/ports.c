@@ -16,142 +16,90 @@
 #include "ports.h"
 
 
+#define PORTS_DIRSHIFT 8
+#define PORTS_DIRSZ    (1 << PORTS_DIRSHIFT)
+#define PORTS_DIRS     256
+#define PORTS_MAX      (PORTS_DIRS * PORTS_DIRSZ)
+
+
+/*
+ * Ports are kept in two level table indexed by id. Readers look ports up holding only the read
+ * spinlock of their CPU. Writer unpublishes a port and then takes all read spinlocks in turn before
+ * freeing it, so no reader can still hold a stale pointer. Directories are never freed.
+ */
 struct {
-	rbtree_t tree;
+	port_t **dirs[PORTS_DIRS];
+	unsigned int used[PORTS_DIRS];
+	spinlock_t *readers;
+	vm_cache_t *cache;
 	lock_t port_lock;
 } port_common;
 
 
-static int ports_cmp(rbnode_t *n1, rbnode_t *n2)
-{
-	port_t *p1 = lib_treeof(port_t, linkage, n1);
-	port_t *p2 = lib_treeof(port_t, linkage, n2);
-
-	return (p1->id - p2->id);
-}
-
-
-static int ports_gapcmp(rbnode_t *n1, rbnode_t *n2)
+static int _proc_portAlloc(u32 *id)
 {
-	port_t *p1 = lib_treeof(port_t, linkage, n1);
-	port_t *p2 = lib_treeof(port_t, linkage, n2);
-	rbnode_t *child = NULL;
-	int ret = 1;
-
-	if (p1->lmaxgap > 0 && p1->rmaxgap > 0) {
-		if (p2->id > p1->id) {
-			child = n1->right;
-			ret = -1;
-		}
-		else {
-			child = n1->left;
-			ret = 1;
-		}
-	}
-	else if (p1->lmaxgap > 0) {
-		child = n1->left;
-		ret = 1;
-	}
-	else if (p1->rmaxgap > 0) {
-		child = n1->right;
-		ret = -1;
-	}
-
-	if (child == NULL)
-		return 0;
+	unsigned int d, i;
 
-	return ret;
-}
+	for (d = 0; d < PORTS_DIRS; d++) {
+		if (port_common.used[d] == PORTS_DIRSZ)
+			continue;
 
+		if (port_common.dirs[d] == NULL) {
+			if ((port_common.dirs[d] = vm_kmalloc(PORTS_DIRSZ * sizeof(port_t *))) == NULL)
+				return -ENOMEM;
 
-static void ports_augment(rbnode_t *node)
-{
-	rbnode_t *it;
-	port_t *n = lib_treeof(port_t, linkage, node);
-	port_t *p = n, *r, *l;
-
-	if (node->left == NULL) {
-		for (it = node; it->parent != NULL; it = it->parent) {
-			p = lib_treeof(port_t, linkage, it->parent);
-			if (it->parent->right == it)
-				break;
+			hal_memset(port_common.dirs[d], 0, PORTS_DIRSZ * sizeof(port_t *));
 		}
 
-		n->lmaxgap = (n->id <= p->id) ? n->id : n->id - p->id - 1;
-	}
-	else {
-		l = lib_treeof(port_t, linkage, node->left);
-		n->lmaxgap = max(l->lmaxgap, l->rmaxgap);
-	}
-
-	if (node->right == NULL) {
-		for (it = node; it->parent != NULL; it = it->parent) {
-			p = lib_treeof(port_t, linkage, it->parent);
-			if (it->parent->left == it)
-				break;
+		for (i = 0; i < PORTS_DIRSZ; i++) {
+			if (port_common.dirs[d][i] == NULL) {
+				*id = (d << PORTS_DIRSHIFT) + i;
+				return EOK;
+			}
 		}
-
-		n->rmaxgap = (n->id >= p->id) ? (unsigned)-1 - n->id - 1 : p->id - n->id - 1;
-	}
-	else {
-		r = lib_treeof(port_t, linkage, node->right);
-		n->rmaxgap = max(r->lmaxgap, r->rmaxgap);
 	}
 
-	for (it = node; it->parent != NULL; it = it->parent) {
-		n = lib_treeof(port_t, linkage, it);
-		p = lib_treeof(port_t, linkage, it->parent);
-
-		if (it->parent->left == it)
-			p->lmaxgap = max(n->lmaxgap, n->rmaxgap);
-		else
-			p->rmaxgap = max(n->lmaxgap, n->rmaxgap);
-	}
+	return -ENOMEM;
 }
 
 
-static int _proc_portAlloc(u32 *id)
+/* Waits until readers which could have seen unpublished port leave their read sections */
+static void ports_synchronize(void)
 {
-	port_t *p;
-	port_t t;
-
-	if (port_common.tree.root == NULL) {
-		*id = 0;
-		return EOK;
-	}
+	unsigned int i;
 
-	t.id = 0;
-	p = lib_treeof(port_t, linkage, lib_rbFindEx(port_common.tree.root, &t.linkage, ports_gapcmp));
-	if (p != NULL) {
-		if (p->lmaxgap > 0)
-			*id = p->id - 1;
-		else if (p->rmaxgap > 0)
-			*id = p->id + 1;
-		else
-			return -ENOMEM;
-
-		return EOK;
+	for (i = 0; i < hal_cpuGetCount(); i++) {
+		hal_spinlockSet(&port_common.readers[i]);
+		hal_spinlockClear(&port_common.readers[i]);
 	}
-
-	return -EINVAL;
 }
 
 
 port_t *proc_portGet(u32 id)
 {
-	port_t *port;
-	port_t t;
+	spinlock_t *reader;
+	port_t *port = NULL, **dir;
 
-	t.id = id;
+	if (id >= PORTS_MAX)
+		return NULL;
 
-	proc_lockSet(&port_common.port_lock);
-	port = lib_treeof(port_t, linkage, lib_rbFind(&port_common.tree, &t.linkage));
-	if (port != NULL) {
+	reader = port_common.readers + hal_cpuGetID();
+
+	hal_spinlockSet(reader);
+	if ((dir = port_common.dirs[id >> PORTS_DIRSHIFT]) != NULL && (port = dir[id & (PORTS_DIRSZ - 1)]) != NULL) {
 		hal_spinlockSet(&port->spinlock);
-		port->refs++;
-		hal_spinlockClear(&port->spinlock);
+
+		/* Port which lost its last reference is being destroyed */
+		if (port->refs > 0) {
+			port->refs++;
+			hal_spinlockClear(&port->spinlock);
+		}
+		else {
+			hal_spinlockClear(&port->spinlock);
+			port = NULL;
+		}
 	}
-	proc_lockClear(&port_common.port_lock);
+	hal_spinlockClear(reader);
 
 	return port;
 }
@@ -159,7 +107,6 @@ port_t *proc_portGet(u32 id)
 
 void port_put(port_t *p, int destroy)
 {
-	proc_lockSet(&port_common.port_lock);
 	hal_spinlockSet(&p->spinlock);
 	p->refs--;
 
@@ -168,7 +115,6 @@ void port_put(port_t *p, int destroy)
 
 	if (p->refs) {
 		hal_spinlockClear(&p->spinlock);
-		proc_lockClear(&port_common.port_lock);
 
 		if (destroy)
 			/* Wake receivers up */
@@ -177,16 +123,23 @@ void port_put(port_t *p, int destroy)
 	}
 
 	hal_spinlockClear(&p->spinlock);
-	lib_rbRemove(&port_common.tree, &p->linkage);
+
+	proc_lockSet(&port_common.port_lock);
+	port_common.dirs[p->id >> PORTS_DIRSHIFT][p->id & (PORTS_DIRSZ - 1)] = NULL;
+	port_common.used[p->id >> PORTS_DIRSHIFT]--;
 	proc_lockClear(&port_common.port_lock);
 
-	proc_lockSet(&p->owner->lock);
-	if (p->next != NULL)
-		LIST_REMOVE(&p->owner->ports, p);
-	proc_lockClear(&p->owner->lock);
+	ports_synchronize();
+
+	if (p->owner != NULL) {
+		proc_lockSet(&p->owner->lock);
+		if (p->next != NULL)
+			LIST_REMOVE(&p->owner->ports, p);
+		proc_lockClear(&p->owner->lock);
+	}
 
 	hal_spinlockDestroy(&p->spinlock);
-	vm_kfree(p);
+	vm_cacheFree(port_common.cache, p);
 }
 
 
@@ -197,18 +150,9 @@ int proc_portCreate(u32 *id)
 	process_t *proc = NULL;
 
 
-	if ((port = vm_kmalloc(sizeof(port_t))) == NULL)
+	if ((port = vm_cacheAlloc(port_common.cache)) == NULL)
 		return -ENOMEM;
 
-	proc_lockSet(&port_common.port_lock);
-	if (_proc_portAlloc(&port->id) != EOK) {
-		proc_lockClear(&port_common.port_lock);
-		vm_kfree(port);
-		return -EINVAL;
-	}
-
-	lib_rbInsert(&port_common.tree, &port->linkage);
-
 	port->kmessages = NULL;
 	port->received = NULL;
 	hal_spinlockCreate(&port->spinlock, "port.spinlock");
@@ -217,9 +161,7 @@ int proc_portCreate(u32 *id)
 	port->current = NULL;
 	port->refs = 1;
 	port->closed = 0;
-
-	*id = port->id;
-	proc_lockClear(&port_common.port_lock);
+	port->next = NULL;
 
 	if ((curr = proc_current()) != NULL && (proc = curr->process) != NULL) {
 		proc_lockSet(&proc->lock);
@@ -230,7 +172,24 @@ int proc_portCreate(u32 *id)
 	port->owner = proc;
 
 	proc_lockSet(&port_common.port_lock);
-	lib_rbInsert(&port_common.tree, &port->linkage);
+	if (_proc_portAlloc(&port->id) != EOK) {
+		proc_lockClear(&port_common.port_lock);
+
+		if (proc != NULL) {
+			proc_lockSet(&proc->lock);
+			LIST_REMOVE(&proc->ports, port);
+			proc_lockClear(&proc->lock);
+		}
+
+		hal_spinlockDestroy(&port->spinlock);
+		vm_cacheFree(port_common.cache, port);
+		return -EINVAL;
+	}
+
+	/* Publish fully initialized port to readers */
+	port_common.dirs[port->id >> PORTS_DIRSHIFT][port->id & (PORTS_DIRSZ - 1)] = port;
+	port_common.used[port->id >> PORTS_DIRSHIFT]++;
+	*id = port->id;
 	proc_lockClear(&port_common.port_lock);
 
 	return EOK;
@@ -278,6 +237,16 @@ void proc_portsDestroy(process_t *proc)
 
 void _port_init(void)
 {
-	lib_rbInit(&port_common.tree, ports_cmp, ports_augment);
+	unsigned int i;
+
+	hal_memset(port_common.dirs, 0, sizeof(port_common.dirs));
+	hal_memset(port_common.used, 0, sizeof(port_common.used));
+
+	port_common.readers = vm_kmalloc(hal_cpuGetCount() * sizeof(spinlock_t));
+	for (i = 0; i < hal_cpuGetCount(); i++)
+		hal_spinlockCreate(&port_common.readers[i], "port_common.readers");
+
+	port_common.cache = vm_cacheCreate("port", sizeof(port_t), NULL);
+
 	proc_lockInit(&port_common.port_lock);
 }
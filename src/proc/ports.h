@@ -23,13 +23,10 @@
 
 
 typedef struct _port_t {
-	rbnode_t linkage;
 	struct _port_t *next;
 	struct _port_t *prev;
 
 	u32 id;
-	u32 lmaxgap;
-	u32 rmaxgap;
 	kmsg_t *kmessages;
 	kmsg_t *received;
 	process_t *owner;
@@ -26,6 +26,7 @@
 #include "resource.h"
 #include "mutex.h"
 #include "cond.h"
+#include "futex.h"
 #include "file.h"
 #include "userintr.h"
 #include "ports.h"
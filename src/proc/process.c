@@ -211,8 +211,10 @@ int proc_start(void (*initthr)(void *), void *arg, const char *path)
 	process->sigmask = 0;
 	process->sighandler = NULL;
 
+	/* Pages are faulted in on first access */
+	process->lazy = 1;
+
 #ifndef NOMMU
-	process->lazy = 0;
 	process->mapp = &process->map;
 
 	vm_mapCreate(process->mapp, (void *)VADDR_MIN + SIZE_PAGE, (void *)VADDR_USR_MAX);
@@ -223,7 +225,6 @@ int proc_start(void (*initthr)(void *), void *arg, const char *path)
 
 	pmap_create(&process->mapp->pmap, &process_common.kmap->pmap, p, process->pmapv);
 #else
-	process->lazy = 1;
 	process->mapp = process_common.kmap;
 	//stack = (void *)VADDR_MIN;
 #endif
@@ -448,11 +449,11 @@ int proc_vfork(void)
 		return -ENOMEM;
 	}
 
-#ifdef NOMMU
+	/* Copy-on-write fork, child faults in pages on demand */
 	process->lazy = 1;
+
+#ifdef NOMMU
 	process->entries = NULL;
-#else
-	process->lazy = 0;
 #endif
 
 	process->state = NORMAL;
@@ -22,6 +22,12 @@
 #include "resource.h"
 #include "name.h"
 #include "userintr.h"
+#include "msg.h"
+
+
+struct {
+	vm_cache_t *cache;
+} resource_common;
 
 
 static int resource_cmp(rbnode_t *n1, rbnode_t *n2)
@@ -133,7 +139,7 @@ resource_t *resource_alloc(process_t *process, unsigned int *id, int type)
 		}
 	}
 
-	if ((r = (resource_t *)vm_kmalloc(sizeof(resource_t))) == NULL) {
+	if ((r = (resource_t *)vm_cacheAlloc(resource_common.cache)) == NULL) {
 		proc_lockClear(process->rlock);
 		return NULL;
 	}
@@ -141,7 +147,7 @@ resource_t *resource_alloc(process_t *process, unsigned int *id, int type)
 	switch (type) {
 	case rtLock:
 		if ((r->lock = vm_kmalloc(sizeof(lock_t))) == NULL) {
-			vm_kfree(r);
+			vm_cacheFree(resource_common.cache, r);
 			proc_lockClear(process->rlock);
 			return NULL;
 		}
@@ -153,7 +159,7 @@ resource_t *resource_alloc(process_t *process, unsigned int *id, int type)
 
 	case rtFile:
 		if ((r->fd = vm_kmalloc(sizeof(fd_t))) == NULL) {
-			vm_kfree(r);
+			vm_cacheFree(resource_common.cache, r);
 			proc_lockClear(process->rlock);
 			return NULL;
 		}
@@ -161,14 +167,22 @@ resource_t *resource_alloc(process_t *process, unsigned int *id, int type)
 
 	case rtInth:
 		if ((r->inth = vm_kmalloc(sizeof(intr_handler_t))) == NULL) {
-			vm_kfree(r);
+			vm_cacheFree(resource_common.cache, r);
+			proc_lockClear(process->rlock);
+			return NULL;
+		}
+		break;
+
+	case rtRing:
+		if ((r->ring = vm_kmalloc(sizeof(kring_t))) == NULL) {
+			vm_cacheFree(resource_common.cache, r);
 			proc_lockClear(process->rlock);
 			return NULL;
 		}
 		break;
 
 	default:
-		vm_kfree(r);
+		vm_cacheFree(resource_common.cache, r);
 		proc_lockClear(process->rlock);
 		return NULL;
 	}
@@ -197,7 +211,7 @@ int proc_resourcesCopy(process_t *src)
 	for (n = lib_rbMinimum(src->resources->root); n != NULL; n = lib_rbNext(n)) {
 		r = lib_treeof(resource_t, linkage, n);
 
-		if (d == NULL && (d = vm_kmalloc(sizeof(resource_t))) == NULL) {
+		if (d == NULL && (d = vm_cacheAlloc(resource_common.cache)) == NULL) {
 			err = -ENOMEM;
 			break;
 		}
@@ -225,6 +239,10 @@ int proc_resourcesCopy(process_t *src)
 			err = 1; /* Don't copy interrupt handlers */
 			d->inth = NULL;
 			break;
+		case rtRing:
+			err = 1; /* Messages in flight belong to parent */
+			d->ring = NULL;
+			break;
 		}
 
 		if (err == EOK) {
@@ -249,7 +267,7 @@ int proc_resourcesCopy(process_t *src)
 		else if (d->type == rtInth && d->inth != NULL)
 			vm_kfree(d->inth);
 
-		vm_kfree(d);
+		vm_cacheFree(resource_common.cache, d);
 	}
 
 	return err;
@@ -289,7 +307,13 @@ int resource_free(resource_t *r)
 	lib_rbRemove(process->resources, &r->linkage);
 	proc_lockClear(process->rlock);
 
-	vm_kfree(r);
+	/* Ring waits for messages in flight, so it's released with resources unlocked */
+	if (r->type == rtRing) {
+		proc_msgRingDestroy(r->ring);
+		vm_kfree(r->ring);
+	}
+
+	vm_cacheFree(resource_common.cache, r);
 
 	return EOK;
 }
@@ -324,11 +348,15 @@ void proc_resourcesFree(process_t *proc)
 			hal_interruptsDeleteHandler(r->inth);
 			vm_kfree(r->inth);
 			break;
+		case rtRing:
+			proc_msgRingDestroy(r->ring);
+			vm_kfree(r->ring);
+			break;
 		default:
 			break;
 		}
 
-		vm_kfree(r);
+		vm_cacheFree(resource_common.cache, r);
 	}
 	proc_lockClear(proc->rlock);
 }
@@ -379,3 +407,9 @@ void resource_init(process_t *process)
 	process->resources = &process->resourcetree;
 	process->rlock = &process->lock;
 }
+
+
+void _resource_init(void)
+{
+	resource_common.cache = vm_cacheCreate("resource", sizeof(resource_t), NULL);
+}
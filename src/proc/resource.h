@@ -36,13 +36,14 @@ typedef struct _resource_t {
 	unsigned int lmaxgap;
 	unsigned int rmaxgap;
 
-	enum { rtLock = 0, rtCond, rtFile, rtInth } type;
+	enum { rtLock = 0, rtCond, rtFile, rtInth, rtRing } type;
 
 	union {
 		lock_t *lock;
 		thread_t *waitq;
 		fd_t *fd;
 		intr_handler_t *inth;
+		struct _kring_t *ring;
 	};
 } resource_t;
 
@@ -71,4 +72,7 @@ extern int proc_resourceFree(unsigned int h);
 extern void resource_init(process_t *process);
 
 
+extern void _resource_init(void);
+
+
 #endif
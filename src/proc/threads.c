@@ -25,28 +25,65 @@
 #include "ports.h"
 
 
+#define THREADS_PRIORITIES 8
+
+/* Maximum number of threads examined in single ready list while looking for a thread to steal */
+#define THREADS_STEALSCAN 8
+
+/* Resolution of sleeping threads timing wheel in microseconds, rounded down to power of 2 timer cycles */
+#define THREADS_WHEELRES 128
+
+/* Round robin timeslice, also the period of the timer tick on targets without HPTIMER */
+#define THREADS_TIMESLICE TIMER_US2CYC(1000)
+
+
+/* Per-CPU run queue, synchronized by its own spinlock */
+typedef struct {
+	spinlock_t spinlock;
+	thread_t *ready[THREADS_PRIORITIES];
+	u32 readymask;
+	unsigned int nready;
+	thread_t *current;
+
+	/* Thread to be switched to directly, bypassing ready queues */
+	thread_t *handoff;
+
+	unsigned int executions;
+	unsigned int steals;
+	unsigned int migrations;
+	unsigned int handoffs;
+	unsigned int ticks;
+	unsigned int ticksAvoided;
+	time_t lasttick;
+
+#ifdef HPTIMER_IRQ
+	/* Nearest sleeping thread deadline and currently programmed timer deadline */
+	time_t sleepnext;
+	time_t deadline;
+#endif
+
+#ifndef CPU_STM32
+	cpu_load_t load;
+#endif
+} threads_cpu_t;
+
+
 struct {
 	vm_map_t *kmap;
+	vm_cache_t *cache;
 	spinlock_t spinlock;
 	lock_t lock;
-	thread_t *ready[8];
-	thread_t **current;
+	threads_cpu_t *cpus;
 	volatile time_t jiffies;
 	time_t utcoffs;
 
-	unsigned int executions;
-
 	/* Synchronized by spinlock */
-	rbtree_t sleeping;
+	wheel_t sleeping;
 
 	/* Synchronized by mutex */
 	unsigned int nextid;
 	rbtree_t id;
 
-#ifndef CPU_STM32
-	cpu_load_t load;
-#endif
-
 	intr_handler_t timeintrHandler;
 	intr_handler_t scheduleHandler;
 
@@ -57,6 +94,8 @@ struct {
 	thread_t * volatile ghosts;
 	process_t * volatile zombies;
 
+	/* Synchronized by perfSpinlock */
+	spinlock_t perfSpinlock;
 	int perfGather;
 	time_t perfLastTimestamp;
 	cbuffer_t perfBuffer;
@@ -64,27 +103,6 @@ struct {
 } threads_common;
 
 
-static int threads_sleepcmp(rbnode_t *n1, rbnode_t *n2)
-{
-	thread_t *t1 = lib_treeof(thread_t, sleeplinkage, n1);
-	thread_t *t2 = lib_treeof(thread_t, sleeplinkage, n2);
-
-	if (t1->wakeup > t2->wakeup)
-		return 1;
-
-	else if (t1->wakeup < t2->wakeup)
-		return -1;
-
-	else if (t1->id < t2->id)
-		return -1;
-
-	else if (t1->id > t2->id)
-		return 1;
-
-	return 0;
-}
-
-
 static int threads_idcmp(rbnode_t *n1, rbnode_t *n2)
 {
 	thread_t *t1 = lib_treeof(thread_t, idlinkage, n1);
@@ -108,6 +126,7 @@ static inline time_t _threads_getTimer(void);
 static void _proc_threadWakeup(thread_t **queue);
 static int _proc_threadWait(thread_t **queue, time_t timeout);
 static thread_t *_proc_current(void);
+static void threads_idlethr(void *arg);
 
 
 static unsigned perf_idpack(unsigned id)
@@ -116,7 +135,7 @@ static unsigned perf_idpack(unsigned id)
 }
 
 
-/* Note: always called with threads_common.spinlock set */
+/* Note: always called with threads_common.spinlock or thread's run queue spinlock set */
 static void _perf_event(thread_t *t, int type)
 {
 	perf_event_t ev;
@@ -138,12 +157,14 @@ static void _perf_event(thread_t *t, int type)
 		return;
 
 	ev.type = type;
+	ev.tid = perf_idpack(t->id);
 
+	hal_spinlockSet(&threads_common.perfSpinlock);
 	ev.deltaTimestamp = now - threads_common.perfLastTimestamp;
 	threads_common.perfLastTimestamp = now;
-	ev.tid = perf_idpack(t->id);
 
 	_cbuffer_write(&threads_common.perfBuffer, &ev, sizeof(ev));
+	hal_spinlockClear(&threads_common.perfSpinlock);
 }
 
 
@@ -185,11 +206,13 @@ static void _perf_begin(thread_t *t)
 	ev.tid = perf_idpack(t->id);
 	ev.pid = t->process != NULL ? perf_idpack(t->process->id) : -1;
 
+	hal_spinlockSet(&threads_common.perfSpinlock);
 	now = TIMER_CYC2US(_threads_getTimer());
 	ev.deltaTimestamp = now - threads_common.perfLastTimestamp;
 	threads_common.perfLastTimestamp = now;
 
 	_cbuffer_write(&threads_common.perfBuffer, &ev, sizeof(ev));
+	hal_spinlockClear(&threads_common.perfSpinlock);
 }
 
 
@@ -205,11 +228,13 @@ void _perf_end(thread_t *t)
 	ev.type = perf_levEnd;
 	ev.tid = perf_idpack(t->id);
 
+	hal_spinlockSet(&threads_common.perfSpinlock);
 	now = TIMER_CYC2US(_threads_getTimer());
 	ev.deltaTimestamp = now - threads_common.perfLastTimestamp;
 	threads_common.perfLastTimestamp = now;
 
 	_cbuffer_write(&threads_common.perfBuffer, &ev, sizeof(ev));
+	hal_spinlockClear(&threads_common.perfSpinlock);
 }
 
 
@@ -221,7 +246,7 @@ void perf_fork(process_t *p)
 	if (!threads_common.perfGather)
 		return;
 
-	hal_spinlockSet(&threads_common.spinlock);
+	hal_spinlockSet(&threads_common.perfSpinlock);
 	ev.sbz = 0;
 	ev.type = perf_levFork;
 	ev.pid = perf_idpack(p->id);
@@ -233,7 +258,7 @@ void perf_fork(process_t *p)
 	threads_common.perfLastTimestamp = now;
 
 	_cbuffer_write(&threads_common.perfBuffer, &ev, sizeof(ev));
-	hal_spinlockClear(&threads_common.spinlock);
+	hal_spinlockClear(&threads_common.perfSpinlock);
 }
 
 
@@ -245,7 +270,7 @@ void perf_kill(process_t *p)
 	if (!threads_common.perfGather)
 		return;
 
-	hal_spinlockSet(&threads_common.spinlock);
+	hal_spinlockSet(&threads_common.perfSpinlock);
 	ev.sbz = 0;
 	ev.type = perf_levKill;
 	ev.pid = perf_idpack(p->id);
@@ -256,7 +281,7 @@ void perf_kill(process_t *p)
 	threads_common.perfLastTimestamp = now;
 
 	_cbuffer_write(&threads_common.perfBuffer, &ev, sizeof(ev));
-	hal_spinlockClear(&threads_common.spinlock);
+	hal_spinlockClear(&threads_common.perfSpinlock);
 }
 
 
@@ -269,7 +294,7 @@ void perf_exec(process_t *p, char *path)
 	if (!threads_common.perfGather)
 		return;
 
-	hal_spinlockSet(&threads_common.spinlock);
+	hal_spinlockSet(&threads_common.perfSpinlock);
 	ev.sbz = 0;
 	ev.type = perf_levExec;
 	ev.tid = perf_idpack(_proc_current()->id);
@@ -284,7 +309,7 @@ void perf_exec(process_t *p, char *path)
 	threads_common.perfLastTimestamp = now;
 
 	_cbuffer_write(&threads_common.perfBuffer, &ev, sizeof(ev) - sizeof(ev.path) + plen + 1);
-	hal_spinlockClear(&threads_common.spinlock);
+	hal_spinlockClear(&threads_common.perfSpinlock);
 }
 
 
@@ -350,10 +375,10 @@ int perf_start(unsigned pid)
 	_cbuffer_init(&threads_common.perfBuffer, data, 4 << 20);
 
 	/* Start gathering events */
-	hal_spinlockSet(&threads_common.spinlock);
+	hal_spinlockSet(&threads_common.perfSpinlock);
 	threads_common.perfGather = 1;
 	threads_common.perfLastTimestamp = TIMER_CYC2US(_threads_getTimer());
-	hal_spinlockClear(&threads_common.spinlock);
+	hal_spinlockClear(&threads_common.perfSpinlock);
 
 	return EOK;
 }
@@ -361,9 +386,9 @@ int perf_start(unsigned pid)
 
 int perf_read(void *buffer, size_t bufsz)
 {
-	hal_spinlockSet(&threads_common.spinlock);
+	hal_spinlockSet(&threads_common.perfSpinlock);
 	bufsz = _cbuffer_read(&threads_common.perfBuffer, buffer, bufsz);
-	hal_spinlockClear(&threads_common.spinlock);
+	hal_spinlockClear(&threads_common.perfSpinlock);
 
 	return bufsz;
 }
@@ -371,15 +396,15 @@ int perf_read(void *buffer, size_t bufsz)
 
 int perf_finish()
 {
-	hal_spinlockSet(&threads_common.spinlock);
+	hal_spinlockSet(&threads_common.perfSpinlock);
 	if (threads_common.perfGather) {
 		threads_common.perfGather = 0;
-		hal_spinlockClear(&threads_common.spinlock);
+		hal_spinlockClear(&threads_common.perfSpinlock);
 
 		perf_bufferFree(threads_common.perfBuffer.data, &threads_common.perfPages);
 	}
 	else {
-		hal_spinlockClear(&threads_common.spinlock);
+		hal_spinlockClear(&threads_common.perfSpinlock);
 	}
 
 	return EOK;
@@ -387,35 +412,203 @@ int perf_finish()
 
 
 /*
- * Time management
+ * Run queues
  */
 
 
-static void _threads_updateWakeup(time_t now, thread_t *min)
+static inline threads_cpu_t *_threads_cpu(void)
+{
+	return threads_common.cpus + hal_cpuGetID();
+}
+
+
+/* Note: called with run queue spinlock set */
+static void _threads_enqueue(threads_cpu_t *cpu, thread_t *t)
+{
+	LIST_ADD(&cpu->ready[t->priority], t);
+	cpu->readymask |= 1 << t->priority;
+	cpu->nready++;
+}
+
+
+/* Note: called with run queue spinlock set */
+static void _threads_dequeue(threads_cpu_t *cpu, thread_t *t)
+{
+	LIST_REMOVE(&cpu->ready[t->priority], t);
+
+	if (cpu->ready[t->priority] == NULL)
+		cpu->readymask &= ~(1 << t->priority);
+
+	cpu->nready--;
+}
+
+
+/* Note: called with run queue spinlock set */
+static thread_t *_threads_pick(threads_cpu_t *cpu)
 {
-#ifdef HPTIMER_IRQ
 	thread_t *t;
-	time_t wakeup;
 
-	if (min != NULL)
-		t = min;
-	else
-		t = lib_treeof(thread_t, sleeplinkage, lib_rbMinimum(threads_common.sleeping.root));
+	if (!cpu->readymask)
+		return NULL;
 
-	if (t != NULL) {
-		if (now >= t->wakeup)
-			wakeup = 1;
-		else
-			wakeup = t->wakeup - now;
+	t = cpu->ready[hal_cpuGetFirstBit(cpu->readymask)];
+	_threads_dequeue(cpu, t);
+
+	return t;
+}
+
+
+/* Selects run queue for a thread which has never been scheduled */
+static unsigned int _threads_place(void)
+{
+	unsigned int i, best = 0;
+
+	for (i = 1; i < hal_cpuGetCount(); i++) {
+		if (threads_common.cpus[i].nready < threads_common.cpus[best].nready)
+			best = i;
 	}
-	else {
-		wakeup = TIMER_US2CYC(1000);
+
+	return best;
+}
+
+
+#ifdef HPTIMER_IRQ
+/* Programs one-shot timer for the nearest sleeper deadline or the end of timeslice, whichever comes first */
+static void _threads_program(threads_cpu_t *cpu, time_t now)
+{
+	time_t deadline = cpu->sleepnext, wakeup;
+
+	/* Timeslice matters only if there is another thread of the same priority to switch to */
+	if (cpu->current != NULL && cpu->ready[cpu->current->priority] != NULL) {
+		if (!deadline || now + THREADS_TIMESLICE < deadline)
+			deadline = now + THREADS_TIMESLICE;
 	}
 
-	if (wakeup > TIMER_US2CYC(1200))
-		wakeup = TIMER_US2CYC(1000);
+	if (deadline == cpu->deadline)
+		return;
+
+	/* Nothing to wait for - leave the timer stopped */
+	if ((cpu->deadline = deadline) == 0)
+		return;
+
+	if (now >= deadline)
+		wakeup = 1;
+	else
+		wakeup = deadline - now;
+
+	if (wakeup > TIMER_MAXWAKEUP)
+		wakeup = TIMER_MAXWAKEUP;
 
 	hal_setWakeup(wakeup);
+}
+#endif
+
+
+/* Note: always called with threads_common.spinlock set */
+static void _threads_ready(thread_t *t)
+{
+	threads_cpu_t *cpu = threads_common.cpus + t->cpu;
+
+	hal_spinlockSet(&cpu->spinlock);
+	t->state = READY;
+
+	/* Thread which is still running will be requeued by its own scheduler */
+	if (t != cpu->current) {
+		_threads_enqueue(cpu, t);
+
+#ifdef HPTIMER_IRQ
+		/* There is no periodic tick - preempt lower priority thread right away */
+		if (cpu == _threads_cpu()) {
+			if (cpu->current == NULL || t->priority < cpu->current->priority) {
+				cpu->deadline = 1;
+				hal_setWakeup(1);
+			}
+			else {
+				_threads_program(cpu, hal_getTimer());
+			}
+		}
+#endif
+	}
+	hal_spinlockClear(&cpu->spinlock);
+}
+
+
+/* Moves the most cache-cold thread from the busiest peer run queue to the given one */
+static int threads_steal(threads_cpu_t *cpu)
+{
+	threads_cpu_t *victim = NULL, *peer;
+	thread_t *t, *selected = NULL;
+	unsigned int i, n, prio;
+	u32 mask;
+
+	/* Unlocked scan - run queue lengths are used only as a hint */
+	for (i = 0; i < hal_cpuGetCount(); i++) {
+		peer = threads_common.cpus + i;
+
+		if (peer == cpu || peer->nready < 2)
+			continue;
+
+		if (victim == NULL || peer->nready > victim->nready)
+			victim = peer;
+	}
+
+	if (victim == NULL)
+		return 0;
+
+	/* Thread state can't change while it's being moved between run queues */
+	hal_spinlockSet(&threads_common.spinlock);
+	hal_spinlockSet(&victim->spinlock);
+
+	/* Take highest priority work, prefer the thread which hasn't run for the longest time */
+	for (mask = victim->readymask; mask != 0 && selected == NULL; mask &= ~(1 << prio)) {
+		prio = hal_cpuGetFirstBit(mask);
+		t = victim->ready[prio];
+
+		for (n = 0; n < THREADS_STEALSCAN; n++) {
+			if (!(t->flags & thread_pinned) && (selected == NULL || t->lastrun < selected->lastrun))
+				selected = t;
+
+			if ((t = t->next) == victim->ready[prio])
+				break;
+		}
+	}
+
+	if (selected != NULL) {
+		_threads_dequeue(victim, selected);
+		victim->migrations++;
+	}
+
+	hal_spinlockClear(&victim->spinlock);
+
+	if (selected != NULL) {
+		hal_spinlockSet(&cpu->spinlock);
+		selected->cpu = cpu - threads_common.cpus;
+		_threads_enqueue(cpu, selected);
+		cpu->steals++;
+		hal_spinlockClear(&cpu->spinlock);
+	}
+
+	hal_spinlockClear(&threads_common.spinlock);
+
+	return selected != NULL;
+}
+
+
+/*
+ * Time management
+ */
+
+
+/* Note: always called with threads_common.spinlock set */
+static void _threads_updateWakeup(time_t now)
+{
+#ifdef HPTIMER_IRQ
+	threads_cpu_t *cpu = _threads_cpu();
+
+	hal_spinlockSet(&cpu->spinlock);
+	cpu->sleepnext = lib_wheelNext(&threads_common.sleeping);
+	_threads_program(cpu, now);
+	hal_spinlockClear(&cpu->spinlock);
 #endif
 }
 
@@ -432,8 +625,8 @@ static inline time_t _threads_getTimer(void)
 
 int threads_timeintr(unsigned int n, cpu_context_t *context, void *arg)
 {
+	threads_cpu_t *cpu = _threads_cpu();
 	thread_t *t;
-	unsigned int i = 0;
 	time_t now;
 
 	hal_spinlockSet(&threads_common.spinlock);
@@ -441,35 +634,38 @@ int threads_timeintr(unsigned int n, cpu_context_t *context, void *arg)
 #ifdef HPTIMER_IRQ
 	now = threads_common.jiffies = hal_getTimer();
 #else
-	now = threads_common.jiffies += TIMER_US2CYC(1000);
+	now = threads_common.jiffies += THREADS_TIMESLICE;
 #endif
 
-	for (;; i++) {
-		t = lib_treeof(thread_t, sleeplinkage, lib_rbMinimum(threads_common.sleeping.root));
+	hal_spinlockSet(&cpu->spinlock);
+	cpu->ticks++;
 
-		if (t == NULL || t->wakeup > now)
-			break;
+	/* Count periodic ticks which would have fired since the previous interrupt */
+	if (now - cpu->lasttick >= 2 * THREADS_TIMESLICE)
+		cpu->ticksAvoided += (now - cpu->lasttick) / THREADS_TIMESLICE - 1;
+	cpu->lasttick = now;
+
+#ifdef HPTIMER_IRQ
+	/* One-shot timer has expired */
+	cpu->deadline = 0;
+#endif
+	hal_spinlockClear(&cpu->spinlock);
 
+	while ((t = lib_wheelof(thread_t, sleeplinkage, lib_wheelExpire(&threads_common.sleeping, now))) != NULL) {
 		_perf_waking(t);
 
-		lib_rbRemove(&threads_common.sleeping, &t->sleeplinkage);
 		t->wakeup = 0;
 		hal_cpuSetReturnValue(t->context, -ETIME);
 
-		t->state = READY;
-
 		if (t->wait != NULL) {
 			LIST_REMOVE(t->wait, t);
 			t->wait = NULL;
 		}
 
-		/* MOD - test presence for all cores */
-		if (t != threads_common.current[hal_cpuGetID()])
-			LIST_ADD(&threads_common.ready[t->priority], t);
-
+		_threads_ready(t);
 	}
 
-	_threads_updateWakeup(now, t);
+	_threads_updateWakeup(now);
 
 	hal_spinlockClear(&threads_common.spinlock);
 
@@ -523,29 +719,33 @@ int threads_getCpuTime(thread_t *t)
 {
 	int i;
 	u64 curr = 0, tot = 0;
+	threads_cpu_t *cpu;
 
-	hal_spinlockSet(&threads_common.spinlock);
-	threads_findCurrBucket(&threads_common.load, threads_common.jiffies);
-	threads_findCurrBucket(&t->load, threads_common.jiffies);
+	if (t == NULL)
+		return 0;
 
-	if (t != NULL) {
-		for (i = 0; i < sizeof(t->load.cycl) / sizeof(t->load.cycl[0]); ++i) {
-			curr += t->load.cycl[i];
-			tot += threads_common.load.cycl[i];
-		}
+	cpu = threads_common.cpus + t->cpu;
 
-		if (tot != 0)
-			curr = (curr * 1000) / tot;
-		else
-			curr = 0;
+	hal_spinlockSet(&cpu->spinlock);
+	threads_findCurrBucket(&cpu->load, _threads_getTimer());
+	threads_findCurrBucket(&t->load, _threads_getTimer());
+
+	for (i = 0; i < sizeof(t->load.cycl) / sizeof(t->load.cycl[0]); ++i) {
+		curr += t->load.cycl[i];
+		tot += cpu->load.cycl[i];
 	}
-	hal_spinlockClear(&threads_common.spinlock);
+
+	if (tot != 0)
+		curr = (curr * 1000) / tot;
+	else
+		curr = 0;
+	hal_spinlockClear(&cpu->spinlock);
 
 	return (int)curr;
 }
 
 
-static void threads_cpuTimeCalc(thread_t *current, thread_t *selected)
+static void threads_cpuTimeCalc(threads_cpu_t *cpu, thread_t *current, thread_t *selected)
 {
 	cycles_t now = 0;
 	time_t jiffies;
@@ -553,7 +753,8 @@ static void threads_cpuTimeCalc(thread_t *current, thread_t *selected)
 	jiffies = threads_common.jiffies;
 
 #ifdef HPTIMER_IRQ
-	now = hal_getTimer();
+	/* Timer interrupts are sparse in tickless mode - use current time instead of jiffies */
+	jiffies = now = hal_getTimer();
 #else
 	hal_cpuGetCycles(&now);
 #endif
@@ -564,10 +765,10 @@ static void threads_cpuTimeCalc(thread_t *current, thread_t *selected)
 	now += threads_common.jiffies;
 #endif
 
-	threads_findCurrBucket(&threads_common.load, jiffies);
+	threads_findCurrBucket(&cpu->load, jiffies);
 
-	threads_common.load.cycl[threads_common.load.cyclptr] += now - threads_common.load.cyclPrev;
-	threads_common.load.cyclPrev = now;
+	cpu->load.cycl[cpu->load.cyclptr] += now - cpu->load.cyclPrev;
+	cpu->load.cyclPrev = now;
 
 	if (current != NULL) {
 		/* Find current bucket */
@@ -600,35 +801,36 @@ int threads_getCpuTime(thread_t *t)
 
 int threads_schedule(unsigned int n, cpu_context_t *context, void *arg)
 {
+	threads_cpu_t *cpu;
 	thread_t *current, *selected;
-	unsigned int i;
 	process_t *proc;
 
-	threads_common.executions++;
+	cpu = _threads_cpu();
 
-	hal_spinlockSet(&threads_common.spinlock);
-	current = threads_common.current[hal_cpuGetID()];
+	hal_spinlockSet(&cpu->spinlock);
+	cpu->executions++;
+	current = cpu->current;
 
 	/* Save current thread context */
 	if (current != NULL) {
 		current->context = context;
+		current->lastrun = threads_common.jiffies;
 
 		/* Move thread to the end of queue */
 		if (current->state == READY) {
-			LIST_ADD(&threads_common.ready[current->priority], current);
+			_threads_enqueue(cpu, current);
 			_perf_preempted(current);
 		}
 	}
 
-	/* Get next thread */
-	for (i = 0; i < sizeof(threads_common.ready) / sizeof(thread_t *); i++) {
-		if ((selected = threads_common.ready[i]) != NULL)
-			break;
-	}
+	/* Get next thread, thread handed off to bypasses ready queues */
+	if ((selected = cpu->handoff) != NULL)
+		cpu->handoff = NULL;
+	else
+		selected = _threads_pick(cpu);
 
 	if (selected != NULL) {
-		LIST_REMOVE(&threads_common.ready[selected->priority], selected);
-		threads_common.current[hal_cpuGetID()] = selected;
+		cpu->current = selected;
 
 		if (((proc = selected->process) != NULL) && (proc->mapp != NULL)) {
 			/* Switch address space */
@@ -642,7 +844,12 @@ int threads_schedule(unsigned int n, cpu_context_t *context, void *arg)
 
 #ifndef CPU_STM32
 	/* Update CPU usage */
-	threads_cpuTimeCalc(current, selected);
+	threads_cpuTimeCalc(cpu, current, selected);
+#endif
+
+#ifdef HPTIMER_IRQ
+	/* Arm timer for the end of timeslice of selected thread if needed */
+	_threads_program(cpu, hal_getTimer());
 #endif
 
 	/* Test stack usage */
@@ -651,7 +858,7 @@ int threads_schedule(unsigned int n, cpu_context_t *context, void *arg)
 		for (;;);
 	}
 
-	hal_spinlockClear(&threads_common.spinlock);
+	hal_spinlockClear(&cpu->spinlock);
 
 	return EOK;
 }
@@ -659,46 +866,58 @@ int threads_schedule(unsigned int n, cpu_context_t *context, void *arg)
 
 static thread_t *_proc_current(void)
 {
-	thread_t *current;
-
-	current = threads_common.current[hal_cpuGetID()];
-
-	return current;
+	return _threads_cpu()->current;
 }
 
 
 thread_t *proc_current(void)
 {
+	threads_cpu_t *cpu = _threads_cpu();
 	thread_t *current;
 
-	hal_spinlockSet(&threads_common.spinlock);
-	current = threads_common.current[hal_cpuGetID()];
-	hal_spinlockClear(&threads_common.spinlock);
+	hal_spinlockSet(&cpu->spinlock);
+	current = cpu->current;
+	hal_spinlockClear(&cpu->spinlock);
 
 	return current;
 }
 
 
+/* Note: always called with threads_common.spinlock set */
+static void _threads_disown(thread_t *thr)
+{
+	lock_t *l;
+
+	/* Locks left held by dead thread can't pass priority to it anymore */
+	while ((l = thr->locks) != NULL) {
+		LIST_REMOVE(&thr->locks, l);
+		l->owner = NULL;
+	}
+}
+
+
 int proc_threadCreate(process_t *process, void (*start)(void *), unsigned int *id, unsigned int priority, size_t kstacksz, void *stack, size_t stacksz, void *arg)
 {
 	/* TODO - save user stack and it's size in thread_t */
 	thread_t *t, *current = proc_current();
 
-	if (priority >= sizeof(threads_common.ready) / sizeof(thread_t *))
+	if (priority >= THREADS_PRIORITIES)
 		return -EINVAL;
 
 	hal_spinlockSet(&threads_common.spinlock);
-	if ((t = threads_common.ghosts) != NULL)
+	if ((t = threads_common.ghosts) != NULL) {
 		LIST_REMOVE(&threads_common.ghosts, t);
+		_threads_disown(t);
+	}
 	hal_spinlockClear(&threads_common.spinlock);
 
 	if (t == NULL) {
-		if ((t = (thread_t *)vm_kmalloc(sizeof(thread_t))) == NULL)
+		if ((t = (thread_t *)vm_cacheAlloc(threads_common.cache)) == NULL)
 			return -ENOMEM;
 
 		t->kstacksz = kstacksz;
 		if ((t->kstack = vm_kmalloc(t->kstacksz)) == NULL) {
-			vm_kfree(t);
+			vm_cacheFree(threads_common.cache, t);
 			return -ENOMEM;
 		}
 
@@ -709,7 +928,8 @@ int proc_threadCreate(process_t *process, void (*start)(void *), unsigned int *i
 
 		t->kstacksz = kstacksz;
 		if ((t->kstack = vm_kmalloc(t->kstacksz)) == NULL) {
-			vm_kfree(t);
+			hal_spinlockDestroy(&t->execwaitsl);
+			vm_cacheFree(threads_common.cache, t);
 			return -ENOMEM;
 		}
 	}
@@ -729,9 +949,17 @@ int proc_threadCreate(process_t *process, void (*start)(void *), unsigned int *i
 
 	t->stick = 0;
 	t->utick = 0;
+	t->lastrun = 0;
 	t->priority = priority;
+	t->priorityBase = priority;
+	t->blocking = NULL;
+	t->locks = NULL;
 	t->flags = thread_protected;
 
+	/* Idle threads never migrate */
+	if (start == threads_idlethr)
+		t->flags |= thread_pinned;
+
 	if (process != NULL) {
 		hal_spinlockSet(&threads_common.spinlock);
 		LIST_ADD_EX(&process->threads, t, procnext, procprev);
@@ -768,9 +996,11 @@ int proc_threadCreate(process_t *process, void (*start)(void *), unsigned int *i
 	t->maxWait = 0;
 	_perf_waking(t);
 
-	LIST_ADD(&threads_common.ready[priority], t);
 	if (current != NULL && current->flags & thread_killme)
 		t->flags |= thread_killme;
+
+	t->cpu = _threads_place();
+	_threads_ready(t);
 	hal_spinlockClear(&threads_common.spinlock);
 
 	proc_lockClear(&threads_common.lock);
@@ -784,7 +1014,7 @@ void proc_threadProtect(void)
 	thread_t *t;
 
 	hal_spinlockSet(&threads_common.spinlock);
-	t = threads_common.current[hal_cpuGetID()];
+	t = _proc_current();
 	if (t != NULL)
 		t->flags |= thread_protected;
 	hal_spinlockClear(&threads_common.spinlock);
@@ -796,7 +1026,7 @@ void proc_threadUnprotect(void)
 	thread_t *t;
 
 	hal_spinlockSet(&threads_common.spinlock);
-	t = threads_common.current[hal_cpuGetID()];
+	t = _proc_current();
 	if (t != NULL) {
 		t->flags &= ~thread_protected;
 		if (t->flags & thread_killme) {
@@ -814,6 +1044,7 @@ void proc_threadDestroy(void)
 {
 	thread_t *thr = proc_current();
 	process_t *proc = thr->process;
+	threads_cpu_t *cpu;
 	int zombie = 0;
 
 	hal_spinlockSet(&threads_common.spinlock);
@@ -829,7 +1060,12 @@ void proc_threadDestroy(void)
 
 	hal_spinlockSet(&threads_common.spinlock);
 	_perf_end(thr);
-	threads_common.current[hal_cpuGetID()] = NULL;
+
+	cpu = _threads_cpu();
+	hal_spinlockSet(&cpu->spinlock);
+	cpu->current = NULL;
+	hal_spinlockClear(&cpu->spinlock);
+
 	if (zombie || proc == NULL) {
 		LIST_ADD(&threads_common.ghosts, thr);
 	}
@@ -845,6 +1081,7 @@ void proc_threadDestroy(void)
 void proc_threadsDestroy(process_t *proc)
 {
 	thread_t *t = NULL, *n, *l;
+	threads_cpu_t *cpu;
 
 	hal_spinlockSet(&threads_common.spinlock);
 	n = proc->threads;
@@ -865,13 +1102,21 @@ void proc_threadsDestroy(process_t *proc)
 
 		if (t->state == SLEEP) {
 			if (t->wakeup)
-				lib_rbRemove(&threads_common.sleeping, &t->sleeplinkage);
+				lib_wheelRemove(&threads_common.sleeping, &t->sleeplinkage);
 
 			if (t->wait != NULL && *t->wait != (void *)-1)
 				LIST_REMOVE(t->wait, t);
 		}
 		else if (t->state == READY) {
-			LIST_REMOVE(&threads_common.ready[t->priority], t);
+			cpu = threads_common.cpus + t->cpu;
+
+			/* Thread handed off is not on ready queue */
+			hal_spinlockSet(&cpu->spinlock);
+			if (t == cpu->handoff)
+				cpu->handoff = NULL;
+			else if (t != cpu->current)
+				_threads_dequeue(cpu, t);
+			hal_spinlockClear(&cpu->spinlock);
 		}
 
 		LIST_ADD(&threads_common.ghosts, t);
@@ -958,40 +1203,104 @@ static void proc_cleanupZombie(process_t *proc)
 
 static void proc_cleanupGhost(thread_t *thr)
 {
+	hal_spinlockSet(&threads_common.spinlock);
+	_threads_disown(thr);
+	hal_spinlockClear(&threads_common.spinlock);
+
 	proc_lockSet(&threads_common.lock);
 	lib_rbRemove(&threads_common.id, &thr->idlinkage);
 	proc_lockClear(&threads_common.lock);
 
 	hal_spinlockDestroy(&thr->execwaitsl);
 	vm_kfree(thr->kstack);
-	vm_kfree(thr);
+	vm_cacheFree(threads_common.cache, thr);
 }
 
 
-int _proc_threadSetPriority(thread_t *t, unsigned int priority)
+/* Note: always called with threads_common.spinlock set */
+static void _threads_setPriority(thread_t *t, unsigned int priority)
 {
-	if (priority > sizeof(threads_common.ready) / sizeof(thread_t *))
-		return -EINVAL;
+	threads_cpu_t *cpu = threads_common.cpus + t->cpu;
+
+	hal_spinlockSet(&cpu->spinlock);
+
+	/* If thread exist in ready queue */
+	if (t->state == READY && t != cpu->current && t->next != NULL) {
+		_threads_dequeue(cpu, t);
+		t->priority = priority;
+		_threads_enqueue(cpu, t);
+	}
+	else {
+		t->priority = priority;
+	}
+
+	hal_spinlockClear(&cpu->spinlock);
+}
+
+
+/* Returns priority raised to the highest priority of threads in queue */
+static unsigned int _threads_queuePriority(thread_t *queue, unsigned int priority)
+{
+	thread_t *w;
+
+	if ((w = queue) == NULL || w == (void *)-1)
+		return priority;
 
-	hal_spinlockSet(&threads_common.spinlock);
 	do {
-		if (t->priority == priority)
-			break;
+		if (w->priority < priority)
+			priority = w->priority;
+	} while ((w = w->next) != queue);
 
-		/* If thread exist in ready queue */
-		if (t->next != NULL) {
+	return priority;
+}
 
-			LIST_REMOVE(&threads_common.ready[t->priority], t);
-			LIST_ADD(&threads_common.ready[priority], t);
 
-		}
-		t->priority = priority;
-		t = t->blocking;
+/* Returns base priority of thread raised to priority of threads waiting for locks it holds */
+static unsigned int _threads_inheritedPriority(thread_t *t)
+{
+	unsigned int priority = t->priorityBase;
+	lock_t *l;
+
+	if ((l = t->locks) == NULL)
+		return priority;
+
+	do
+		priority = _threads_queuePriority(l->queue, priority);
+	while ((l = l->next) != t->locks);
+
+	return priority;
+}
+
+
+/* Boosts owners along the chain of locks blocking t */
+static void _threads_boost(thread_t *t)
+{
+	thread_t *owner;
+
+	while (t->blocking != NULL && (owner = t->blocking->owner) != NULL && owner->priority > t->priority) {
+		_threads_setPriority(owner, t->priority);
+		t = owner;
 	}
-	while ((t != NULL) && (t->priority <= priority));
+}
+
+
+int proc_threadPriority(int priority)
+{
+	thread_t *current;
+
+	if (priority == -1)
+		return proc_current()->priorityBase;
+
+	if (priority < 0 || priority >= THREADS_PRIORITIES)
+		return -EINVAL;
 
+	hal_spinlockSet(&threads_common.spinlock);
+	current = _proc_current();
+	current->priorityBase = priority;
+	_threads_setPriority(current, _threads_inheritedPriority(current));
 	hal_spinlockClear(&threads_common.spinlock);
-	return EOK;
+
+	return priority;
 }
 
 
@@ -1011,16 +1320,16 @@ int proc_threadSleep(unsigned int us)
 
 	now = _threads_getTimer();
 
-	current = threads_common.current[hal_cpuGetID()];
+	current = _proc_current();
 	current->state = SLEEP;
 	current->wait = NULL;
 	current->wakeup = now + TIMER_US2CYC(us);
 
-	lib_rbInsert(&threads_common.sleeping, &current->sleeplinkage);
+	lib_wheelInsert(&threads_common.sleeping, &current->sleeplinkage, current->wakeup);
 
 	_perf_enqueued(current);
 
-	_threads_updateWakeup(now, NULL);
+	_threads_updateWakeup(now);
 
 	if ((err = hal_cpuReschedule(&threads_common.spinlock)) == -ETIME)
 		err = EOK;
@@ -1041,7 +1350,7 @@ static void _proc_threadEnqueue(thread_t **queue, time_t timeout)
 		return;
 	}
 
-	current = threads_common.current[hal_cpuGetID()];
+	current = _proc_current();
 
 	LIST_ADD(queue, current);
 
@@ -1052,8 +1361,8 @@ static void _proc_threadEnqueue(thread_t **queue, time_t timeout)
 	if (timeout) {
 		now = _threads_getTimer();
 		current->wakeup = now + TIMER_US2CYC(timeout);
-		lib_rbInsert(&threads_common.sleeping, &current->sleeplinkage);
-		_threads_updateWakeup(now, NULL);
+		lib_wheelInsert(&threads_common.sleeping, &current->sleeplinkage, current->wakeup);
+		_threads_updateWakeup(now);
 	}
 
 	_perf_enqueued(current);
@@ -1106,15 +1415,12 @@ static void _proc_threadWakeup(thread_t **queue)
 	LIST_REMOVE(queue, first);
 
 	if (first->wakeup != 0)
-		lib_rbRemove(&threads_common.sleeping, &first->sleeplinkage);
+		lib_wheelRemove(&threads_common.sleeping, &first->sleeplinkage);
 
 	first->wakeup = 0;
 	first->wait = NULL;
-	first->state = READY;
 
-	/* MOD */
-	if (first != threads_common.current[hal_cpuGetID()])
-		LIST_ADD(&threads_common.ready[first->priority], first);
+	_threads_ready(first);
 
 	return;
 }
@@ -1132,6 +1438,71 @@ void proc_threadWakeup(thread_t **queue)
 }
 
 
+/*
+ * Wakes first thread from wakeq and, unless waitq is NULL, puts current thread to sleep on waitq.
+ * Woken thread is switched to directly if it runs on local CPU and no ready thread has higher
+ * priority. With NULL waitq the switch is a directed yield - current thread stays ready and is
+ * switched to only if it doesn't have higher priority than the woken one.
+ */
+int proc_threadHandoff(thread_t **wakeq, thread_t **waitq, spinlock_t *spinlock)
+{
+	threads_cpu_t *cpu = _threads_cpu();
+	thread_t *current, *t;
+	unsigned int priority;
+	int err;
+
+	hal_spinlockSet(&threads_common.spinlock);
+	current = _proc_current();
+
+	/* Current thread stays ready if wakeup has been already posted to waitq */
+	if (waitq != NULL)
+		_proc_threadEnqueue(waitq, 0);
+
+	if ((t = *wakeq) == NULL || t == (void *)-1) {
+		(*wakeq) = (void *)(-1);
+		t = NULL;
+	}
+	else {
+		hal_spinlockSet(&cpu->spinlock);
+		priority = (current->state == READY) ? current->priority : THREADS_PRIORITIES;
+
+		if (cpu->readymask && hal_cpuGetFirstBit(cpu->readymask) < priority)
+			priority = hal_cpuGetFirstBit(cpu->readymask);
+
+		if (t->cpu != cpu - threads_common.cpus || cpu->handoff != NULL || t->priority > priority) {
+			hal_spinlockClear(&cpu->spinlock);
+			_proc_threadWakeup(wakeq);
+			t = NULL;
+		}
+		else {
+			_perf_waking(t);
+			LIST_REMOVE(wakeq, t);
+
+			if (t->wakeup != 0)
+				lib_wheelRemove(&threads_common.sleeping, &t->sleeplinkage);
+
+			t->wakeup = 0;
+			t->wait = NULL;
+			t->state = READY;
+
+			cpu->handoff = t;
+			cpu->handoffs++;
+			hal_spinlockClear(&cpu->spinlock);
+		}
+	}
+
+	hal_spinlockClear(&threads_common.spinlock);
+
+	if (t == NULL && current->state == READY)
+		return EOK;
+
+	err = hal_cpuReschedule(spinlock);
+	hal_spinlockSet(spinlock);
+
+	return err;
+}
+
+
 void proc_threadBroadcast(thread_t **queue)
 {
 	hal_spinlockSet(&threads_common.spinlock);
@@ -1304,18 +1675,16 @@ int proc_settime(time_t offs)
 
 int proc_nextWakeup(void)
 {
-	thread_t *thread;
 	int wakeup = 0;
-	time_t now;
+	time_t now, next;
 
 	hal_spinlockSet(&threads_common.spinlock);
-	thread = lib_treeof(thread_t, sleeplinkage, lib_rbMinimum(threads_common.sleeping.root));
-	if (thread != NULL) {
+	if ((next = lib_wheelNext(&threads_common.sleeping)) != 0) {
 		now = _threads_getTimer();
-		if (now >= thread->wakeup)
+		if (now >= next)
 			wakeup = 0;
 		else
-			wakeup = thread->wakeup - now;
+			wakeup = next - now;
 	}
 	hal_spinlockClear(&threads_common.spinlock);
 
@@ -1412,10 +1781,8 @@ int proc_sigpost(process_t *process, thread_t *thread, int sig)
 	}
 
 	if (execthr->state == SLEEP) {
-		execthr->state = READY;
-
 		if (execthr->wakeup > 0) {
-			lib_rbRemove(&threads_common.sleeping, &execthr->sleeplinkage);
+			lib_wheelRemove(&threads_common.sleeping, &execthr->sleeplinkage);
 			execthr->wakeup = 0;
 		}
 
@@ -1424,8 +1791,8 @@ int proc_sigpost(process_t *process, thread_t *thread, int sig)
 			execthr->wait = NULL;
 		}
 
-		LIST_ADD(&threads_common.ready[execthr->priority], execthr);
 		hal_cpuSetReturnValue(execthr->context, -EINTR);
+		_threads_ready(execthr);
 	}
 
 	hal_spinlockClear(&threads_common.spinlock);
@@ -1438,6 +1805,27 @@ void proc_sighandle(void *kstack)
 	thread_t *thr;
 	cpu_context_t signal, *top, *dummy;
 	long s;
+#ifndef NOMMU
+	int err;
+
+	/* Handler argument is pushed onto user stack with spinlock set, it can't fault there.
+	 * Fault the page in with interrupts enabled, thread protected against nested delivery */
+	thr = proc_current();
+	top = thr->kstack + thr->kstacksz - sizeof(cpu_context_t);
+
+	proc_threadProtect();
+	hal_cpuEnableInterrupts();
+	err = vm_mapForce(thr->process->mapp, (void *)(((unsigned long)hal_cpuGetUserSP(top) - sizeof(void *)) & ~(SIZE_PAGE - 1)), PROT_READ | PROT_WRITE | PROT_USER);
+
+	/* Handler can't run without its stack, delivery doesn't go on */
+	if (err != EOK) {
+		proc_sigpost(thr->process, thr, signal_kill);
+		proc_threadDestroy();
+	}
+
+	hal_cpuDisableInterrupts();
+	proc_threadUnprotect();
+#endif
 
 	hal_spinlockSet(&threads_common.spinlock);
 	thr = _proc_current();
@@ -1486,12 +1874,38 @@ void proc_sigreturn(int s)
 
 int _proc_lockSet(lock_t *lock)
 {
+	thread_t *current = proc_current();
+	unsigned int priority;
+	int err = EOK;
+
 	while (lock->v == 0) {
-		if (proc_threadWait(&lock->queue, &lock->spinlock, 0) == -EINTR)
-			return -EINTR;
+		/* Lend our priority to the owner and to whoever the owner waits for */
+		hal_spinlockSet(&threads_common.spinlock);
+		current->blocking = lock;
+		_threads_boost(current);
+		hal_spinlockClear(&threads_common.spinlock);
+
+		if ((err = proc_threadWait(&lock->queue, &lock->spinlock, 0)) == -EINTR)
+			break;
 	}
 
+	if (current->blocking != NULL) {
+		hal_spinlockSet(&threads_common.spinlock);
+		current->blocking = NULL;
+
+		/* Take over boost from threads still waiting for the lock */
+		if (err != -EINTR && (priority = _threads_queuePriority(lock->queue, current->priority)) != current->priority)
+			_threads_setPriority(current, priority);
+		hal_spinlockClear(&threads_common.spinlock);
+	}
+
+	if (err == -EINTR)
+		return err;
+
 	lock->v = 0;
+	lock->owner = current;
+	LIST_ADD(&current->locks, lock);
+
 	return EOK;
 }
 
@@ -1518,10 +1932,14 @@ int proc_lockTry(lock_t *lock)
 		return -EINVAL;
 
 	hal_spinlockSet(&lock->spinlock);
-	if (lock->v == 0)
+	if (lock->v == 0) {
 		err = -EBUSY;
-
-	lock->v = 0;
+	}
+	else {
+		lock->v = 0;
+		lock->owner = proc_current();
+		LIST_ADD(&lock->owner->locks, lock);
+	}
 	hal_spinlockClear(&lock->spinlock);
 
 	return err;
@@ -1530,6 +1948,20 @@ int proc_lockTry(lock_t *lock)
 
 int _proc_lockClear(lock_t *lock)
 {
+	thread_t *owner;
+
+	if ((owner = lock->owner) != NULL) {
+		LIST_REMOVE(&owner->locks, lock);
+		lock->owner = NULL;
+
+		/* Drop priority inherited through this lock */
+		if (owner->priority != owner->priorityBase) {
+			hal_spinlockSet(&threads_common.spinlock);
+			_threads_setPriority(owner, _threads_inheritedPriority(owner));
+			hal_spinlockClear(&threads_common.spinlock);
+		}
+	}
+
 	lock->v = 1;
 	if (lock->queue == NULL || lock->queue == (void *)-1)
 		return 0;
@@ -1585,8 +2017,9 @@ int proc_lockWait(thread_t **queue, lock_t *lock, time_t timeout)
 
 int proc_lockInit(lock_t *lock)
 {
+	lock->next = NULL;
+	lock->prev = NULL;
 	lock->owner = NULL;
-	lock->priority = 0;
 	lock->queue = NULL;
 	lock->v = 1;
 	hal_spinlockCreate(&lock->spinlock, "lock.spinlock");
@@ -1596,6 +2029,20 @@ int proc_lockInit(lock_t *lock)
 
 int proc_lockDone(lock_t *lock)
 {
+	thread_t *owner;
+
+	if ((owner = lock->owner) != NULL) {
+		LIST_REMOVE(&owner->locks, lock);
+		lock->owner = NULL;
+
+		/* Drop priority inherited through this lock */
+		if (owner->priority != owner->priorityBase) {
+			hal_spinlockSet(&threads_common.spinlock);
+			_threads_setPriority(owner, _threads_inheritedPriority(owner));
+			hal_spinlockClear(&threads_common.spinlock);
+		}
+	}
+
 	hal_spinlockDestroy(&lock->spinlock);
 	return EOK;
 }
@@ -1614,6 +2061,12 @@ static void threads_idlethr(void *arg)
 
 	for (;;) {
 
+		/* Nothing else is runnable on this core - pull work from the busiest one */
+		if (threads_steal(_threads_cpu())) {
+			hal_cpuReschedule(NULL);
+			continue;
+		}
+
 		/* Don't grab spinlocks unless there is something to clean up */
 		if (threads_common.ghosts != NULL) {
 			do {
@@ -1643,6 +2096,10 @@ static void threads_idlethr(void *arg)
 			while (zombie != NULL);
 		}
 
+		/* Zero free pages ahead of anonymous faults, one per pass to stay preemptible */
+		if (vm_pageZeroIdle())
+			continue;
+
 		wakeup = proc_nextWakeup();
 
 		if (wakeup > TIMER_US2CYC(2000)) {
@@ -1660,21 +2117,27 @@ static void threads_idlethr(void *arg)
 
 void proc_threadsDump(unsigned int priority)
 {
+	threads_cpu_t *cpu;
 	thread_t *t;
+	unsigned int i;
 
 	lib_printf("threads: ");
-	hal_spinlockSet(&threads_common.spinlock);
 
-	t = threads_common.ready[priority];
-	do {
-		lib_printf("[%p] ", t);
+	for (i = 0; i < hal_cpuGetCount(); i++) {
+		cpu = threads_common.cpus + i;
 
-		if (t == NULL)
-			break;
+		hal_spinlockSet(&cpu->spinlock);
+		t = cpu->ready[priority];
+		do {
+			lib_printf("[%p] ", t);
 
-		t = t->next;
-	} while (t != threads_common.ready[priority]);
-	hal_spinlockClear(&threads_common.spinlock);
+			if (t == NULL)
+				break;
+
+			t = t->next;
+		} while (t != cpu->ready[priority]);
+		hal_spinlockClear(&cpu->spinlock);
+	}
 
 	lib_printf("\n");
 
@@ -1778,11 +2241,36 @@ int proc_threadsList(int n, threadinfo_t *info)
 }
 
 
+int proc_schedInfo(int n, schedinfo_t *info)
+{
+	threads_cpu_t *cpu;
+	int i;
+
+	for (i = 0; i < n && i < hal_cpuGetCount(); i++) {
+		cpu = threads_common.cpus + i;
+
+		hal_spinlockSet(&cpu->spinlock);
+		info[i].cpu = i;
+		info[i].nready = cpu->nready;
+		info[i].switches = cpu->executions;
+		info[i].steals = cpu->steals;
+		info[i].migrations = cpu->migrations;
+		info[i].handoffs = cpu->handoffs;
+		info[i].ticks = cpu->ticks;
+		info[i].ticksAvoided = cpu->ticksAvoided;
+		hal_spinlockClear(&cpu->spinlock);
+	}
+
+	return i;
+}
+
+
 int _threads_init(vm_map_t *kmap, vm_object_t *kernel)
 {
 	unsigned int i;
+	threads_cpu_t *cpu;
+
 	threads_common.kmap = kmap;
-	threads_common.executions = 0;
 	threads_common.jiffies = 0;
 	threads_common.ghosts = NULL;
 	threads_common.zombies = NULL;
@@ -1792,31 +2280,33 @@ int _threads_init(vm_map_t *kmap, vm_object_t *kernel)
 
 	proc_lockInit(&threads_common.lock);
 
-#ifndef CPU_STM32
-	hal_memset(&threads_common.load, 0, sizeof(threads_common.load));
-#endif
-
-	/* Initiaizlie scheduler queue */
-	for (i = 0; i < sizeof(threads_common.ready) / sizeof(thread_t *); i++)
-		threads_common.ready[i] = NULL;
-
-	lib_rbInit(&threads_common.sleeping, threads_sleepcmp, NULL);
+	lib_wheelInit(&threads_common.sleeping, hal_cpuGetLastBit(TIMER_US2CYC(THREADS_WHEELRES)), 0);
 	lib_rbInit(&threads_common.id, threads_idcmp, NULL);
 
-	lib_printf("proc: Initializing thread scheduler, priorities=%d\n", sizeof(threads_common.ready) / sizeof(thread_t *));
+	lib_printf("proc: Initializing thread scheduler, priorities=%d, cpus=%d\n", THREADS_PRIORITIES, hal_cpuGetCount());
 
 	hal_spinlockCreate(&threads_common.spinlock, "threads.spinlock");
+	hal_spinlockCreate(&threads_common.perfSpinlock, "threads.perfSpinlock");
 
-	/* Allocate and initialize current threads array */
-	if ((threads_common.current = (thread_t **)vm_kmalloc(sizeof(thread_t *) * hal_cpuGetCount())) == NULL)
+	if ((threads_common.cache = vm_cacheCreate("thread", sizeof(thread_t), NULL)) == NULL)
 		return -ENOMEM;
 
-	/* Run idle thread on every cpu */
+	/* Allocate and initialize per-CPU run queues
+	 * Note: all HALs in the tree run single CPU, paths with more than one queue are untested */
+	if ((threads_common.cpus = (threads_cpu_t *)vm_kmalloc(sizeof(threads_cpu_t) * hal_cpuGetCount())) == NULL)
+		return -ENOMEM;
+
+	hal_memset(threads_common.cpus, 0, sizeof(threads_cpu_t) * hal_cpuGetCount());
+
 	for (i = 0; i < hal_cpuGetCount(); i++) {
-		threads_common.current[i] = NULL;
-		proc_threadCreate(NULL, threads_idlethr, NULL, sizeof(threads_common.ready) / sizeof(thread_t *) - 1, SIZE_KSTACK, NULL, 0, NULL);
+		cpu = threads_common.cpus + i;
+		hal_spinlockCreate(&cpu->spinlock, "threads.cpu.spinlock");
 	}
 
+	/* Run idle thread on every cpu */
+	for (i = 0; i < hal_cpuGetCount(); i++)
+		proc_threadCreate(NULL, threads_idlethr, NULL, THREADS_PRIORITIES - 1, SIZE_KSTACK, NULL, 0, NULL);
+
 	/* Install scheduler on clock interrupt */
 #ifdef PENDSV_IRQ
 	hal_memset(&threads_common.pendsvHandler, NULL, sizeof(threads_common.pendsvHandler));
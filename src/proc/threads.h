@@ -44,7 +44,7 @@ typedef struct _thread_t {
 	struct _thread_t *next;
 	struct _thread_t *prev;
 
-	rbnode_t sleeplinkage;
+	wheelnode_t sleeplinkage;
 	rbnode_t idlinkage;
 
 	struct _process_t *process;
@@ -53,7 +53,12 @@ typedef struct _thread_t {
 
 	unsigned long id;
 	unsigned int priority;
-	struct _thread_t *blocking;
+	unsigned int priorityBase;
+	unsigned int cpu;
+
+	/* Priority inheritance - lock the thread waits for and locks it holds */
+	struct _lock_t *blocking;
+	struct _lock_t *locks;
 
 	struct _thread_t **wait;
 	volatile time_t wakeup;
@@ -61,6 +66,7 @@ typedef struct _thread_t {
 	volatile enum {
 		thread_killme = 1 << 0,
 		thread_protected = 1 << 1,
+		thread_pinned = 1 << 2,
 	} flags;
 
 	unsigned sigmask;
@@ -83,6 +89,7 @@ typedef struct _thread_t {
 
 	time_t readyTime;
 	time_t maxWait;
+	time_t lastrun;
 
 #ifndef CPU_STM32
 	cpu_load_t load;
@@ -140,12 +147,18 @@ extern int proc_waittid(int pid, int options);
 extern int proc_threadsList(int n, threadinfo_t *info);
 
 
+extern int proc_schedInfo(int n, schedinfo_t *info);
+
+
 extern void proc_zombie(process_t *proc);
 
 
 extern int proc_threadClone(void);
 
 
+extern int proc_threadPriority(int priority);
+
+
 extern int proc_threadSleep(unsigned int us);
 
 
@@ -158,6 +171,9 @@ extern void proc_threadWakeup(thread_t **queue);
 extern void proc_threadWakeupYield(thread_t **queue);
 
 
+extern int proc_threadHandoff(thread_t **wakeq, thread_t **waitq, spinlock_t *spinlock);
+
+
 extern void proc_threadBroadcast(thread_t **queue);
 
 
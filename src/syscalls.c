@@ -62,12 +62,33 @@ void *syscalls_mmap(void *ustack)
 	GETFROMSTACK(ustack, oid_t *, oid, 4);
 	GETFROMSTACK(ustack, offs_t, offs, 5);
 
-	if (oid == (void *)-1)
+	if (flags & MAP_ANONYMOUS)
+		oid = NULL;
+
+	flags &= ~MAP_ANONYMOUS;
+
+#ifdef NOMMU
+	/* There is a single address space, all memory is shared already */
+	flags &= ~MAP_SHARED;
+#endif
+
+	if (oid == (void *)-1) {
 		o = (void *)-1;
-	else if (oid == NULL)
+	}
+	else if (oid != NULL) {
+		if (vm_objectGet(&o, *oid) != EOK)
+			return NULL;
+	}
+	else if (flags & MAP_SHARED) {
+		/* Shared anonymous memory gets an object of its own, other processes map it by oid */
+		if (vm_objectCreate(&o, size) != EOK)
+			return NULL;
+
+		offs = 0;
+	}
+	else {
 		o = NULL;
-	else if (vm_objectGet(&o, *oid) != EOK)
-		return NULL;
+	}
 
 	vaddr = vm_mmap(proc_current()->process->mapp, vaddr, NULL, size, PROT_USER | prot, o, (o == NULL) ? -1 : offs, flags);
 	vm_objectPut(o);
@@ -92,6 +113,33 @@ void syscalls_munmap(void *ustack)
 }
 
 
+int syscalls_mmapOid(void *ustack)
+{
+	void *vaddr;
+	oid_t *oid, t;
+	int err;
+
+	GETFROMSTACK(ustack, void *, vaddr, 0);
+	GETFROMSTACK(ustack, oid_t *, oid, 1);
+
+	/* Copied out after the map is unlocked, storing to oid may fault */
+	if ((err = vm_mapOid(proc_current()->process->mapp, vaddr, &t)) == EOK)
+		hal_memcpy(oid, &t, sizeof(t));
+
+	return err;
+}
+
+
+void syscalls_mmapFaultAround(void *ustack)
+{
+	unsigned int npages;
+
+	GETFROMSTACK(ustack, unsigned int, npages, 0);
+
+	vm_mapFaultAround(proc_current()->process->mapp, npages);
+}
+
+
 /*
  * Process management
  */
@@ -218,18 +266,10 @@ int syscalls_usleep(void *ustack)
 int syscalls_priority(void *ustack)
 {
 	int priority;
-	thread_t *thread;
 
 	GETFROMSTACK(ustack, int, priority, 0);
 
-	thread = proc_current();
-
-	if (priority == -1)
-		return thread->priority;
-	else if (priority >= 0 && priority <= 7)
-		return thread->priority = priority;
-
-	return -EINVAL;
+	return proc_threadPriority(priority);
 }
 
 
@@ -250,6 +290,18 @@ int syscalls_threadsinfo(void *ustack)
 }
 
 
+int syscalls_schedinfo(void *ustack)
+{
+	int n;
+	schedinfo_t *info;
+
+	GETFROMSTACK(ustack, int, n, 0);
+	GETFROMSTACK(ustack, schedinfo_t *, info, 1);
+
+	return proc_schedInfo(n, info);
+}
+
+
 void syscalls_meminfo(void *ustack)
 {
 	meminfo_t *info;
@@ -406,6 +458,37 @@ int syscalls_condBroadcast(void *ustack)
 }
 
 
+/*
+ * Futexes
+ */
+
+
+int syscalls_futexWait(void *ustack)
+{
+	volatile u32 *uaddr;
+	u32 val;
+	time_t timeout;
+
+	GETFROMSTACK(ustack, volatile u32 *, uaddr, 0);
+	GETFROMSTACK(ustack, u32, val, 1);
+	GETFROMSTACK(ustack, time_t, timeout, 2);
+
+	return proc_futexWait(uaddr, val, timeout);
+}
+
+
+int syscalls_futexWake(void *ustack)
+{
+	volatile u32 *uaddr;
+	unsigned int n;
+
+	GETFROMSTACK(ustack, volatile u32 *, uaddr, 0);
+	GETFROMSTACK(ustack, unsigned int, n, 1);
+
+	return proc_futexWake(uaddr, n);
+}
+
+
 /*
  * Resources
  */
@@ -523,6 +606,30 @@ int syscalls_msgRespond(void *ustack)
 }
 
 
+int syscalls_msgRingCreate(void *ustack)
+{
+	unsigned int *h;
+
+	GETFROMSTACK(ustack, unsigned int *, h, 0);
+
+	return proc_msgRingCreate(h);
+}
+
+
+int syscalls_msgRingEnter(void *ustack)
+{
+	unsigned int h;
+	msgring_t *ring;
+	unsigned int wait;
+
+	GETFROMSTACK(ustack, unsigned int, h, 0);
+	GETFROMSTACK(ustack, msgring_t *, ring, 1);
+	GETFROMSTACK(ustack, unsigned int, wait, 2);
+
+	return proc_msgRingEnter(h, ring, wait);
+}
+
+
 int syscalls_lookup(void *ustack)
 {
 	char *name;
@@ -15,15 +15,31 @@
  */
 
 #include HAL
+#include "../../include/errno.h"
 #include "../proc/proc.h"
 
 
+#define TEST_PROC_SWITCHES 100000
+#define TEST_PROC_LOCKS    100000
+#define TEST_PROC_MSGS     100000
+#define TEST_PROC_XFERS    64
+#define TEST_PROC_XFERMAX  (4 << 20)
+
+
 struct {
 	volatile unsigned int rotations[8];
 	volatile time_t tm;
 	spinlock_t spinlock;
 	thread_t *queue;
 	unsigned int port;
+
+	thread_t *pingq[2];
+	volatile unsigned int turn;
+	volatile unsigned int done;
+	cycles_t b;
+	cycles_t e;
+
+	volatile u32 futex;
 } test_proc_common;
 
 
@@ -201,3 +217,259 @@ void test_proc_exit(void)
 	hal_cpuEnableInterrupts();
 	hal_cpuReschedule(NULL);
 }
+
+
+/*
+ * Scheduler benchmark - measures wakeup-to-run context switch latency
+ */
+
+
+static void test_proc_pingthr(void *arg)
+{
+	unsigned int i, me = (unsigned long)arg;
+
+	hal_spinlockSet(&test_proc_common.spinlock);
+	if (!me)
+		hal_cpuGetCycles(&test_proc_common.b);
+
+	for (i = 0; i < TEST_PROC_SWITCHES; i++) {
+		while (test_proc_common.turn != me)
+			proc_threadWait(&test_proc_common.pingq[me], &test_proc_common.spinlock, 0);
+
+		test_proc_common.turn = !me;
+		proc_threadWakeup(&test_proc_common.pingq[!me]);
+	}
+
+	if (++test_proc_common.done == 2) {
+		hal_cpuGetCycles(&test_proc_common.e);
+		lib_printf("test: [proc.schedule] %d switches, %u cycles per switch\n", 2 * TEST_PROC_SWITCHES,
+			(u32)((test_proc_common.e - test_proc_common.b) / (2 * TEST_PROC_SWITCHES)));
+	}
+	hal_spinlockClear(&test_proc_common.spinlock);
+
+	proc_threadDestroy();
+}
+
+
+void test_proc_schedule(void)
+{
+	test_proc_common.pingq[0] = NULL;
+	test_proc_common.pingq[1] = NULL;
+	test_proc_common.turn = 0;
+	test_proc_common.done = 0;
+	hal_spinlockCreate(&test_proc_common.spinlock, "test_proc_common.spinlock");
+
+	proc_threadCreate(NULL, test_proc_pingthr, NULL, 1, 1024, NULL, 0, (void *)0);
+	proc_threadCreate(NULL, test_proc_pingthr, NULL, 1, 1024, NULL, 0, (void *)1);
+}
+
+
+/*
+ * Mutex benchmark - compares uncontended lock/unlock cost of resource based mutex and futex fast path
+ */
+
+
+static void test_proc_futexLock(volatile u32 *f)
+{
+	u32 v;
+
+	/* 0 - unlocked, 1 - locked, 2 - locked with waiters */
+	if ((v = __sync_val_compare_and_swap(f, 0, 1)) == 0)
+		return;
+
+	if (v != 2)
+		v = __sync_lock_test_and_set(f, 2);
+
+	while (v != 0) {
+		proc_futexWait(f, 2, 0);
+		v = __sync_lock_test_and_set(f, 2);
+	}
+}
+
+
+static void test_proc_futexUnlock(volatile u32 *f)
+{
+	if (__sync_fetch_and_sub(f, 1) != 1) {
+		*f = 0;
+		proc_futexWake(f, 1);
+	}
+}
+
+
+static void test_proc_futexthr(void *arg)
+{
+	unsigned int i;
+	cycles_t b, e;
+
+	test_proc_common.futex = 0;
+
+	if (proc_futexWait(&test_proc_common.futex, 1, 0) != -EAGAIN)
+		lib_printf("test: [proc.futex] wait on changed value didn't fail\n");
+
+	hal_cpuGetCycles(&b);
+	for (i = 0; i < TEST_PROC_LOCKS; i++) {
+		test_proc_futexLock(&test_proc_common.futex);
+		test_proc_futexUnlock(&test_proc_common.futex);
+	}
+	hal_cpuGetCycles(&e);
+
+	lib_printf("test: [proc.futex] futex fast path: %u cycles per lock/unlock\n", (u32)((e - b) / TEST_PROC_LOCKS));
+
+	proc_threadDestroy();
+}
+
+
+static void test_proc_mutexthr(void *arg)
+{
+	unsigned int i, h;
+	cycles_t b, e;
+
+	_hal_start();
+
+	if (proc_mutexCreate(&h) < 0) {
+		lib_printf("test: [proc.futex] can't create mutex\n");
+		proc_threadDestroy();
+	}
+
+	hal_cpuGetCycles(&b);
+	for (i = 0; i < TEST_PROC_LOCKS; i++) {
+		proc_mutexLock(h);
+		proc_mutexUnlock(h);
+	}
+	hal_cpuGetCycles(&e);
+
+	lib_printf("test: [proc.futex] resource mutex (without syscall entry): %u cycles per lock/unlock\n", (u32)((e - b) / TEST_PROC_LOCKS));
+
+	proc_resourceFree(h);
+
+	/* Futex keys of kernel addresses are available to kernel threads only */
+	proc_threadCreate(NULL, test_proc_futexthr, NULL, 4, 1024, NULL, 0, NULL);
+	proc_threadDestroy();
+}
+
+
+void test_proc_futex(void)
+{
+	proc_start(test_proc_mutexthr, NULL, (const char *)"futex");
+
+	hal_cpuEnableInterrupts();
+	hal_cpuReschedule(NULL);
+}
+
+
+/*
+ * Message passing benchmark - measures send/recv/respond round trip latency
+ */
+
+
+static void test_proc_msgsrv(void *arg)
+{
+	msg_t msg;
+	unsigned int rid;
+
+	for (;;) {
+		if (proc_recv(test_proc_common.port, &msg, &rid) < 0)
+			break;
+
+		msg.o.io.err = msg.i.io.len;
+		proc_respond(test_proc_common.port, &msg, rid);
+	}
+
+	proc_threadDestroy();
+}
+
+
+static void test_proc_msgcli(void *arg)
+{
+	unsigned int i;
+	msg_t msg;
+	cycles_t b, e;
+
+	hal_memset(&msg, 0, sizeof(msg));
+	msg.type = mtDevCtl;
+
+	hal_cpuGetCycles(&b);
+	for (i = 0; i < TEST_PROC_MSGS; i++) {
+		msg.i.io.len = i;
+
+		if (proc_send(test_proc_common.port, &msg) < 0 || msg.o.io.err != (int)i) {
+			lib_printf("test: [proc.msg] message %u failed\n", i);
+			break;
+		}
+	}
+	hal_cpuGetCycles(&e);
+
+	if (i > 0)
+		lib_printf("test: [proc.msg] %u round trips, %u cycles per round trip\n", i, (u32)((e - b) / i));
+
+	proc_portDestroy(test_proc_common.port);
+	proc_threadDestroy();
+}
+
+
+void test_proc_msg(void)
+{
+	proc_portCreate(&test_proc_common.port);
+
+	proc_threadCreate(NULL, test_proc_msgsrv, NULL, 1, 1024, NULL, 0, NULL);
+	proc_threadCreate(NULL, test_proc_msgcli, NULL, 1, 1024, NULL, 0, NULL);
+}
+
+
+/*
+ * Message transfer benchmark - measures throughput of unaligned payloads from 4 KB to 4 MB with
+ * bounce copies of partially used pages and with MSG_ZEROCOPY
+ */
+
+
+static void test_proc_xfercli(void *arg)
+{
+	unsigned int i, zc;
+	size_t size;
+	msg_t msg;
+	cycles_t b, e;
+	void *buff;
+
+	_hal_start();
+
+	if ((buff = vm_mmap(proc_current()->process->mapp, NULL, NULL, TEST_PROC_XFERMAX + SIZE_PAGE, PROT_READ | PROT_WRITE | PROT_USER, NULL, -1, MAP_NONE)) == NULL) {
+		lib_printf("test: [proc.xfer] can't allocate buffer\n");
+		proc_threadDestroy();
+	}
+
+	/* Fault pages in */
+	hal_memset(buff, 0, TEST_PROC_XFERMAX + SIZE_PAGE);
+
+	for (zc = 0; zc < 2; zc++) {
+		for (size = SIZE_PAGE; size <= TEST_PROC_XFERMAX; size <<= 1) {
+			hal_memset(&msg, 0, sizeof(msg));
+			msg.type = mtWrite;
+			msg.flags = zc ? MSG_ZEROCOPY : 0;
+			msg.i.data = buff + 1;
+			msg.i.size = size;
+
+			hal_cpuGetCycles(&b);
+			for (i = 0; i < TEST_PROC_XFERS; i++)
+				proc_send(test_proc_common.port, &msg);
+			hal_cpuGetCycles(&e);
+
+			lib_printf("test: [proc.xfer] %s %7u B: %u cycles per message, %u B per kcycle\n", zc ? "zero copy" : "bounce   ",
+				size, (u32)((e - b) / TEST_PROC_XFERS), (u32)((u64)size * TEST_PROC_XFERS * 1000 / (e - b)));
+		}
+	}
+
+	proc_portDestroy(test_proc_common.port);
+	proc_threadDestroy();
+}
+
+
+void test_proc_xfer(void)
+{
+	proc_portCreate(&test_proc_common.port);
+
+	proc_threadCreate(NULL, test_proc_msgsrv, NULL, 1, 1024, NULL, 0, NULL);
+	proc_start(test_proc_xfercli, NULL, (const char *)"xfer");
+
+	hal_cpuEnableInterrupts();
+	hal_cpuReschedule(NULL);
+}
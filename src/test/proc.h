@@ -29,4 +29,16 @@ extern void test_proc_conditional(void);
 extern void test_proc_exit(void);
 
 
+extern void test_proc_schedule(void);
+
+
+extern void test_proc_futex(void);
+
+
+extern void test_proc_msg(void);
+
+
+extern void test_proc_xfer(void);
+
+
 #endif
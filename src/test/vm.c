@@ -14,6 +14,7 @@
  */
 
 #include HAL
+#include "../../include/errno.h"
 #include "../lib/lib.h"
 #include "../vm/vm.h"
 #include "../proc/proc.h"
@@ -154,6 +155,213 @@ void test_vm_kmalloc(void)
 }
 
 
+void test_vm_zerofault(vm_map_t *kmap)
+{
+	void *vaddr;
+	cycles_t b = 0, e = 0;
+	unsigned int k, n = 32;
+
+	lib_printf("test: Anonymous fault latency\n");
+
+	/* Give idle time to fill the zeroed page pool, the second pass finds it empty */
+	proc_threadSleep(100000);
+
+	for (k = 0; k < 2; k++) {
+		hal_cpuGetCycles(&b);
+		vaddr = vm_mmap(kmap, NULL, NULL, n * SIZE_PAGE, PROT_READ | PROT_WRITE, NULL, -1, MAP_NONE);
+		hal_cpuGetCycles(&e);
+
+		if (vaddr == NULL) {
+			lib_printf("test: Can't map anonymous memory!\n");
+			return;
+		}
+
+		lib_printf("test: %s pool %u cycles/page\n", k ? "without" : "with", (u32)((e - b) / n));
+		vm_munmap(kmap, vaddr, n * SIZE_PAGE);
+	}
+}
+
+
+void test_vm_copy(vm_map_t *kmap)
+{
+	static const unsigned int sizes[] = { 16, 64, 256, 1024, 4096 };
+	static const unsigned int aligns[] = { 0, 1, 4 };
+	void *buf, *dst, *src;
+	cycles_t b = 0, e = 0;
+	unsigned int i, k, n, rep = 256;
+
+	lib_printf("test: Memory copy routines\n");
+
+	if ((buf = vm_mmap(kmap, NULL, NULL, 4 * SIZE_PAGE, PROT_READ | PROT_WRITE, NULL, -1, MAP_NONE)) == NULL) {
+		lib_printf("test: Can't map buffers!\n");
+		return;
+	}
+
+	dst = buf;
+	src = buf + 2 * SIZE_PAGE;
+	hal_memset(src, 0x5a, 2 * SIZE_PAGE);
+
+	/* Source is misaligned against destination as well, that takes the byte path */
+	for (k = 0; k < sizeof(aligns) / sizeof(aligns[0]); k++) {
+		for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+			hal_cpuGetCycles(&b);
+			for (n = 0; n < rep; n++)
+				hal_memcpy(dst + aligns[k], src + 2 * aligns[k], sizes[i]);
+			hal_cpuGetCycles(&e);
+
+			lib_printf("test: memcpy %4u bytes, offset %u: %u cycles", sizes[i], aligns[k], (u32)((e - b) / rep));
+
+			hal_cpuGetCycles(&b);
+			for (n = 0; n < rep; n++)
+				hal_memset(dst + aligns[k], n, sizes[i]);
+			hal_cpuGetCycles(&e);
+
+			lib_printf(", memset %u cycles\n", (u32)((e - b) / rep));
+		}
+	}
+
+	hal_cpuGetCycles(&b);
+	for (n = 0; n < rep; n++)
+		hal_pagecpy(dst, src, SIZE_PAGE);
+	hal_cpuGetCycles(&e);
+
+	lib_printf("test: page copy %u cycles", (u32)((e - b) / rep));
+
+	hal_cpuGetCycles(&b);
+	for (n = 0; n < rep; n++)
+		hal_memclr(dst, SIZE_PAGE);
+	hal_cpuGetCycles(&e);
+
+	lib_printf(", page clear %u cycles\n", (u32)((e - b) / rep));
+
+	hal_pagecpy(dst, src, SIZE_PAGE);
+	for (n = 0; (n < SIZE_PAGE) && (((u8 *)dst)[n] == 0x5a); n++);
+	if (n != SIZE_PAGE)
+		lib_printf("test: Page copy differs at %u!\n", n);
+
+	vm_munmap(kmap, buf, 4 * SIZE_PAGE);
+}
+
+
+void test_vm_shm(vm_map_t *kmap)
+{
+	vm_object_t *o, *f;
+	oid_t oid;
+	u32 *v, *w, *p;
+	unsigned int n;
+
+	lib_printf("test: Shared memory objects\n");
+
+	if (vm_objectCreate(&o, 2 * SIZE_PAGE) != EOK) {
+		lib_printf("test: Can't create object!\n");
+		return;
+	}
+
+	v = vm_mmap(kmap, NULL, NULL, 2 * SIZE_PAGE, PROT_READ | PROT_WRITE, o, 0, MAP_SHARED);
+	w = vm_mmap(kmap, NULL, NULL, 2 * SIZE_PAGE, PROT_READ | PROT_WRITE, o, 0, MAP_SHARED);
+	p = vm_mmap(kmap, NULL, NULL, 2 * SIZE_PAGE, PROT_READ | PROT_WRITE, o, 0, MAP_PRIVATE);
+	hal_memcpy(&oid, &o->oid, sizeof(oid));
+	vm_objectPut(o);
+
+	if ((v == NULL) || (w == NULL) || (p == NULL)) {
+		lib_printf("test: Can't map object!\n");
+		if (v != NULL)
+			vm_munmap(kmap, v, 2 * SIZE_PAGE);
+		if (w != NULL)
+			vm_munmap(kmap, w, 2 * SIZE_PAGE);
+		if (p != NULL)
+			vm_munmap(kmap, p, 2 * SIZE_PAGE);
+		return;
+	}
+
+	for (n = 0; (n < 2 * SIZE_PAGE / sizeof(u32)) && (w[n] == 0); n++);
+	if (n != 2 * SIZE_PAGE / sizeof(u32))
+		lib_printf("test: Fresh object isn't zeroed at word %u!\n", n);
+
+	for (n = 0; n < 2 * SIZE_PAGE / sizeof(u32); n++)
+		v[n] = n;
+
+	for (n = 0; (n < 2 * SIZE_PAGE / sizeof(u32)) && (w[n] == n); n++);
+	if (n != 2 * SIZE_PAGE / sizeof(u32))
+		lib_printf("test: Mappings differ at word %u!\n", n);
+
+	/* Private mapping gets its own copy on write */
+	for (n = 0; n < 2 * SIZE_PAGE / sizeof(u32); n++)
+		p[n] = ~n;
+
+	for (n = 0; (n < 2 * SIZE_PAGE / sizeof(u32)) && (v[n] == n); n++);
+	if (n != 2 * SIZE_PAGE / sizeof(u32))
+		lib_printf("test: Private mapping wrote to object at word %u!\n", n);
+
+	vm_munmap(kmap, p, 2 * SIZE_PAGE);
+
+	if ((vm_objectGet(&f, oid) != EOK) || (f != o))
+		lib_printf("test: Object not found by oid!\n");
+	else
+		vm_objectPut(f);
+
+	vm_munmap(kmap, v, 2 * SIZE_PAGE);
+	vm_munmap(kmap, w, 2 * SIZE_PAGE);
+
+	/* Last mapping is gone and the object with it */
+	if (vm_objectGet(&f, oid) != -ENOENT)
+		lib_printf("test: Object outlived its mappings!\n");
+}
+
+
+static unsigned int test_vm_ctors;
+
+
+static void test_vm_slabctor(void *obj)
+{
+	*(u32 *)obj = 0xdeadbeef;
+	test_vm_ctors++;
+}
+
+
+void test_vm_slab(void)
+{
+	vm_cache_t *cache;
+	void *objs[256];
+	unsigned int i, k, bad = 0;
+	cycles_t b = 0, e = 0;
+
+	lib_printf("test: Slab cache test\n");
+
+	if ((cache = vm_cacheCreate("test", 100, test_vm_slabctor)) == NULL) {
+		lib_printf("test: Can't create cache!\n");
+		return;
+	}
+
+	/* Objects must come back constructed and are never reconstructed when reused */
+	for (k = 0; k < 4; k++) {
+		for (i = 0; i < sizeof(objs) / sizeof(objs[0]); i++) {
+			if ((objs[i] = vm_cacheAlloc(cache)) == NULL)
+				break;
+			if (*(u32 *)objs[i] != 0xdeadbeef)
+				bad++;
+			if (vm_slabOf(objs[i])->cache != cache)
+				bad++;
+		}
+
+		while (i-- > 0)
+			vm_cacheFree(cache, objs[i]);
+	}
+
+	lib_printf("test: slabs=%d, perslab=%d, ctors=%d, bad=%d\n", cache->slabs, cache->perslab, test_vm_ctors, bad);
+
+	hal_cpuGetCycles(&b);
+	for (i = 0; i < 100000; i++)
+		vm_cacheFree(cache, vm_cacheAlloc(cache));
+	hal_cpuGetCycles(&e);
+
+	lib_printf("test: alloc/free pair %u cycles\n", (u32)((e - b) / 100000));
+
+	if (vm_cacheDestroy(cache) < 0)
+		lib_printf("test: Cache busy after test!\n");
+}
+
+
 static void _test_vm_msgsimthr(void *arg)
 {
 	char *buff;
@@ -38,6 +38,18 @@ extern void test_vm_zalloc(void);
 extern void test_vm_kmalloc(void);
 
 
+extern void test_vm_slab(void);
+
+
+extern void test_vm_zerofault(struct _vm_map_t *kmap);
+
+
+extern void test_vm_copy(struct _vm_map_t *kmap);
+
+
+extern void test_vm_shm(struct _vm_map_t *kmap);
+
+
 extern void test_vm_kmallocsim(void);
 
 
@@ -0,0 +1,125 @@
+/*
+ * Phoenix-RTOS
+ *
+ * Operating system kernel
+ *
+ * Tests for timing wheel
+ *
+ * Copyright 2018 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#include HAL
+#include "../lib/lib.h"
+#include "../proc/proc.h"
+
+
+#define WHEEL_TEST_SIZE  256
+#define WHEEL_TEST_STEPS 100000
+
+
+struct {
+	wheel_t wheel;
+	wheelnode_t nodes[WHEEL_TEST_SIZE];
+	time_t expires[WHEEL_TEST_SIZE];
+	char active[WHEEL_TEST_SIZE];
+} test_wheel_common;
+
+
+/* Compares wheel against brute force search */
+static int test_wheelCheck(time_t now)
+{
+	time_t min = 0, next;
+	wheelnode_t *node;
+	int i;
+
+	for (i = 0; i < WHEEL_TEST_SIZE; i++) {
+		if (test_wheel_common.active[i] && (!min || test_wheel_common.expires[i] < min))
+			min = test_wheel_common.expires[i];
+	}
+
+	next = lib_wheelNext(&test_wheel_common.wheel);
+
+	/* Wheel may report earlier deadline but never later one */
+	if (!min != !next || next > min)
+		return -1;
+
+	while ((node = lib_wheelExpire(&test_wheel_common.wheel, now)) != NULL) {
+		i = node - test_wheel_common.nodes;
+
+		if (!test_wheel_common.active[i] || test_wheel_common.expires[i] > now)
+			return -1;
+
+		test_wheel_common.active[i] = 0;
+	}
+
+	for (i = 0; i < WHEEL_TEST_SIZE; i++) {
+		if (test_wheel_common.active[i] && test_wheel_common.expires[i] <= now)
+			return -1;
+	}
+
+	return 0;
+}
+
+
+static void test_wheel_autothr(void *arg)
+{
+	unsigned int seed = 1234, n, i;
+	time_t now = 0, delta;
+
+	lib_printf("test: Start automatic timing wheel test\n");
+
+	for (;;) {
+		hal_memset(&test_wheel_common, 0, sizeof(test_wheel_common));
+		lib_wheelInit(&test_wheel_common.wheel, 7, now);
+
+		for (n = 0; n < WHEEL_TEST_STEPS; n++) {
+			i = lib_rand(&seed) % WHEEL_TEST_SIZE;
+
+			switch (lib_rand(&seed) % 3) {
+			case 0:
+				if (test_wheel_common.active[i])
+					break;
+
+				/* Mix short timeouts with ones beyond wheel range */
+				if (lib_rand(&seed) % 4)
+					delta = lib_rand(&seed) % 20000;
+				else
+					delta = ((time_t)lib_rand(&seed) * lib_rand(&seed)) % (1ULL << 36);
+
+				test_wheel_common.expires[i] = now + delta;
+				test_wheel_common.active[i] = 1;
+				lib_wheelInsert(&test_wheel_common.wheel, &test_wheel_common.nodes[i], now + delta);
+				break;
+
+			case 1:
+				if (!test_wheel_common.active[i])
+					break;
+
+				test_wheel_common.active[i] = 0;
+				lib_wheelRemove(&test_wheel_common.wheel, &test_wheel_common.nodes[i]);
+				break;
+
+			default:
+				now += lib_rand(&seed) % 3000;
+
+				if (test_wheelCheck(now) < 0) {
+					lib_printf("error: timing wheel mismatch at step %d\n", n);
+					hal_cpuHalt();
+				}
+				break;
+			}
+		}
+
+		lib_printf("success: timing wheel test steps: %d\n", WHEEL_TEST_STEPS);
+	}
+}
+
+
+void test_wheel(void)
+{
+	proc_threadCreate(NULL, test_wheel_autothr, NULL, 1, 1024, NULL, 0, NULL);
+}
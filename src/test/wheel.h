@@ -0,0 +1,22 @@
+/*
+ * Phoenix-RTOS
+ *
+ * Operating system kernel
+ *
+ * Tests for timing wheel
+ *
+ * Copyright 2018 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _TEST_WHEEL_H_
+#define _TEST_WHEEL_H_
+
+
+extern void test_wheel(void);
+
+
+#endif
@@ -25,6 +25,7 @@
 struct {
 	vm_object_t *kernel;
 	vm_map_t *kmap;
+	vm_cache_t *anons;
 } amap_common;
 
 
@@ -42,7 +43,7 @@ static anon_t *amap_putanon(anon_t *a)
 	vm_pageFree(a->page);
 	proc_lockClear(&a->lock);
 	proc_lockDone(&a->lock);
-	vm_kfree(a);
+	vm_cacheFree(amap_common.anons, a);
 	return NULL;
 }
 
@@ -164,12 +165,12 @@ static anon_t *anon_new(page_t *p)
 {
 	anon_t *a;
 
-	if ((a = vm_kmalloc(sizeof(anon_t))) == NULL)
+	if ((a = vm_cacheAlloc(amap_common.anons)) == NULL)
 		return NULL;
 
+	proc_lockInit(&a->lock);
 	a->page = p;
 	a->refs = 1;
-	proc_lockInit(&a->lock);
 
 	return a;
 }
@@ -211,6 +212,15 @@ page_t *amap_page(vm_map_t *map, amap_t *amap, vm_object_t *o, void *vaddr, int
 		}
 		a->refs--;
 	}
+	else if ((o == NULL) && ((p = vm_pageAllocZeroed(PAGE_OWNER_APP)) != NULL)) {
+		/* Zero-fill fault served from the pool refilled in idle time */
+		if ((amap->anons[aoffs / SIZE_PAGE] = anon_new(p)) == NULL) {
+			vm_pageFree(p);
+			p = NULL;
+		}
+		proc_lockClear(&amap->lock);
+		return p;
+	}
 	else if ((p = vm_objectPage(map, &amap, o, vaddr, offs)) == NULL) {
 		/* amap could be invalidated while fetching from the object's store */
 		if (amap != NULL)
@@ -241,11 +251,11 @@ page_t *amap_page(vm_map_t *map, amap_t *amap, vm_object_t *o, void *vaddr, int
 			proc_lockClear(&amap->lock);
 			return NULL;
 		}
-		hal_memcpy(w, v, SIZE_PAGE);
+		hal_pagecpy(w, v, SIZE_PAGE);
 		amap_unmap(map, w);
 	}
 	else {
-		hal_memset(v, 0, SIZE_PAGE);
+		hal_memclr(v, SIZE_PAGE);
 	}
 
 	amap_unmap(map, v);
@@ -263,8 +273,62 @@ page_t *amap_page(vm_map_t *map, amap_t *amap, vm_object_t *o, void *vaddr, int
 }
 
 
+page_t *amap_super(vm_map_t *map, amap_t *amap, int aoffs)
+{
+	unsigned int i, n = SIZE_SUPERPAGE / SIZE_PAGE;
+	page_t *p;
+	void *v;
+
+	/* Whole blocks are taken only while reclaim has nothing to do */
+	if (vm_pageReclaimTarget() != 0)
+		return NULL;
+
+	proc_lockSet(&amap->lock);
+
+	for (i = 0; i < n; ++i) {
+		if (amap->anons[aoffs / SIZE_PAGE + i] != NULL) {
+			proc_lockClear(&amap->lock);
+			return NULL;
+		}
+	}
+
+	if ((p = vm_pageAlloc(SIZE_SUPERPAGE, PAGE_OWNER_APP)) == NULL) {
+		proc_lockClear(&amap->lock);
+		return NULL;
+	}
+
+	/* Pages of the block are anons of their own, copy-on-write and unmap free them one by one */
+	vm_pageSplit(p);
+
+	for (i = 0; i < n; ++i) {
+		if ((v = amap_map(map, p + i)) == NULL)
+			break;
+
+		hal_memclr(v, SIZE_PAGE);
+		amap_unmap(map, v);
+
+		if ((amap->anons[aoffs / SIZE_PAGE + i] = anon_new(p + i)) == NULL)
+			break;
+	}
+
+	if (i < n) {
+		amap_putanons(amap, aoffs, i * SIZE_PAGE);
+
+		while (i < n)
+			vm_pageFree(p + i++);
+
+		p = NULL;
+	}
+
+	proc_lockClear(&amap->lock);
+
+	return p;
+}
+
+
 void _amap_init(vm_map_t *kmap, vm_object_t *kernel)
 {
 	amap_common.kmap = kmap;
 	amap_common.kernel = kernel;
+	amap_common.anons = vm_cacheCreate("anon", sizeof(anon_t), NULL);
 }
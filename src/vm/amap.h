@@ -40,6 +40,10 @@ typedef struct _amap_t {
 extern page_t *amap_page(struct _vm_map_t *map, amap_t *amap, struct _vm_object_t *o, void *vaddr, int aoffs, int offs, int prot);
 
 
+/* Function fills empty superpage of amap with zeroed pages of one aligned block */
+extern page_t *amap_super(struct _vm_map_t *map, amap_t *amap, int aoffs);
+
+
 extern void amap_putanons(amap_t *amap, int offs, int size);
 
 
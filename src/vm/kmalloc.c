@@ -17,263 +17,191 @@
 #include HAL
 #include "../lib/lib.h"
 #include "map.h"
-#include "zone.h"
+#include "slab.h"
+#include "kmalloc.h"
 #include "../../include/errno.h"
 #include "proc/proc.h"
 
 
-struct {
-	vm_zone_t *sizes[17];
-	vm_zone_t *used;
-	vm_zone_t firstzone;
-	
-	rbtree_t tree;
+#define KMALLOC_MINIDX   4
+#define KMALLOC_SIZES    8
+#define KMALLOC_HASHSZ   64
 
-	unsigned int hdrblocks;
-	size_t allocsz;
+#define KMALLOC_HASH(vaddr) (((unsigned long)(vaddr) / SIZE_PAGE) % KMALLOC_HASHSZ)
 
-	unsigned int zonehdrs;
-	lock_t lock;
-} kmalloc_common;
 
+/* Allocations too large for a slab get their own pages */
+typedef struct _kmalloc_large_t {
+	struct _kmalloc_large_t *next;
+	void *vaddr;
+	page_t *page;
+} kmalloc_large_t;
 
-static int kmalloc_zone_cmp(rbnode_t *n1, rbnode_t *n2)
-{
-	vm_zone_t *z1 = lib_treeof(vm_zone_t, linkage, n1);
-	vm_zone_t *z2 = lib_treeof(vm_zone_t, linkage, n2);
-
-	if (z1->vaddr > z2->vaddr)
-		return 1;
 
-	if (((z2->vaddr >= z1->vaddr) && (z2->vaddr < z1->vaddr + z1->blocks * z1->blocksz)) ||
-	    ((z1->vaddr >= z2->vaddr) && (z1->vaddr < z2->vaddr + z2->blocks * z2->blocksz)))
-		return 0;
+static const char *kmalloc_names[KMALLOC_SIZES] = {
+	"kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128",
+	"kmalloc-256", "kmalloc-512", "kmalloc-1024", "kmalloc-2048"
+};
 
-	return -1;
-}
-
-
-void *_kmalloc_alloc(u8 hdridx, u8 idx)
-{
-	void *b;
-	vm_zone_t *z = kmalloc_common.sizes[idx];
 
-	b = _vm_zalloc(z, NULL);
-	kmalloc_common.allocsz += (1 << idx);
+struct {
+	vm_map_t *kmap;
+	vm_object_t *kernel;
 
-	if (idx == hdridx)
-		kmalloc_common.hdrblocks--;
+	vm_cache_t sizes[KMALLOC_SIZES];
+	unsigned int nsizes;
 
-	if (z->used == z->blocks) {
-		LIST_REMOVE(&kmalloc_common.sizes[idx], z);
-		LIST_ADD(&kmalloc_common.used, z);
-	}
+	vm_cache_t large;
+	kmalloc_large_t *hash[KMALLOC_HASHSZ];
+	size_t largesz;
 
-	return b;
-}
+	lock_t lock;
+} kmalloc_common;
 
 
-vm_zone_t *_kmalloc_free(u8 hdridx, void *p)
+static void *kmalloc_allocLarge(size_t size)
 {
-	vm_zone_t t;
-	vm_zone_t *z;
-	u8 idx;
+	kmalloc_large_t *l;
+	unsigned int h;
 
-	/* Free block */
-	t.vaddr = p;
-	t.blocks = 1;
-	t.blocksz = 16;
+	if ((l = vm_cacheAlloc(&kmalloc_common.large)) == NULL)
+		return NULL;
 
-	if ((z = lib_treeof(vm_zone_t, linkage, lib_rbFind(&kmalloc_common.tree, &t.linkage))) == NULL) {
+	if ((l->page = vm_pageAlloc(size, PAGE_OWNER_KERNEL | PAGE_KERNEL_HEAP)) == NULL) {
+		vm_cacheFree(&kmalloc_common.large, l);
 		return NULL;
 	}
 
-	_vm_zfree(z, p);
-	kmalloc_common.allocsz -= z->blocksz;
+	if ((l->vaddr = vm_mmap(kmalloc_common.kmap, kmalloc_common.kmap->start, l->page, 1 << l->page->idx, PROT_READ | PROT_WRITE, kmalloc_common.kernel, -1, MAP_NONE)) == NULL) {
+		vm_pageFree(l->page);
+		vm_cacheFree(&kmalloc_common.large, l);
+		return NULL;
+	}
 
-	if ((idx = hal_cpuGetLastBit(z->blocksz)) == hdridx)
-		kmalloc_common.hdrblocks++;
+	h = KMALLOC_HASH(l->vaddr);
 
-	/* Remove zone from used list */
-	if (z->used == z->blocks - 1) {
-		LIST_REMOVE(&kmalloc_common.used, z);
-		LIST_ADD(&kmalloc_common.sizes[idx], z);
-	}
+	proc_lockSet(&kmalloc_common.lock);
+	l->next = kmalloc_common.hash[h];
+	kmalloc_common.hash[h] = l;
+	kmalloc_common.largesz += 1 << l->page->idx;
+	proc_lockClear(&kmalloc_common.lock);
 
-	return z;
+	return l->vaddr;
 }
 
 
-int _kmalloc_addZone(u8 hdridx, u8 idx)
+static void kmalloc_freeLarge(void *p)
 {
-	vm_zone_t *nz;
+	kmalloc_large_t *l, **prev;
 
-	nz = _kmalloc_alloc(hdridx, hdridx);
+	proc_lockSet(&kmalloc_common.lock);
 
-	/* Add new zone */
-	if (_vm_zoneCreate(nz, 1 << idx, max(((idx == hdridx) ? kmalloc_common.zonehdrs : 1), SIZE_PAGE / (1 << idx))) < 0) {
-		_kmalloc_free(hdridx, nz);
-		return -ENOMEM;
+	for (prev = &kmalloc_common.hash[KMALLOC_HASH(p)]; (l = *prev) != NULL; prev = &l->next) {
+		if (l->vaddr == p)
+			break;
 	}
 
-	LIST_ADD(&kmalloc_common.sizes[idx], nz);
-	lib_rbInsert(&kmalloc_common.tree, &nz->linkage);
+	if (l == NULL) {
+		proc_lockClear(&kmalloc_common.lock);
+		return;
+	}
 
-	if (idx == hdridx)
-		kmalloc_common.hdrblocks += nz->blocks;		
+	*prev = l->next;
+	kmalloc_common.largesz -= 1 << l->page->idx;
+	proc_lockClear(&kmalloc_common.lock);
 
-	return EOK;
+	vm_munmap(kmalloc_common.kmap, l->vaddr, 1 << l->page->idx);
+	vm_pageFree(l->page);
+	vm_cacheFree(&kmalloc_common.large, l);
 }
 
 
 void *vm_kmalloc(size_t size)
 {
-	unsigned int idx, hdridx;
-	void *b = NULL;
-	vm_zone_t *z;
-	int err = EOK;
+	unsigned int idx;
 
 	/* Establish minimal size */
-	size = size < 16 ? 16 : size;
+	size = size < (1 << KMALLOC_MINIDX) ? (1 << KMALLOC_MINIDX) : size;
+
+	if (size > VM_SLAB_MAX)
+		return kmalloc_allocLarge(size);
 
 	idx = hal_cpuGetLastBit(size);
 	if (hal_cpuGetFirstBit(size) < idx)
 		idx++;
-	if (idx >= sizeof(kmalloc_common.sizes) / sizeof(vm_zone_t *))
-		return NULL;
-
-	hdridx = hal_cpuGetLastBit(sizeof(vm_zone_t));
-	if (hal_cpuGetFirstBit(sizeof(vm_zone_t)) < hdridx)
-		hdridx++;
-	if (hdridx >= sizeof(kmalloc_common.sizes) / sizeof(vm_zone_t *))
-		return NULL;
-
-	proc_lockSet(&kmalloc_common.lock);
-
-	if (kmalloc_common.hdrblocks == 1)
-		err = _kmalloc_addZone(hdridx, hdridx);
-
-	if (!err && (z = kmalloc_common.sizes[idx]) == NULL)
-		err = _kmalloc_addZone(hdridx, idx);
-
-	/* Alloc new fragment */
-	if (!err)
-		b = _kmalloc_alloc(hdridx, idx);
 
-	proc_lockClear(&kmalloc_common.lock);
-
-	return b;
-}
-
-
-static void *_kmalloc_freeAtom(u8 hdridx, void *p)
-{
-	vm_zone_t *z;
-	u8 idx;
-
-	z = _kmalloc_free(hdridx, p);
-	idx = hal_cpuGetLastBit(z->blocksz);
-
-	/* Remove zone if free */
-	if ((z->used == 0) && (z != &kmalloc_common.firstzone)) {
-		LIST_REMOVE(&kmalloc_common.sizes[idx], z);
-		_vm_zoneDestroy(z);
-		lib_rbRemove(&kmalloc_common.tree, &z->linkage);
-
-		if (idx == hdridx)
-			kmalloc_common.hdrblocks -= z->blocks;
-		return z;
-	}
-
-	return NULL;
+	return vm_cacheAlloc(&kmalloc_common.sizes[idx - KMALLOC_MINIDX]);
 }
 
 
 void vm_kfree(void *p)
 {
-	unsigned int hdridx;
-
-	hdridx = hal_cpuGetLastBit(sizeof(vm_zone_t));
-	if (hal_cpuGetFirstBit(sizeof(vm_zone_t)) < hdridx)
-		hdridx++;
-	if (hdridx >= sizeof(kmalloc_common.sizes) / sizeof(vm_zone_t *))
+	/* Slab objects never start a page, the slab header does */
+	if ((unsigned long)p & (SIZE_PAGE - 1)) {
+		vm_cacheFree(vm_slabOf(p)->cache, p);
 		return;
-
-	proc_lockSet(&kmalloc_common.lock);
-
-	for (;;) {
-		p = _kmalloc_freeAtom(hdridx, p);
-
-		if (p == NULL)
-			break;
 	}
 
-	proc_lockClear(&kmalloc_common.lock);
+	kmalloc_freeLarge(p);
 }
 
 
 void vm_kmallocGetStats(size_t *allocsz)
 {
-	*allocsz = kmalloc_common.allocsz;
+	unsigned int i;
+
+	*allocsz = kmalloc_common.largesz;
+
+	for (i = 0; i < kmalloc_common.nsizes; i++)
+		*allocsz += vm_cacheUsed(&kmalloc_common.sizes[i]) * kmalloc_common.sizes[i].objsz;
 }
 
 
 void vm_kmallocDump(void)
 {
 	unsigned int i;
-	vm_zone_t *z;
-
-	for (i = 0; i < sizeof(kmalloc_common.sizes) / sizeof(vm_zone_t *); i++) {
-		lib_printf("sizes[%d]=", i);
-		z = kmalloc_common.sizes[i];
+	vm_cache_t *c;
 
-		if (z != NULL) {
-			do {
-				lib_printf("%p(%d/%d) ", z, z->used, z->blocks);
-				z = z->next;
-			} while (z != kmalloc_common.sizes[i]);
-		}
-
-		lib_printf("\n");
+	for (i = 0; i < kmalloc_common.nsizes; i++) {
+		c = &kmalloc_common.sizes[i];
+		lib_printf("%s: slabs=%d, used=%d/%d\n", c->name, c->slabs, vm_cacheUsed(c), c->slabs * c->perslab);
 	}
+
+	lib_printf("kmalloc-large: %d\n", kmalloc_common.largesz);
 }
 
 
-int _kmalloc_init(void)
+int _kmalloc_init(vm_map_t *kmap, vm_object_t *kernel)
 {
-	unsigned int hdridx, i;
+	unsigned int i;
 
 	lib_printf("vm: Initializing kernel memory allocator: ");
 
-	proc_lockInit(&kmalloc_common.lock);
-
-	hdridx = hal_cpuGetLastBit(sizeof(vm_zone_t));
-	if (hal_cpuGetFirstBit(sizeof(vm_zone_t)) < hdridx)
-		hdridx++;
-	if (hdridx >= sizeof(kmalloc_common.sizes) / sizeof(vm_zone_t *)) {
-		lib_printf("BAD HDRIDX!\n");
-		return NULL;
-	}
+	kmalloc_common.kmap = kmap;
+	kmalloc_common.kernel = kernel;
+	kmalloc_common.largesz = 0;
 
-	/* Initialize sizes */
-	for (i = 0; i < sizeof(kmalloc_common.sizes) / sizeof(vm_zone_t *); i++)
-		kmalloc_common.sizes[i] = NULL;
-	kmalloc_common.used = NULL;
+	proc_lockInit(&kmalloc_common.lock);
 
-	/* Initialize allocated zone tree */
-	lib_rbInit(&kmalloc_common.tree, kmalloc_zone_cmp, NULL);
+	for (i = 0; i < KMALLOC_HASHSZ; i++)
+		kmalloc_common.hash[i] = NULL;
 
-	kmalloc_common.zonehdrs = 16;
+	/* Size classes cover everything a single page slab can hold, the last one is cut to fit two objects */
+	for (i = 0; (i < KMALLOC_SIZES) && ((1 << (i + KMALLOC_MINIDX - 1)) < VM_SLAB_MAX); i++)
+		_vm_cacheInit(&kmalloc_common.sizes[i], kmalloc_names[i], min(1 << (i + KMALLOC_MINIDX), VM_SLAB_MAX), NULL);
+	kmalloc_common.nsizes = i;
 
-	/* Add first zone_t zone */
-	_vm_zoneCreate(&kmalloc_common.firstzone, 1 << hdridx, max(kmalloc_common.zonehdrs, SIZE_PAGE / (1 << hdridx)));
-	LIST_ADD(&kmalloc_common.sizes[hdridx], &kmalloc_common.firstzone);
-	lib_rbInsert(&kmalloc_common.tree, &kmalloc_common.firstzone.linkage);
+	_vm_cacheInit(&kmalloc_common.large, "kmalloc-large", sizeof(kmalloc_large_t), NULL);
 
-	kmalloc_common.allocsz = 0;
-	kmalloc_common.hdrblocks = kmalloc_common.firstzone.blocks;
+	/* Magazines are kmalloc'ed themselves, enable them once all caches exist */
+	for (i = 0; i < kmalloc_common.nsizes; i++) {
+		if (_vm_cacheMagazines(&kmalloc_common.sizes[i]) < 0) {
+			lib_printf("no memory!\n");
+			return -ENOMEM;
+		}
+	}
 
-	lib_printf("(%d*%d) %d\n", kmalloc_common.hdrblocks, sizeof(vm_zone_t), kmalloc_common.hdrblocks * sizeof(vm_zone_t));
+	lib_printf("(%d caches, %d..%d) slab=%d\n", kmalloc_common.nsizes, 1 << KMALLOC_MINIDX, kmalloc_common.sizes[kmalloc_common.nsizes - 1].objsz, SIZE_PAGE);
 
-	return 0;
+	return EOK;
 }
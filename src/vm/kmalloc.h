@@ -19,6 +19,12 @@
 #include HAL
 
 
+struct _vm_map_t;
+
+
+struct _vm_object_t;
+
+
 extern void *vm_kmalloc(size_t size);
 
 
@@ -31,7 +37,7 @@ extern void vm_kmallocGetStats(size_t *allocsz);
 extern void vm_kmallocDump(void);
 
 
-extern int _kmalloc_init(void);
+extern int _kmalloc_init(struct _vm_map_t *kmap, struct _vm_object_t *kernel);
 
 
 #endif
@@ -20,6 +20,11 @@
 #include "map.h"
 #include "../proc/proc.h"
 #include "amap.h"
+#include "slab.h"
+
+
+/* Window for entry slabs takes this share of kernel address space above the heap */
+#define MAP_WINDOWSHARE  8
 
 
 extern void _etext(void);
@@ -29,11 +34,20 @@ struct {
 	vm_map_t *kmap;
 	vm_object_t *kernel;
 
+#ifndef NOMMU
+	vm_cache_t entries;
+
+	/* Entry slabs are mapped in a window inside the kernel heap segment */
+	void *window;
+	u32 *slots;
+	unsigned int nslots;
+#else
 	lock_t lock;
 
 	unsigned int ntotal, nfree;
 	map_entry_t *free;
 	map_entry_t *entries;
+#endif
 } map_common;
 
 
@@ -114,6 +128,20 @@ void map_dump(rbnode_t *node)
 }
 
 
+/* Objects backed by files or shared memory, not anonymous, physical nor kernel memory */
+static int map_object(vm_object_t *o)
+{
+	return (o != NULL) && (o != (void *)-1) && (o != map_common.kernel);
+}
+
+
+/* Objects track their entries, see vm_objectAttach() */
+static int map_tracked(map_entry_t *e)
+{
+	return map_object(e->object);
+}
+
+
 static int _map_add(process_t *p, vm_map_t *map, map_entry_t *entry)
 {
 #ifdef NOMMU
@@ -126,6 +154,10 @@ static int _map_add(process_t *p, vm_map_t *map, map_entry_t *entry)
 #endif
 
 	entry->map = map;
+
+	if (map_tracked(entry))
+		vm_objectAttach(entry->object, entry);
+
 	return lib_rbInsert(&map->tree, &entry->linkage);
 }
 
@@ -142,6 +174,9 @@ static void _map_remove(vm_map_t *map, map_entry_t *entry)
 	entry->process = NULL;
 #endif
 
+	if (map_tracked(entry))
+		vm_objectDetach(entry->object, entry);
+
 	lib_rbRemove(&map->tree, &entry->linkage);
 	entry->map = NULL;
 }
@@ -150,8 +185,8 @@ static void _map_remove(vm_map_t *map, map_entry_t *entry)
 static void _entry_put(vm_map_t *map, map_entry_t *e)
 {
 	amap_put(e->amap);
-	vm_objectPut(e->object);
 	_map_remove(map, e);
+	vm_objectPut(e->object);
 	map_free(e);
 }
 
@@ -224,6 +259,12 @@ static void *_map_map(vm_map_t *map, void *vaddr, process_t *proc, size_t size,
 	unsigned int lmerge, rmerge;
 	amap_t *amap;
 
+	/* Place user physical memory at its superpage alignment and user anonymous memory aligned,
+	 * so _map_force() can map them in superpages. Kernel map never uses superpages */
+	if ((SIZE_SUPERPAGE > SIZE_PAGE) && (map != map_common.kmap) && ((o == (void *)-1) || (o == NULL)) &&
+	    (vaddr == NULL) && (size >= SIZE_SUPERPAGE) && ((v = _map_find(map, vaddr, size + SIZE_SUPERPAGE, &prev, &next)) != NULL))
+		vaddr = v + ((((o == NULL) ? 0 : offs) - (unsigned long)v) & (SIZE_SUPERPAGE - 1));
+
 	if ((v = _map_find(map, vaddr, size, &prev, &next)) == NULL)
 		return NULL;
 
@@ -356,7 +397,6 @@ void *vm_mapFind(vm_map_t *map, void *vaddr, size_t size, u8 flags, u8 prot)
 
 int _vm_munmap(vm_map_t *map, void *vaddr, size_t size)
 {
-	int offs;
 	map_entry_t *e, *s;
 	map_entry_t t;
 	process_t *proc = proc_current()->process;
@@ -371,8 +411,7 @@ int _vm_munmap(vm_map_t *map, void *vaddr, size_t size)
 
 	amap_putanons(e->amap, e->aoffs + vaddr - e->vaddr, size);
 
-	for (offs = vaddr - e->vaddr; offs < vaddr + size - e->vaddr; offs += SIZE_PAGE)
-		pmap_remove(&map->pmap, e->vaddr + offs);
+	pmap_removeRange(&map->pmap, vaddr, size);
 
 	if (e->vaddr == vaddr) {
 		if (e->size == size) {
@@ -431,6 +470,7 @@ int _vm_munmap(vm_map_t *map, void *vaddr, size_t size)
 void *_vm_mmap(vm_map_t *map, void *vaddr, page_t *p, size_t size, u8 prot, vm_object_t *o, offs_t offs, u8 flags)
 {
 	int attr = PROT_NONE;
+	unsigned int n;
 	void *w;
 	process_t *process = NULL;
 	thread_t *current;
@@ -439,6 +479,18 @@ void *_vm_mmap(vm_map_t *map, void *vaddr, page_t *p, size_t size, u8 prot, vm_o
 	if (!size || (size & (SIZE_PAGE - 1)))
 		return NULL;
 
+	/* Shared anonymous memory needs an object to share, see vm_objectCreate() */
+	if ((flags & MAP_SHARED) && (o == NULL))
+		return NULL;
+
+	/* Objects never write pages back, stores to a shared file mapping would be lost */
+	if ((flags & MAP_SHARED) && (prot & PROT_WRITE) && (o != (void *)-1) && !o->anonymous)
+		return NULL;
+
+	/* Private object mappings copy on write, file pages stay clean and shared memory unchanged */
+	if ((prot & PROT_WRITE) && !(flags & MAP_SHARED) && map_object(o))
+		flags |= MAP_NEEDSCOPY;
+
 	/* NULL page indicates that proc sybsystem is ready */
 	if (p == NULL && (current = proc_current()) != NULL)
 		process = current->process;
@@ -467,8 +519,11 @@ void *_vm_mmap(vm_map_t *map, void *vaddr, page_t *p, size_t size, u8 prot, vm_o
 		if (flags & MAP_DEVICE)
 			attr |= PGHD_DEV;
 
-		for (w = vaddr; w < vaddr + size; w += SIZE_PAGE)
-			page_map(&map->pmap, w, (p++)->addr, attr);
+		/* Physically contiguous runs are entered at once */
+		for (w = vaddr; w < vaddr + size; w += n * SIZE_PAGE, p += n) {
+			for (n = 1; (w + n * SIZE_PAGE < vaddr + size) && (p[n].addr == p->addr + n * SIZE_PAGE); n++);
+			page_mapRange(&map->pmap, w, p->addr, n * SIZE_PAGE, attr);
+		}
 
 		return vaddr;
 	}
@@ -477,12 +532,14 @@ void *_vm_mmap(vm_map_t *map, void *vaddr, page_t *p, size_t size, u8 prot, vm_o
 		return vaddr;
 
 	for (w = vaddr; w < vaddr + size; w += SIZE_PAGE) {
+		/* Skip pages already mapped in anonymous superpage, mapping them again would split it */
+		if ((SIZE_SUPERPAGE > SIZE_PAGE) && (o == NULL) && (pmap_resolve(&map->pmap, w) != 0))
+			continue;
+
 		if (_map_force(map, e, w, prot)) {
 			amap_putanons(e->amap, e->aoffs, w - vaddr);
 
-			do
-				pmap_remove(&map->pmap, w);
-			while (w > vaddr && (w -= SIZE_PAGE));
+			pmap_removeRange(&map->pmap, vaddr, w + SIZE_PAGE - vaddr);
 
 			_entry_put(map, e);
 			return NULL;
@@ -558,6 +615,101 @@ int vm_mapFlags(vm_map_t *map, void *vaddr)
 }
 
 
+int vm_mapKey(vm_map_t *map, void *vaddr, vm_object_t **o, offs_t *offs)
+{
+	map_entry_t t, *e;
+
+	proc_lockSet(&map->lock);
+
+	t.vaddr = vaddr;
+	t.size = SIZE_PAGE;
+
+	e = lib_treeof(map_entry_t, linkage, lib_rbFind(&map->tree, &t.linkage));
+
+	if (e == NULL) {
+		proc_lockClear(&map->lock);
+		return -EFAULT;
+	}
+
+	/* Shared memory is identified by object and offset. Private memory is keyed by map even
+	 * before its first write, copy on write must not change the key */
+	if ((e->flags & MAP_SHARED) && (e->object != NULL)) {
+		*o = e->object;
+		*offs = e->offs + ((ptr_t)vaddr - (ptr_t)e->vaddr);
+	}
+	else {
+		*o = NULL;
+		*offs = (ptr_t)vaddr;
+	}
+
+	proc_lockClear(&map->lock);
+
+	return EOK;
+}
+
+
+int vm_mapOid(vm_map_t *map, void *vaddr, oid_t *oid)
+{
+	map_entry_t t, *e;
+	int err = EOK;
+
+	proc_lockSet(&map->lock);
+
+	t.vaddr = vaddr;
+	t.size = SIZE_PAGE;
+
+	e = lib_treeof(map_entry_t, linkage, lib_rbFind(&map->tree, &t.linkage));
+
+	/* Only shared memory is handed out by oid, files are opened by name */
+	if (e == NULL)
+		err = -EFAULT;
+	else if (!map_tracked(e) || !e->object->anonymous)
+		err = -EINVAL;
+	else
+		hal_memcpy(oid, &e->object->oid, sizeof(*oid));
+
+	proc_lockClear(&map->lock);
+
+	return err;
+}
+
+
+/* Pins objects mapped in range, their pages are about to be mapped where reclaim can't find them */
+int vm_mapPin(vm_map_t *map, void *vaddr, size_t size, vm_pin_t **pins)
+{
+	map_entry_t t, *e;
+	int err = EOK;
+
+	proc_lockSet(&map->lock);
+
+	t.size = SIZE_PAGE;
+
+	for (t.vaddr = vaddr; (err == EOK) && (t.vaddr < vaddr + size); t.vaddr = e->vaddr + e->size) {
+		if ((e = lib_treeof(map_entry_t, linkage, lib_rbFind(&map->tree, &t.linkage))) == NULL)
+			break;
+
+		if (map_tracked(e) && !e->object->anonymous)
+			err = vm_objectPin(e->object, pins);
+	}
+
+	proc_lockClear(&map->lock);
+
+	return err;
+}
+
+
+void vm_mapFaultAround(vm_map_t *map, unsigned int npages)
+{
+	/* Window has to be a power of two to be aligned */
+	if (npages > 1)
+		npages = 1 << hal_cpuGetLastBit(min(npages, VM_FAULTAROUNDMAX));
+
+	proc_lockSet(&map->lock);
+	map->faultaround = npages;
+	proc_lockClear(&map->lock);
+}
+
+
 int vm_mapForce(vm_map_t *map, void *paddr, int prot)
 {
 	map_entry_t t, *e;
@@ -581,9 +733,115 @@ int vm_mapForce(vm_map_t *map, void *paddr, int prot)
 }
 
 
+static int map_attr(map_entry_t *e, int prot)
+{
+	int attr = 0;
+
+	if (prot & PROT_WRITE)
+		attr |= PGHD_WRITE | PGHD_PRESENT;
+
+	if (prot & PROT_READ)
+		attr |= PGHD_PRESENT;
+
+	if (prot & PROT_USER)
+		attr |= PGHD_USER;
+
+	if (prot & PROT_EXEC)
+		attr |= PGHD_EXEC;
+
+	if (e->flags & MAP_UNCACHED)
+		attr |= PGHD_NOT_CACHED;
+
+	if (e->flags & MAP_DEVICE)
+		attr |= PGHD_DEV;
+
+	return attr;
+}
+
+
+/*
+ * Maps pages around a read fault which are already in memory, so sequential
+ * access to a fresh mapping doesn't trap on every page. Neighbours are mapped
+ * read-only, a write still faults and goes through copy-on-write.
+ */
+static void _map_faultAround(vm_map_t *map, map_entry_t *e, void *paddr)
+{
+	size_t window = (size_t)map->faultaround * SIZE_PAGE;
+	void *vaddr, *start, *end;
+	anon_t *a;
+	page_t *p;
+	int attr, offs;
+
+	if (window <= SIZE_PAGE)
+		return;
+
+	start = (void *)((unsigned long)paddr & ~(window - 1));
+	end = min(start + window, e->vaddr + e->size);
+	start = max(start, e->vaddr);
+
+	attr = map_attr(e, e->prot & ~PROT_WRITE);
+
+	if (e->amap != NULL)
+		proc_lockSet(&e->amap->lock);
+
+	for (vaddr = start; vaddr < end; vaddr += SIZE_PAGE) {
+		if ((vaddr == paddr) || (pmap_resolve(&map->pmap, vaddr) != 0))
+			continue;
+
+		offs = vaddr - e->vaddr;
+
+		if ((e->amap != NULL) && ((a = e->amap->anons[(e->aoffs + offs) / SIZE_PAGE]) != NULL))
+			p = a->page;
+		else
+			p = vm_objectResident(e->object, e->offs + offs);
+
+		if ((p != NULL) && (page_map(&map->pmap, vaddr, p->addr, attr) < 0))
+			break;
+	}
+
+	if (e->amap != NULL)
+		proc_lockClear(&e->amap->lock);
+}
+
+
+/*
+ * Maps superpage around paddr when physical memory or private anonymous entry
+ * covers it whole. Anonymous superpage is one aligned block whose pages are
+ * tracked in amap one by one, so copy-on-write and partial unmap split it
+ * and fault the rest in as pages. Kernel map is never mapped in superpages,
+ * its page tables are preallocated and shared by all page directories.
+ */
+static int _map_super(vm_map_t *map, map_entry_t *e, void *paddr, int attr)
+{
+	void *vaddr = (void *)((unsigned long)paddr & ~(SIZE_SUPERPAGE - 1));
+	offs_t offs = vaddr - e->vaddr;
+	page_t *p;
+
+	if ((SIZE_SUPERPAGE == SIZE_PAGE) || (map == map_common.kmap) || (vaddr < e->vaddr) || (vaddr + SIZE_SUPERPAGE > e->vaddr + e->size))
+		return -EINVAL;
+
+	if (e->object == (void *)-1) {
+		if ((e->amap != NULL) || ((e->offs + offs) & (SIZE_SUPERPAGE - 1)))
+			return -EINVAL;
+
+		return pmap_enterSuper(&map->pmap, e->offs + offs, vaddr, attr);
+	}
+
+	/* Amap is shared until the first write after fork */
+	if ((e->object != NULL) || (e->amap == NULL) || (e->flags & MAP_NEEDSCOPY))
+		return -EINVAL;
+
+	if ((p = amap_super(map, e->amap, e->aoffs + offs)) == NULL)
+		return -ENOMEM;
+
+	/* Fresh anons aren't shared, whole superpage gets entry rights */
+	return pmap_enterSuper(&map->pmap, p->addr, vaddr, map_attr(e, e->prot));
+}
+
+
 static int _map_force(vm_map_t *map, map_entry_t *e, void *paddr, int prot)
 {
-	int attr = 0, offs;
+	int attr, offs;
 	page_t *p;
 
 	if (prot & PROT_WRITE && !(e->prot & PROT_WRITE))
@@ -607,31 +865,20 @@ static int _map_force(vm_map_t *map, map_entry_t *e, void *paddr, int prot)
 
 	offs = paddr - e->vaddr;
 
+	/* Kernel faults on user pages map them for the user too */
+	attr = map_attr(e, prot | (e->prot & PROT_USER));
+
+	/* Superpage falls back to pages, amap_page() finds anons it left behind */
+	if ((e->object == NULL) && (_map_super(map, e, paddr, attr) == EOK))
+		return EOK;
+
 	if (e->amap == NULL)
 		p = vm_objectPage(map, NULL, e->object, paddr, (e->offs < 0) ? e->offs : e->offs + offs);
 	else
 		p = amap_page(map, e->amap, e->object, paddr, e->aoffs + offs, (e->offs < 0) ? e->offs : e->offs + offs, prot);
 
-	if (prot & PROT_WRITE)
-		attr |= PGHD_WRITE | PGHD_PRESENT;
-
-	if (prot & PROT_READ)
-		attr |= PGHD_PRESENT;
-
-	if (prot & PROT_USER)
-		attr |= PGHD_USER;
-
-	if (prot & PROT_EXEC)
-		attr |= PGHD_EXEC;
-
-	if (e->flags & MAP_UNCACHED)
-		attr |= PGHD_NOT_CACHED;
-
-	if (e->flags & MAP_DEVICE)
-		attr |= PGHD_DEV;
-
 	if (p == NULL && e->object == (void *)-1) {
-		if (page_map(&map->pmap, paddr, e->offs + offs, attr) < 0)
+		if ((_map_super(map, e, paddr, attr) < 0) && (page_map(&map->pmap, paddr, e->offs + offs, attr) < 0))
 			return -ENOMEM;
 	}
 	else if (p == NULL) {
@@ -641,6 +888,9 @@ static int _map_force(vm_map_t *map, map_entry_t *e, void *paddr, int prot)
 		amap_putanons(e->amap, e->aoffs + offs, SIZE_PAGE);
 		return -ENOMEM;
 	}
+	else if (!(prot & PROT_WRITE)) {
+		_map_faultAround(map, e, paddr);
+	}
 
 	return EOK;
 }
@@ -710,6 +960,8 @@ int vm_mapCreate(vm_map_t *map, void *start, void *stop)
 	map->pmap.start = start;
 	map->pmap.end = stop;
 
+	map->faultaround = VM_FAULTAROUND;
+
 	proc_lockInit(&map->lock);
 	lib_rbInit(&map->tree, map_cmp, map_augment);
 	return EOK;
@@ -742,19 +994,6 @@ void vm_mapDestroy(process_t *p, vm_map_t *map)
 }
 
 
-static void remap_readonly(vm_map_t *map, map_entry_t *e, int offs)
-{
-	addr_t a;
-	int attr = PGHD_PRESENT;
-
-	if (e->prot & PROT_USER)
-		attr |= PGHD_USER;
-
-	if ((a = pmap_resolve(&map->pmap, e->vaddr + offs)))
-		page_map(&map->pmap, e->vaddr + offs, a, attr);
-}
-
-
 int vm_mapCopy(process_t *proc, vm_map_t *dst, vm_map_t *src)
 {
 	rbnode_t *n;
@@ -763,6 +1002,8 @@ int vm_mapCopy(process_t *proc, vm_map_t *dst, vm_map_t *src)
 
 	proc_lockSet2(&src->lock, &dst->lock);
 
+	dst->faultaround = src->faultaround;
+
 	for (n = lib_rbMinimum(src->tree.root); n != NULL; n = lib_rbNext(n)) {
 		e = lib_treeof(map_entry_t, linkage, n);
 
@@ -782,14 +1023,12 @@ int vm_mapCopy(process_t *proc, vm_map_t *dst, vm_map_t *src)
 		f->object = vm_objectRef(e->object);
 		_map_add(proc, dst, f);
 
-		if ((e->prot & PROT_WRITE) && !(e->flags & MAP_DEVICE)) {
+		/* Child starts with no pages mapped, parent loses write access to the whole entry at once */
+		if ((e->prot & PROT_WRITE) && !(e->flags & (MAP_DEVICE | MAP_SHARED))) {
 			e->flags |= MAP_NEEDSCOPY;
 			f->flags |= MAP_NEEDSCOPY;
 
-			for (offs = 0; offs < f->size; offs += SIZE_PAGE) {
-				remap_readonly(src, e, offs);
-				remap_readonly(dst, f, offs);
-			}
+			pmap_protect(&src->pmap, e->vaddr, e->size, map_attr(e, e->prot & ~PROT_WRITE));
 		}
 
 		if (proc == NULL || !proc->lazy) {
@@ -842,18 +1081,22 @@ void vm_mapinfo(meminfo_t *info)
 	int i;
 
 
+#ifndef NOMMU
+	info->entry.total = map_common.entries.slabs * map_common.entries.perslab;
+	info->entry.free = info->entry.total - vm_cacheUsed(&map_common.entries);
+#else
 	proc_lockSet(&map_common.lock);
 	info->entry.total = map_common.ntotal;
 	info->entry.free = map_common.nfree;
-	info->entry.sz = sizeof(map_entry_t);
 	proc_lockClear(&map_common.lock);
+#endif
+	info->entry.sz = sizeof(map_entry_t);
 
 	if (info->entry.mapsz != -1) {
 		process = proc_find(info->entry.pid);
 
 		if (process == NULL) {
 			info->entry.mapsz = -1;
-			proc_lockClear(&map_common.lock);
 			return;
 		}
 
@@ -983,6 +1226,109 @@ void vm_mapinfo(meminfo_t *info)
  * Entry pool management
  */
 
+#ifndef NOMMU
+
+/* Slabs can't be mapped with vm_mmap() which needs entries itself, called with cache lock held */
+static void *map_slabMap(page_t *p)
+{
+	unsigned int i, n = (map_common.nslots + 31) / 32;
+	void *vaddr;
+
+	for (i = 0; (i < n) && (map_common.slots[i] == 0xffffffff); i++)
+		;
+
+	if ((i == n) || ((i = i * 32 + hal_cpuGetFirstBit(~map_common.slots[i])) >= map_common.nslots))
+		return NULL;
+
+	vaddr = map_common.window + i * SIZE_PAGE;
+
+	if (page_map(&map_common.kmap->pmap, vaddr, p->addr, PGHD_WRITE | PGHD_PRESENT) < 0)
+		return NULL;
+
+	map_common.slots[i / 32] |= 1 << (i % 32);
+
+	return vaddr;
+}
+
+
+static void map_slabUnmap(void *vaddr)
+{
+	unsigned int i = (vaddr - map_common.window) / SIZE_PAGE;
+
+	pmap_remove(&map_common.kmap->pmap, vaddr);
+	map_common.slots[i / 32] &= ~(1 << (i % 32));
+}
+
+
+map_entry_t *map_alloc(void)
+{
+	map_entry_t *e;
+
+	if ((e = vm_cacheAlloc(&map_common.entries)) == NULL) {
+#ifndef NDEBUG
+		lib_printf("vm: Entry pool exhausted!\n");
+#endif
+	}
+
+	return e;
+}
+
+
+void map_free(map_entry_t *entry)
+{
+	vm_cacheFree(&map_common.entries, entry);
+}
+
+
+void vm_mapGetStats(size_t *allocsz)
+{
+	*allocsz = vm_cacheUsed(&map_common.entries) * sizeof(map_entry_t);
+}
+
+
+/*
+ * Entry slabs can't grow the window later, reserving address space needs
+ * an entry and the kmap lock, which entry allocation may already hold.
+ * The window is therefore the cap on map entries. It is sized from kernel
+ * address space left above the heap, not from memory, and never has more
+ * slots than there are pages to back them. Only address space is reserved,
+ * slabs get pages on demand and give them back.
+ */
+static int _map_initEntries(void **bss, void **top)
+{
+	size_t freesz, slotsz;
+
+	_vm_cacheInit(&map_common.entries, "map_entry", sizeof(map_entry_t), NULL);
+	_vm_cacheBackend(&map_common.entries, map_slabMap, map_slabUnmap);
+
+	vm_pageGetStats(&freesz);
+	map_common.nslots = min(((void *)map_common.kmap->pmap.end - (*top)) / SIZE_PAGE / MAP_WINDOWSHARE, freesz / SIZE_PAGE);
+	slotsz = (map_common.nslots + 31) / 32 * sizeof(u32);
+
+	while ((*top) - (*bss) < slotsz) {
+		if (_page_sbrk(&map_common.kmap->pmap, bss, top) < 0)
+			return -ENOMEM;
+	}
+
+	map_common.slots = (*bss);
+	hal_memset(map_common.slots, 0, slotsz);
+
+	map_common.window = (*top);
+	(*bss) = (*top) = map_common.window + map_common.nslots * SIZE_PAGE;
+
+	lib_printf("vm: Initializing memory mapper: (%d*%d) %d\n", map_common.nslots * map_common.entries.perslab, sizeof(map_entry_t), map_common.nslots * SIZE_PAGE);
+
+	return EOK;
+}
+
+
+void _map_initMagazines(void)
+{
+	_vm_cacheMagazines(&map_common.entries);
+}
+
+#else
+
 map_entry_t *map_alloc(void)
 {
 	map_entry_t *e;
@@ -1025,19 +1371,13 @@ void vm_mapGetStats(size_t *allocsz)
 }
 
 
-int _map_init(vm_map_t *kmap, vm_object_t *kernel, void **bss, void **top)
+static int _map_initEntries(void **bss, void **top)
 {
-	int i, prot;
-	size_t poolsz, freesz, size;
-	map_entry_t *e;
-	void *vaddr;
+	int i;
+	size_t poolsz, freesz;
 
 	proc_lockInit(&map_common.lock);
 
-	vm_mapCreate(kmap, (void *)VADDR_KERNEL, kmap->pmap.end);
-	map_common.kmap = kmap;
-	map_common.kernel = kernel;
-
 	vm_pageGetStats(&freesz);
 
 	/* Init map entry pool */
@@ -1060,6 +1400,32 @@ int _map_init(vm_map_t *kmap, vm_object_t *kernel, void **bss, void **top)
 
 	lib_printf("vm: Initializing memory mapper: (%d*%d) %d\n", map_common.nfree, sizeof(map_entry_t), poolsz);
 
+	return EOK;
+}
+
+
+void _map_initMagazines(void)
+{
+}
+
+#endif
+
+
+int _map_init(vm_map_t *kmap, vm_object_t *kernel, void **bss, void **top)
+{
+	int i, prot;
+	size_t size;
+	map_entry_t *e;
+	void *vaddr;
+
+	vm_mapCreate(kmap, (void *)VADDR_KERNEL, kmap->pmap.end);
+	kmap->faultaround = 0;
+	map_common.kmap = kmap;
+	map_common.kernel = kernel;
+
+	if (_map_initEntries(bss, top) < 0)
+		return -ENOMEM;
+
 	/* Map kernel segments */
 	for (i = 0;; i++) {
 		prot = PROT_READ | PROT_EXEC;
@@ -25,8 +25,14 @@
 #include "vm/amap.h"
 
 
+/* Default and largest fault-around window in pages */
+#define VM_FAULTAROUND    16
+#define VM_FAULTAROUNDMAX 256
+
+
 struct _amap_t;
 struct _vm_object_t;
+struct _vm_pin_t;
 
 
 typedef struct _vm_map_t {
@@ -35,6 +41,9 @@ typedef struct _vm_map_t {
 	void *stop;
 	rbtree_t tree;
 	lock_t lock;
+
+	/* Read faults map resident pages of this aligned window, in pages */
+	unsigned int faultaround;
 } vm_map_t;
 
 
@@ -68,6 +77,10 @@ typedef struct _map_entry_t {
 	unsigned short prot;
 	struct _vm_object_t *object;
 	offs_t offs;
+
+	/* Linkage on the object's list of entries */
+	struct _map_entry_t *onext;
+	struct _map_entry_t *oprev;
 } map_entry_t;
 
 
@@ -83,9 +96,21 @@ extern void *_vm_mmap(vm_map_t *map, void *vaddr, page_t *p, size_t size, u8 pro
 extern int vm_mapForce(vm_map_t *map, void *vaddr, int prot);
 
 
+extern void vm_mapFaultAround(vm_map_t *map, unsigned int npages);
+
+
 extern int vm_mapFlags(vm_map_t *map, void *vaddr);
 
 
+extern int vm_mapKey(vm_map_t *map, void *vaddr, struct _vm_object_t **o, offs_t *offs);
+
+
+extern int vm_mapOid(vm_map_t *map, void *vaddr, oid_t *oid);
+
+
+extern int vm_mapPin(vm_map_t *map, void *vaddr, size_t size, struct _vm_pin_t **pins);
+
+
 extern int vm_lockVerify(vm_map_t *map, struct _amap_t **amap, struct _vm_object_t *o, void *vaddr, offs_t offs);
 
 
@@ -119,4 +144,8 @@ extern void vm_mapinfo(meminfo_t *info);
 extern int _map_init(vm_map_t *kmap, struct _vm_object_t *kernel, void **start, void **end);
 
 
+/* Function enables per-CPU magazines of the entry pool once kmalloc works */
+extern void _map_initMagazines(void);
+
+
 #endif
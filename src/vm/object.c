@@ -18,20 +18,75 @@
 #include "../lib/lib.h"
 #include "page.h"
 #include "kmalloc.h"
+#include "slab.h"
 #include "object.h"
 #include "map.h"
 #include "../proc/name.h"
 #include "../proc/threads.h"
 
 
+/* Readahead window limits in pages */
+#define OBJECT_RAMIN   4
+#define OBJECT_RAMAX   32
+
+#define OBJECT_RAPRIO  2
+
+/* Unreferenced objects kept with their pages for the next user */
+#define OBJECT_CACHED  16
+
+/* Pages freed per reclaim pass and back-off when nothing could be freed */
+#define OBJECT_RECLAIMBATCH  32
+#define OBJECT_RECLAIMDELAY  100000
+#define OBJECT_RECLAIMPRIO   2
+
+/* Maps locked at once to unmap a reclaimed page */
+#define OBJECT_UNMAPMAX  8
+
+
+typedef struct _object_ra_t {
+	struct _object_ra_t *next;
+	struct _object_ra_t *prev;
+
+	vm_object_t *o;
+	unsigned int idx;
+	unsigned int n;
+} object_ra_t;
+
+
 struct {
 	rbtree_t tree;
 	vm_object_t *kernel;
 	vm_map_t *kmap;
 	lock_t lock;
+
+	/* Unreferenced objects, least recently used first */
+	vm_object_t *cached;
+	unsigned int ncached;
+
+	/* Asynchronous readahead queue */
+	spinlock_t raspinlock;
+	object_ra_t *raq;
+	thread_t *rawq;
+	int raworker;
+
+	/* Resident pages of all objects, least recently used first */
+	spinlock_t lruspinlock;
+	vm_objpage_t *active;
+	vm_objpage_t *inactive;
+	unsigned int nactive;
+	unsigned int ninactive;
+
+	vm_cache_t *objpages;
+	int reclaimer;
+
+	/* Last id given to shared memory, port 0 belongs to the kernel */
+	id_t shmid;
 } object_common;
 
 
+static void object_reclaimthr(void *arg);
+
+
 static int object_cmp(rbnode_t *n1, rbnode_t *n2)
 {
 	vm_object_t *o1 = lib_treeof(vm_object_t, linkage, n1);
@@ -51,11 +106,278 @@ static int object_cmp(rbnode_t *n1, rbnode_t *n2)
 }
 
 
+/*
+ * LRU lists
+ */
+
+static void _object_lruAdd(vm_objpage_t *d, int active)
+{
+	d->active = active;
+
+	if (active) {
+		LIST_ADD(&object_common.active, d);
+		object_common.nactive++;
+	}
+	else {
+		LIST_ADD(&object_common.inactive, d);
+		object_common.ninactive++;
+	}
+}
+
+
+static void _object_lruRemove(vm_objpage_t *d)
+{
+	if (d->active) {
+		LIST_REMOVE(&object_common.active, d);
+		object_common.nactive--;
+	}
+	else {
+		LIST_REMOVE(&object_common.inactive, d);
+		object_common.ninactive--;
+	}
+}
+
+
+/* Deactivates pages not referenced since the last pass until inactive list catches up */
+static void _object_lruAge(void)
+{
+	vm_objpage_t *d;
+	unsigned int scan = object_common.nactive;
+
+	while (scan-- && (object_common.nactive > object_common.ninactive)) {
+		d = object_common.active;
+		_object_lruRemove(d);
+
+		_object_lruAdd(d, d->referenced);
+		d->referenced = 0;
+	}
+}
+
+
+/* Publishes fetched page on the inactive list, called with o->lock held */
+static void _object_install(vm_object_t *o, unsigned int idx, vm_objpage_t *d)
+{
+	if ((o->pages[idx] = d) == NULL)
+		return;
+
+	d->o = o;
+	d->idx = idx;
+	d->referenced = 0;
+	o->npages++;
+
+	/* Shared memory has no backing store to reread its pages from */
+	if (o->anonymous)
+		return;
+
+	hal_spinlockSet(&object_common.lruspinlock);
+	_object_lruAdd(d, 0);
+	hal_spinlockClear(&object_common.lruspinlock);
+}
+
+
+/*
+ * Page reclaim
+ */
+
+/* Removes page from all maps it's mapped in, called with o->lock held */
+static int _object_unmap(vm_object_t *o, vm_objpage_t *d)
+{
+	vm_map_t *maps[OBJECT_UNMAPMAX];
+	map_entry_t *e;
+	offs_t offs = (offs_t)d->idx * SIZE_PAGE;
+	addr_t pa;
+	void *vaddr;
+	int err = EOK;
+	unsigned int i, n = 0;
+
+	if ((e = o->entries) == NULL)
+		return EOK;
+
+	do {
+		if ((offs < e->offs) || (offs >= e->offs + e->size))
+			continue;
+
+		/* Map locks are taken out of order, back off instead of waiting */
+		for (i = 0; (i < n) && (maps[i] != e->map); i++);
+
+		if (i == n) {
+			if ((n == OBJECT_UNMAPMAX) || (proc_lockTry(&e->map->lock) < 0)) {
+				err = -EBUSY;
+				break;
+			}
+			maps[n++] = e->map;
+		}
+
+		vaddr = e->vaddr + (offs - e->offs);
+
+		/* Private mappings may hold a copy instead */
+		if (((pa = pmap_resolve(&e->map->pmap, vaddr)) != 0) && (_page_get(pa) == d->page))
+			pmap_remove(&e->map->pmap, vaddr);
+	} while ((e = e->onext) != o->entries);
+
+	while (n)
+		proc_lockClear(&maps[--n]->lock);
+
+	return err;
+}
+
+
+/* Frees up to n least recently used object pages, returns number of pages freed */
+static unsigned int object_reclaim(unsigned int n)
+{
+	vm_objpage_t *d;
+	vm_object_t *o;
+	unsigned int scan, freed = 0;
+
+	hal_spinlockSet(&object_common.lruspinlock);
+	_object_lruAge();
+
+	for (scan = object_common.ninactive; (freed < n) && scan-- && ((d = object_common.inactive) != NULL);) {
+		_object_lruRemove(d);
+
+		/* Referenced pages get another round on the active list */
+		if (d->referenced) {
+			d->referenced = 0;
+			_object_lruAdd(d, 1);
+			continue;
+		}
+
+		o = d->o;
+
+		if (proc_lockTry(&o->lock) < 0) {
+			_object_lruAdd(d, 0);
+			continue;
+		}
+
+		/* Mappings made by IPC can't be found and removed, wait until they're gone */
+		if (o->pins) {
+			_object_lruAdd(d, 1);
+			hal_spinlockClear(&object_common.lruspinlock);
+			proc_lockClear(&o->lock);
+			hal_spinlockSet(&object_common.lruspinlock);
+			continue;
+		}
+
+		hal_spinlockClear(&object_common.lruspinlock);
+
+		if (_object_unmap(o, d) < 0) {
+			/* Page goes back before the object is unlocked, object_destroy() looks for it there */
+			hal_spinlockSet(&object_common.lruspinlock);
+			_object_lruAdd(d, 0);
+			hal_spinlockClear(&object_common.lruspinlock);
+
+			proc_lockClear(&o->lock);
+
+			hal_spinlockSet(&object_common.lruspinlock);
+			continue;
+		}
+
+		o->pages[d->idx] = NULL;
+		o->npages--;
+		proc_lockClear(&o->lock);
+
+		vm_pageFree(d->page);
+		vm_cacheFree(object_common.objpages, d);
+		freed++;
+
+		hal_spinlockSet(&object_common.lruspinlock);
+	}
+
+	hal_spinlockClear(&object_common.lruspinlock);
+
+	return freed;
+}
+
+
+static void object_reclaimthr(void *arg)
+{
+	size_t target;
+
+	for (;;) {
+		vm_pageReclaimWait();
+
+		while ((target = vm_pageReclaimTarget()) != 0) {
+			if (object_reclaim(min(target / SIZE_PAGE + 1, OBJECT_RECLAIMBATCH)) == 0) {
+				/* Whatever is left is mapped by busy processes */
+				proc_threadSleep(OBJECT_RECLAIMDELAY);
+				break;
+			}
+		}
+	}
+}
+
+
+/*
+ * Objects
+ */
+
+/* Frees unreferenced object already removed from the tree */
+static void object_destroy(vm_object_t *o)
+{
+	vm_objpage_t *d;
+	unsigned int i;
+
+	/* Reclaim holds the lock while it works on object's pages */
+	proc_lockSet(&o->lock);
+	for (i = 0; !o->anonymous && (i < round_page(o->size) / SIZE_PAGE); ++i) {
+		if ((d = o->pages[i]) != NULL) {
+			hal_spinlockSet(&object_common.lruspinlock);
+			_object_lruRemove(d);
+			hal_spinlockClear(&object_common.lruspinlock);
+		}
+	}
+	proc_lockClear(&o->lock);
+
+	proc_lockDone(&o->lock);
+
+	if (o->open)
+		proc_close(o->oid, 0);
+
+	for (i = 0; i < round_page(o->size) / SIZE_PAGE; ++i) {
+		if ((d = o->pages[i]) != NULL) {
+			vm_pageFree(d->page);
+			vm_cacheFree(object_common.objpages, d);
+		}
+	}
+
+	vm_kfree(o);
+}
+
+
+static vm_object_t *object_alloc(oid_t *oid, size_t size)
+{
+	vm_object_t *o;
+	unsigned int i, n = round_page(size) / SIZE_PAGE;
+
+	if ((o = (vm_object_t *)vm_kmalloc(sizeof(vm_object_t) + n * sizeof(vm_objpage_t *))) == NULL)
+		return NULL;
+
+	hal_memcpy(&o->oid, oid, sizeof(*oid));
+	o->size = size;
+	o->mtime = 0;
+	o->refs = 0;
+	o->open = 0;
+	o->anonymous = 0;
+	o->pins = 0;
+	o->ralast = (unsigned int)-1;
+	o->raend = 0;
+	o->rawin = 0;
+	o->entries = NULL;
+	o->npages = 0;
+	o->waitq = NULL;
+	proc_lockInit(&o->lock);
+
+	for (i = 0; i < n; ++i)
+		o->pages[i] = NULL;
+
+	return o;
+}
+
+
 int vm_objectGet(vm_object_t **o, oid_t oid)
 {
-	vm_object_t t;
-	int i, n;
-	size_t sz;
+	vm_object_t t, *stale = NULL;
+	int reclaimer = 1;
 
 	t.oid.port = oid.port;
 	t.oid.id = oid.id;
@@ -63,25 +385,79 @@ int vm_objectGet(vm_object_t **o, oid_t oid)
 	proc_lockSet(&object_common.lock);
 	*o = lib_treeof(vm_object_t, linkage, lib_rbFind(&object_common.tree, &t.linkage));
 
-	if (*o == NULL) {
-		sz = proc_size(oid);
-		n = round_page(sz) / SIZE_PAGE;
+	/* Kernel port has no files, only shared memory can be looked up there */
+	if ((oid.port == 0) && ((*o == NULL) || !(*o)->anonymous)) {
+		proc_lockClear(&object_common.lock);
+		return -ENOENT;
+	}
 
-		if ((*o = (vm_object_t *)vm_kmalloc(sizeof(vm_object_t) + n * sizeof(page_t *))) == NULL)
-			return -ENOMEM;
+	/* Cached object is reused unless the file changed meanwhile */
+	if ((*o != NULL) && ((*o)->refs == 0)) {
+		LIST_REMOVE(&object_common.cached, *o);
+		object_common.ncached--;
 
-		hal_memcpy(&(*o)->oid, &oid, sizeof(oid));
-		(*o)->size = sz;
-		(*o)->refs = 0;
-		proc_lockInit(&(*o)->lock);
+		if ((proc_mtime(oid) != (*o)->mtime) || (proc_size(oid) != (*o)->size)) {
+			lib_rbRemove(&object_common.tree, &(*o)->linkage);
+			stale = *o;
+			*o = NULL;
+		}
+	}
 
-		for (i = 0; i < n; ++i)
-			(*o)->pages[i] = NULL;
+	if (*o == NULL) {
+		if ((*o = object_alloc(&oid, proc_size(oid))) == NULL) {
+			proc_lockClear(&object_common.lock);
+
+			if (stale != NULL)
+				object_destroy(stale);
+
+			return -ENOMEM;
+		}
 
+		(*o)->mtime = proc_mtime(oid);
 		lib_rbInsert(&object_common.tree, &(*o)->linkage);
+
+		reclaimer = object_common.reclaimer;
+		object_common.reclaimer = 1;
 	}
 
+	proc_lockSet(&(*o)->lock);
 	(*o)->refs++;
+	proc_lockClear(&(*o)->lock);
+
+	proc_lockClear(&object_common.lock);
+
+	if (stale != NULL)
+		object_destroy(stale);
+
+	if (!reclaimer)
+		proc_threadCreate(NULL, object_reclaimthr, NULL, OBJECT_RECLAIMPRIO, SIZE_KSTACK, NULL, 0, NULL);
+
+	return EOK;
+}
+
+
+/* Creates shared memory object, it can be found by its oid for as long as it's referenced */
+int vm_objectCreate(vm_object_t **o, size_t size)
+{
+	oid_t oid;
+
+	if (!size)
+		return -EINVAL;
+
+	proc_lockSet(&object_common.lock);
+
+	oid.port = 0;
+	oid.id = ++object_common.shmid;
+
+	if ((*o = object_alloc(&oid, size)) == NULL) {
+		proc_lockClear(&object_common.lock);
+		return -ENOMEM;
+	}
+
+	(*o)->anonymous = 1;
+	(*o)->refs = 1;
+	lib_rbInsert(&object_common.tree, &(*o)->linkage);
+
 	proc_lockClear(&object_common.lock);
 
 	return EOK;
@@ -102,63 +478,311 @@ vm_object_t *vm_objectRef(vm_object_t *o)
 
 int vm_objectPut(vm_object_t *o)
 {
-	int i;
+	vm_object_t *victim = NULL;
 
 	if (o == NULL || o == (void *)-1)
 		return EOK;
 
+	proc_lockSet(&object_common.lock);
 	proc_lockSet(&o->lock);
 
 	if (--o->refs) {
 		proc_lockClear(&o->lock);
+		proc_lockClear(&object_common.lock);
 		return EOK;
 	}
 
-	proc_lockSet(&object_common.lock);
-	lib_rbRemove(&object_common.tree, &o->linkage);
+	proc_lockClear(&o->lock);
+
+	/* Shared memory is gone with its last user, nobody could find it anymore.
+	 * File without modification time couldn't be checked for changes when found again */
+	if (o->anonymous || (o->mtime <= 0)) {
+		lib_rbRemove(&object_common.tree, &o->linkage);
+		proc_lockClear(&object_common.lock);
+		object_destroy(o);
+		return EOK;
+	}
+
+	/* Keep pages around, the same file is likely to be mapped again soon */
+	LIST_ADD(&object_common.cached, o);
+
+	if (++object_common.ncached > OBJECT_CACHED) {
+		victim = object_common.cached;
+		LIST_REMOVE(&object_common.cached, victim);
+		object_common.ncached--;
+		lib_rbRemove(&object_common.tree, &victim->linkage);
+	}
+
 	proc_lockClear(&object_common.lock);
 
-	proc_lockDone(&o->lock);
+	if (victim != NULL)
+		object_destroy(victim);
 
-	for (i = 0; i < round_page(o->size) / SIZE_PAGE; ++i) {
-		if (o->pages[i] != NULL)
-			vm_pageFree(o->pages[i]);
+	return EOK;
+}
+
+
+/* Keeps object and its resident pages until vm_objectUnpin(), pins are collected on the list */
+int vm_objectPin(vm_object_t *o, vm_pin_t **pins)
+{
+	vm_pin_t *pin;
+
+	for (pin = *pins; pin != NULL; pin = pin->next) {
+		if (pin->o == o)
+			return EOK;
 	}
 
-	vm_kfree(o);
+	if ((pin = vm_kmalloc(sizeof(vm_pin_t))) == NULL)
+		return -ENOMEM;
+
+	proc_lockSet(&o->lock);
+	o->refs++;
+	o->pins++;
+	proc_lockClear(&o->lock);
+
+	pin->o = o;
+	pin->next = *pins;
+	*pins = pin;
 
 	return EOK;
 }
 
 
-static page_t *object_fetch(oid_t oid, offs_t offs)
+void vm_objectUnpin(vm_pin_t **pins)
 {
-	page_t *p;
-	void *v;
+	vm_pin_t *pin;
 
-	if (proc_open(oid, 0) < 0)
-		return NULL;
+	while ((pin = *pins) != NULL) {
+		*pins = pin->next;
 
-	if ((p = vm_pageAlloc(SIZE_PAGE, PAGE_OWNER_APP)) == NULL) {
-		proc_close(oid, 0);
-		return NULL;
+		proc_lockSet(&pin->o->lock);
+		pin->o->pins--;
+		proc_lockClear(&pin->o->lock);
+
+		vm_objectPut(pin->o);
+		vm_kfree(pin);
 	}
+}
 
-	if ((v = vm_mmap(object_common.kmap, NULL, p, SIZE_PAGE, PROT_WRITE | PROT_USER, object_common.kernel, 0, MAP_NONE)) == NULL) {
-		vm_pageFree(p);
-		proc_close(oid, 0);
-		return NULL;
+
+void vm_objectAttach(vm_object_t *o, map_entry_t *e)
+{
+	proc_lockSet(&o->lock);
+	LIST_ADD_EX(&o->entries, e, onext, oprev);
+	proc_lockClear(&o->lock);
+}
+
+
+void vm_objectDetach(vm_object_t *o, map_entry_t *e)
+{
+	proc_lockSet(&o->lock);
+	LIST_REMOVE_EX(&o->entries, e, onext, oprev);
+	proc_lockClear(&o->lock);
+}
+
+
+/* Reads n consecutive pages starting at page idx with a single request */
+static void object_fetch(vm_object_t *o, unsigned int idx, unsigned int n, vm_objpage_t **d)
+{
+	unsigned int i;
+	void *w = NULL;
+	int len = -1, opened;
+
+	for (i = 0; i < n; i++)
+		d[i] = NULL;
+
+	for (i = 0; i < n; i++) {
+		if ((d[i] = vm_cacheAlloc(object_common.objpages)) == NULL)
+			break;
+
+		/* Make room at the expense of the coldest cached pages */
+		if (((d[i]->page = vm_pageAlloc(SIZE_PAGE, PAGE_OWNER_APP)) == NULL) && object_reclaim(n - i))
+			d[i]->page = vm_pageAlloc(SIZE_PAGE, PAGE_OWNER_APP);
+
+		if (d[i]->page == NULL)
+			break;
+	}
+
+	if ((i == n) && ((w = vm_mapFind(object_common.kmap, NULL, n * SIZE_PAGE, MAP_NOINHERIT, PROT_READ | PROT_WRITE)) != NULL)) {
+		for (i = 0; i < n; i++) {
+			if (page_map(&object_common.kmap->pmap, w + i * SIZE_PAGE, d[i]->page->addr, PGHD_PRESENT | PGHD_WRITE) < 0)
+				break;
+		}
+
+		/* Open outside o->lock, concurrent fetch may have opened it meanwhile */
+		if (!o->open && (proc_open(o->oid, 0) == EOK)) {
+			proc_lockSet(&o->lock);
+			opened = !o->open;
+			o->open = 1;
+			proc_lockClear(&o->lock);
+
+			if (!opened)
+				proc_close(o->oid, 0);
+		}
+
+		if ((i == n) && o->open && ((len = proc_read(o->oid, idx * SIZE_PAGE, w, n * SIZE_PAGE, 0)) >= 0))
+			hal_memset(w + len, 0, n * SIZE_PAGE - len);
+
+		vm_munmap(object_common.kmap, w, n * SIZE_PAGE);
 	}
 
-	if (proc_read(oid, offs, v, SIZE_PAGE, 0) < 0) {
-		vm_munmap(object_common.kmap, v, SIZE_PAGE);
-		vm_pageFree(p);
-		proc_close(oid, 0);
+	if (len < 0) {
+		for (i = 0; i < n; i++) {
+			if (d[i] == NULL)
+				continue;
+
+			if (d[i]->page != NULL)
+				vm_pageFree(d[i]->page);
+
+			vm_cacheFree(object_common.objpages, d[i]);
+			d[i] = NULL;
+		}
+	}
+}
+
+
+/* Allocates zero filled page for shared memory object */
+static vm_objpage_t *object_zero(void)
+{
+	vm_objpage_t *d;
+	void *w;
+	int err = -ENOMEM;
+
+	if ((d = vm_cacheAlloc(object_common.objpages)) == NULL)
 		return NULL;
+
+	if ((d->page = vm_pageAllocZeroed(PAGE_OWNER_APP)) != NULL)
+		return d;
+
+	if (((d->page = vm_pageAlloc(SIZE_PAGE, PAGE_OWNER_APP)) == NULL) && object_reclaim(1))
+		d->page = vm_pageAlloc(SIZE_PAGE, PAGE_OWNER_APP);
+
+	if ((d->page != NULL) && ((w = vm_mapFind(object_common.kmap, NULL, SIZE_PAGE, MAP_NOINHERIT, PROT_READ | PROT_WRITE)) != NULL)) {
+		if ((err = page_map(&object_common.kmap->pmap, w, d->page->addr, PGHD_PRESENT | PGHD_WRITE)) == EOK)
+			hal_memclr(w, SIZE_PAGE);
+
+		vm_munmap(object_common.kmap, w, SIZE_PAGE);
+	}
+
+	if (err < 0) {
+		if (d->page != NULL)
+			vm_pageFree(d->page);
+
+		vm_cacheFree(object_common.objpages, d);
+		d = NULL;
+	}
+
+	return d;
+}
+
+
+static void object_rathr(void *arg)
+{
+	object_ra_t *ra;
+	vm_object_t *o;
+	vm_objpage_t *d[OBJECT_RAMAX];
+	unsigned int i, n;
+
+	for (;;) {
+		hal_spinlockSet(&object_common.raspinlock);
+		while ((ra = object_common.raq) == NULL)
+			proc_threadWait(&object_common.rawq, &object_common.raspinlock, 0);
+		LIST_REMOVE(&object_common.raq, ra);
+		hal_spinlockClear(&object_common.raspinlock);
+
+		o = ra->o;
+
+		/* Claim the first run of pages nobody has loaded or is loading */
+		proc_lockSet(&o->lock);
+		while (ra->n && (o->pages[ra->idx] != NULL)) {
+			ra->idx++;
+			ra->n--;
+		}
+		for (n = 0; (n < ra->n) && (o->pages[ra->idx + n] == NULL); n++)
+			o->pages[ra->idx + n] = OBJECT_BUSY;
+		proc_lockClear(&o->lock);
+
+		if (n) {
+			object_fetch(o, ra->idx, n, d);
+
+			proc_lockSet(&o->lock);
+			for (i = 0; i < n; i++)
+				_object_install(o, ra->idx + i, d[i]);
+			proc_threadBroadcast(&o->waitq);
+			proc_lockClear(&o->lock);
+		}
+
+		vm_objectPut(o);
+		vm_kfree(ra);
 	}
+}
+
 
-	vm_munmap(object_common.kmap, v, SIZE_PAGE);
-	proc_close(oid, 0);
+/* Grows readahead window on sequential access and queues the next cluster, called with o->lock held */
+static void _object_readahead(vm_object_t *o, unsigned int idx)
+{
+	unsigned int npages = round_page(o->size) / SIZE_PAGE, start, worker;
+	object_ra_t *ra;
+
+	/* Shared memory pages are only made on demand */
+	if (o->anonymous || (idx == o->ralast))
+		return;
+
+	if (idx != o->ralast + 1) {
+		o->ralast = idx;
+		o->raend = 0;
+		o->rawin = 0;
+		return;
+	}
+
+	o->ralast = idx;
+
+	/* Next cluster is requested once access reaches the second half of the current one */
+	if (idx + o->rawin / 2 < o->raend)
+		return;
+
+	start = max(idx + 1, o->raend);
+	o->rawin = o->rawin ? min(2 * o->rawin, OBJECT_RAMAX) : OBJECT_RAMIN;
+
+	if (start >= npages)
+		return;
+
+	if ((ra = vm_kmalloc(sizeof(object_ra_t))) == NULL)
+		return;
+
+	ra->o = o;
+	ra->idx = start;
+	ra->n = min(o->rawin, npages - start);
+	o->raend = start + ra->n;
+	o->refs++;
+
+	hal_spinlockSet(&object_common.raspinlock);
+	worker = object_common.raworker;
+	object_common.raworker = 1;
+	LIST_ADD(&object_common.raq, ra);
+	proc_threadWakeup(&object_common.rawq);
+	hal_spinlockClear(&object_common.raspinlock);
+
+	if (!worker)
+		proc_threadCreate(NULL, object_rathr, NULL, OBJECT_RAPRIO, SIZE_KSTACK, NULL, 0, NULL);
+}
+
+
+/* Returns page only if it's in memory already, never reads backing store */
+page_t *vm_objectResident(vm_object_t *o, offs_t offs)
+{
+	vm_objpage_t *d;
+	page_t *p = NULL;
+
+	if (o == NULL || o == (void *)-1 || o == object_common.kernel)
+		return NULL;
+
+	proc_lockSet(&o->lock);
+
+	if ((offs < o->size) && ((d = o->pages[offs / SIZE_PAGE]) != NULL) && (d != OBJECT_BUSY))
+		p = d->page;
+
+	proc_lockClear(&o->lock);
 
 	return p;
 }
@@ -166,7 +790,8 @@ static page_t *object_fetch(oid_t oid, offs_t offs)
 
 page_t *vm_objectPage(vm_map_t *map, amap_t **amap, vm_object_t *o, void *vaddr, offs_t offs)
 {
-	page_t *p;
+	vm_objpage_t *d;
+	unsigned int idx = offs / SIZE_PAGE;
 
 	if (o == NULL)
 		return vm_pageAlloc(SIZE_PAGE, PAGE_OWNER_APP);
@@ -181,51 +806,66 @@ page_t *vm_objectPage(vm_map_t *map, amap_t **amap, vm_object_t *o, void *vaddr,
 		return NULL;
 	}
 
-	if ((p = o->pages[offs / SIZE_PAGE]) != NULL) {
+	_object_readahead(o, idx);
+
+	if (((d = o->pages[idx]) != NULL) && (d != OBJECT_BUSY)) {
+		d->referenced = 1;
 		proc_lockClear(&o->lock);
-		return p;
+		return d->page;
 	}
 
 	/* Fetch page from backing store */
 
-	proc_lockClear(&o->lock);
+	for (;;) {
+		proc_lockClear(&o->lock);
 
-	if (amap != NULL)
-		proc_lockClear(&(*amap)->lock);
+		if (amap != NULL)
+			proc_lockClear(&(*amap)->lock);
 
-	proc_lockClear(&map->lock);
+		proc_lockClear(&map->lock);
 
-	p = object_fetch(o->oid, offs);
+		proc_lockSet(&o->lock);
 
-	if (vm_lockVerify(map, amap, o, vaddr, offs)) {
-		if (p != NULL)
-			vm_pageFree(p);
+		/* Page may be in flight as part of readahead, don't read it twice */
+		while ((d = o->pages[idx]) == OBJECT_BUSY)
+			proc_lockWait(&o->waitq, &o->lock, 0);
 
-		return NULL;
-	}
+		if (d == NULL) {
+			o->pages[idx] = OBJECT_BUSY;
+			proc_lockClear(&o->lock);
 
-	proc_lockSet(&o->lock);
+			if (o->anonymous)
+				d = object_zero();
+			else
+				object_fetch(o, idx, 1, &d);
+
+			proc_lockSet(&o->lock);
+			_object_install(o, idx, d);
+			proc_threadBroadcast(&o->waitq);
+		}
 
-	if (o->pages[offs / SIZE_PAGE] != NULL) {
-		/* Someone loaded a page in the meantime, use it */
-		if (p != NULL)
-			vm_pageFree(p);
+		if (d != NULL)
+			d->referenced = 1;
 
-		p = o->pages[offs / SIZE_PAGE];
 		proc_lockClear(&o->lock);
-		return p;
+
+		if (vm_lockVerify(map, amap, o, vaddr, offs))
+			return NULL;
+
+		/* Reclaim can't take the page once the map is locked again, check it didn't before */
+		proc_lockSet(&o->lock);
+		if (o->pages[idx] == d)
+			break;
 	}
 
-	o->pages[offs / SIZE_PAGE] = p;
 	proc_lockClear(&o->lock);
-	return p;
+
+	return (d != NULL) ? d->page : NULL;
 }
 
 
 int _object_init(vm_map_t *kmap, vm_object_t *kernel)
 {
-	vm_object_t *o;
-
 	lib_printf("vm: Initializing memory objects\n");
 
 	object_common.kernel = kernel;
@@ -234,19 +874,44 @@ int _object_init(vm_map_t *kmap, vm_object_t *kernel)
 	proc_lockInit(&object_common.lock);
 	lib_rbInit(&object_common.tree, object_cmp, NULL);
 
+	object_common.cached = NULL;
+	object_common.ncached = 0;
+
+	hal_spinlockCreate(&object_common.raspinlock, "object.raspinlock");
+	object_common.raq = NULL;
+	object_common.rawq = NULL;
+	object_common.raworker = 0;
+
+	hal_spinlockCreate(&object_common.lruspinlock, "object.lruspinlock");
+	object_common.active = NULL;
+	object_common.inactive = NULL;
+	object_common.nactive = 0;
+	object_common.ninactive = 0;
+	object_common.reclaimer = 0;
+	object_common.shmid = 0;
+
+	if ((object_common.objpages = vm_cacheCreate("objpage", sizeof(vm_objpage_t), NULL)) == NULL)
+		return -ENOMEM;
+
+	/* Kernel object is never released nor cached */
 	kernel->oid.port = 0;
 	kernel->oid.id = 0;
+	kernel->refs = 1;
+	kernel->mtime = 0;
+	kernel->open = 0;
+	kernel->anonymous = 0;
+	kernel->pins = 0;
+	kernel->entries = NULL;
+	kernel->npages = 0;
+	kernel->waitq = NULL;
 	lib_rbInsert(&object_common.tree, &kernel->linkage);
 	proc_lockInit(&kernel->lock);
 
-	vm_objectGet(&o, kernel->oid);
-
 	return EOK;
 }
 
 
 
-
 #if 0
 void map_pageFault(unsigned int n, exc_context_t *ctx)
 {
@@ -23,14 +23,73 @@
 
 struct _vm_map_t;
 
+
+struct _map_entry_t;
+
+
+struct _thread_t;
+
+
+struct _vm_object_t;
+
+
+/* Marks pages being read from backing store */
+#define OBJECT_BUSY ((vm_objpage_t *)-1)
+
+
+/* Resident object page, kept on the active or inactive LRU list */
+typedef struct _vm_objpage_t {
+	struct _vm_objpage_t *next;
+	struct _vm_objpage_t *prev;
+
+	struct _vm_object_t *o;
+	page_t *page;
+	unsigned int idx;
+	u8 active;
+	u8 referenced;
+} vm_objpage_t;
+
+
+/* Object pinned on behalf of a message, see vm_mapPin() */
+typedef struct _vm_pin_t {
+	struct _vm_pin_t *next;
+	struct _vm_object_t *o;
+} vm_pin_t;
+
+
 typedef struct _vm_object_t {
 	rbnode_t linkage;
+	struct _vm_object_t *next;
+	struct _vm_object_t *prev;
 	lock_t lock;
 	oid_t oid;
 //	mutex_t *mutex;
 	unsigned int refs;
 	size_t size;
-	page_t *pages[];
+
+	/* File modification time, cached object is reused only if it didn't change */
+	int mtime;
+
+	/* Backing file stays open while object is alive */
+	int open;
+
+	/* Shared memory, pages are zero filled on first use and never reclaimed */
+	int anonymous;
+
+	/* Pages are mapped by IPC outside of entries, reclaim leaves them alone */
+	unsigned int pins;
+
+	/* Sequential access detector, in pages */
+	unsigned int ralast;
+	unsigned int raend;
+	unsigned int rawin;
+
+	/* Map entries using the object, needed to unmap reclaimed pages */
+	struct _map_entry_t *entries;
+	unsigned int npages;
+
+	struct _thread_t *waitq;
+	vm_objpage_t *pages[];
 } vm_object_t;
 
 
@@ -40,9 +99,27 @@ extern vm_object_t *vm_objectRef(vm_object_t *o);
 extern int vm_objectGet(vm_object_t **o, oid_t oid);
 
 
+extern int vm_objectCreate(vm_object_t **o, size_t size);
+
+
 extern int vm_objectPut(vm_object_t *o);
 
 
+extern int vm_objectPin(vm_object_t *o, vm_pin_t **pins);
+
+
+extern void vm_objectUnpin(vm_pin_t **pins);
+
+
+extern void vm_objectAttach(vm_object_t *o, struct _map_entry_t *e);
+
+
+extern void vm_objectDetach(vm_object_t *o, struct _map_entry_t *e);
+
+
+extern page_t *vm_objectResident(vm_object_t *o, offs_t offs);
+
+
 extern page_t *vm_objectPage(struct _vm_map_t *map, amap_t **amap, vm_object_t *o, void *vaddr, offs_t offs);
 
 
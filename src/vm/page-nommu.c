@@ -34,6 +34,11 @@ struct {
 	page_t *freeq;
 	size_t freeqsz;
 
+	size_t low;
+	size_t high;
+	spinlock_t spinlock;
+	thread_t *reclaimq;
+
 	lock_t lock;
 } pages;
 
@@ -68,6 +73,9 @@ page_t *vm_pageAlloc(size_t size, u8 flags)
 	p = _page_alloc(size, flags);
 	proc_lockClear(&pages.lock);
 
+	if ((pages.freesz < pages.low) && (pages.reclaimq != (void *)-1) && hal_started())
+		proc_threadWakeup(&pages.reclaimq);
+
 	return p;
 }
 
@@ -94,6 +102,12 @@ void vm_pageFree(page_t *lh)
 }
 
 
+void vm_pageSplit(page_t *lh)
+{
+	/* No superpages without MMU, blocks are never split */
+}
+
+
 void _page_showPages(void)
 {
 	return;
@@ -118,6 +132,19 @@ int page_map(pmap_t *pmap, void *vaddr, addr_t pa, int attr)
 }
 
 
+int page_mapRange(pmap_t *pmap, void *vaddr, addr_t pa, size_t size, int attr)
+{
+	size_t offs;
+
+	for (offs = 0; offs < size; offs += SIZE_PAGE) {
+		if (page_map(pmap, vaddr + offs, pa + offs, attr) < 0)
+			return -ENOMEM;
+	}
+
+	return EOK;
+}
+
+
 page_t *_page_get(addr_t addr)
 {
 	return NULL;
@@ -145,12 +172,41 @@ int _page_sbrk(pmap_t *pmap, void **start, void **end)
 }
 
 
+page_t *vm_pageAllocZeroed(u8 flags)
+{
+	return NULL;
+}
+
+
+int vm_pageZeroIdle(void)
+{
+	return 0;
+}
+
+
 void vm_pageGetStats(size_t *freesz)
 {
 	*freesz = pages.freesz;
 }
 
 
+void vm_pageReclaimWait(void)
+{
+	hal_spinlockSet(&pages.spinlock);
+	while (pages.freesz >= pages.low)
+		proc_threadWait(&pages.reclaimq, &pages.spinlock, 0);
+	hal_spinlockClear(&pages.spinlock);
+}
+
+
+size_t vm_pageReclaimTarget(void)
+{
+	size_t freesz = pages.freesz;
+
+	return (freesz < pages.high) ? pages.high - freesz : 0;
+}
+
+
 void vm_pageinfo(meminfo_t *info)
 {
 }
@@ -176,6 +232,11 @@ void _page_init(pmap_t *pmap, void **bss, void **top)
 	pages.allocsz = (unsigned int)(*bss) - VADDR_MIN;
 	pages.freesz -= pages.freeqsz * sizeof(page_t);
 
+	pages.low = (pages.freesz + pages.allocsz) / 32;
+	pages.high = (pages.freesz + pages.allocsz) / 16;
+	hal_spinlockCreate(&pages.spinlock, "pages.spinlock");
+	pages.reclaimq = NULL;
+
 	/* Show statistics one the console */
 	lib_printf("vm: Initializing page allocator %d/%d KB, page_t=%d\n", (pages.allocsz - pages.bootsz) / 1024,
 		(pages.freesz + pages.allocsz ) / 1024, sizeof(page_t));
@@ -24,19 +24,132 @@
 
 #define SIZE_VM_SIZES 32
 
+/* Physical memory is indexed in 1 MB sections for _page_get */
+#define PAGE_SECTIONSHIFT 20
+
+/* Per-CPU order-0 page cache sizing */
+#define PAGE_PCPBATCH 16
+#define PAGE_PCPHIGH  (4 * PAGE_PCPBATCH)
+
+/* Object page reclaim starts below 1/32 and stops above 1/16 of memory free */
+#define PAGE_LOWSHIFT  5
+#define PAGE_HIGHSHIFT 4
+
+/* Idle threads keep up to this many order-0 pages zeroed for anonymous faults */
+#define PAGE_ZEROMAX   32
+
+
+/*
+ * Order-0 pages cached on a CPU stay allocated from the buddy point of view.
+ * They are marked PAGE_FREE with idx 0 so the double free check still works
+ * and _page_free never coalesces them. The list head holds recently freed
+ * (cache-hot) pages, batches refilled from the buddy lists go to the tail.
+ */
+typedef struct {
+	spinlock_t spinlock;
+	page_t *pages;
+	unsigned int count;
+} page_pcp_t;
+
+
+/*
+ * Index of page_t entries of one physical memory section. Gapless sections
+ * are resolved by offset, sections with holes by search over their entries.
+ */
+typedef struct {
+	page_t *first;
+	u16 count;
+	u16 holes;
+} page_section_t;
+
 
 struct {
 	page_t *sizes[SIZE_VM_SIZES];
 	page_t *pages;
+	page_pcp_t *pcp;
+
+	page_section_t *sections;
+	size_t nsections;
+	size_t section0;
 
 	size_t allocsz;
 	size_t bootsz;
 	size_t freesz;
 
+	size_t low;
+	size_t high;
+	spinlock_t spinlock;
+	thread_t *reclaimq;
+
+	pmap_t *kpmap;
+	page_t *zeroq;
+	unsigned int nzero;
+	int zerobusy;
+	void *zerova;
+	spinlock_t zerospinlock;
+
 	lock_t lock;
 } pages;
 
 
+/* Function gives zeroed pool back to the buddy lists, returns number of pages released */
+static unsigned int _page_zeroDrain(void)
+{
+	page_t *p, *q;
+	unsigned int n;
+
+	/* Pool is empty during boot, before its spinlock is created */
+	if (pages.zeroq == NULL)
+		return 0;
+
+	hal_spinlockSet(&pages.zerospinlock);
+	q = pages.zeroq;
+	n = pages.nzero;
+	pages.zeroq = NULL;
+	pages.nzero = 0;
+	hal_spinlockClear(&pages.zerospinlock);
+
+	while ((p = q) != NULL) {
+		LIST_REMOVE(&q, p);
+		_page_free(p);
+	}
+
+	return n;
+}
+
+
+/* Function gives pages cached on all CPUs back to the buddy lists, returns number of pages released */
+static unsigned int _page_pcpDrain(void)
+{
+	page_pcp_t *pcp;
+	page_t *p, *batch;
+	unsigned int i, n = 0;
+
+	if (pages.pcp == NULL)
+		return 0;
+
+	for (i = 0; i < hal_cpuGetCount(); i++) {
+		pcp = pages.pcp + i;
+
+		hal_spinlockSet(&pcp->spinlock);
+		batch = pcp->pages;
+		n += pcp->count;
+		pcp->pages = NULL;
+		pcp->count = 0;
+		hal_spinlockClear(&pcp->spinlock);
+
+		while ((p = batch) != NULL) {
+			LIST_REMOVE(&batch, p);
+			p->flags &= ~PAGE_FREE;
+			p->idx = hal_cpuGetFirstBit(SIZE_PAGE);
+			_page_free(p);
+		}
+	}
+
+	return n;
+}
+
+
 page_t *_page_alloc(size_t size, u8 flags)
 {
 	unsigned int start, stop, i;
@@ -49,13 +162,19 @@ page_t *_page_alloc(size_t size, u8 flags)
 	if (hal_cpuGetFirstBit(size) < start)
 		start++;
 
-	/* Find segment */
-	stop = start;
+	/* Find segment, zeroed pool and per-CPU caches are counted as free so they're used up before failing */
+	for (;;) {
+		stop = start;
 
-	while ((stop < SIZE_VM_SIZES) && (pages.sizes[stop] == NULL))
-		stop++;
-	if (stop == SIZE_VM_SIZES)
-		return NULL;
+		while ((stop < SIZE_VM_SIZES) && (pages.sizes[stop] == NULL))
+			stop++;
+
+		if (stop < SIZE_VM_SIZES)
+			break;
+
+		if ((_page_zeroDrain() == 0) && (_page_pcpDrain() == 0))
+			return NULL;
+	}
 
 	lh = pages.sizes[stop];
 
@@ -86,13 +205,127 @@ page_t *_page_alloc(size_t size, u8 flags)
 }
 
 
-page_t *vm_pageAlloc(size_t size, u8 flags)
+static size_t page_pcpCount(void)
 {
-	page_t *p;
+	unsigned int i;
+	size_t n = 0;
+
+	if (pages.pcp == NULL)
+		return 0;
+
+	for (i = 0; i < hal_cpuGetCount(); i++)
+		n += pages.pcp[i].count;
+
+	return n;
+}
+
+
+static page_t *page_pcpAlloc(u8 flags)
+{
+	page_pcp_t *pcp = pages.pcp + hal_cpuGetID();
+	page_t *p, *batch = NULL;
+	unsigned int i;
+
+	hal_spinlockSet(&pcp->spinlock);
+	if ((p = pcp->pages) == NULL) {
+		hal_spinlockClear(&pcp->spinlock);
+
+		/* Refill the cache with a batch taken from the buddy lists */
+		proc_lockSet(&pages.lock);
+		for (i = 0; i < PAGE_PCPBATCH; i++) {
+			if ((p = _page_alloc(SIZE_PAGE, 0)) == NULL)
+				break;
+			p->flags |= PAGE_FREE;
+			p->idx = 0;
+			LIST_ADD(&batch, p);
+		}
+		proc_lockClear(&pages.lock);
+
+		if (batch == NULL)
+			return NULL;
+
+		hal_spinlockSet(&pcp->spinlock);
+		while ((p = batch) != NULL) {
+			LIST_REMOVE(&batch, p);
+			LIST_ADD(&pcp->pages, p);
+			pcp->count++;
+		}
+		p = pcp->pages;
+	}
+
+	LIST_REMOVE(&pcp->pages, p);
+	pcp->count--;
+	hal_spinlockClear(&pcp->spinlock);
+
+	p->flags = flags & ~PAGE_FREE;
+	p->idx = hal_cpuGetFirstBit(SIZE_PAGE);
+
+	return p;
+}
+
+
+static void page_pcpFree(page_t *p)
+{
+	page_pcp_t *pcp = pages.pcp + hal_cpuGetID();
+	page_t *batch = NULL;
+	unsigned int i;
+
+	if (p->flags & PAGE_FREE) {
+		hal_cpuDisableInterrupts();
+		lib_printf("page: double free (%p)\n", p);
+		hal_cpuEnableInterrupts();
+		for (;;) ;
+	}
+
+	p->flags |= PAGE_FREE;
+	p->idx = 0;
+
+	hal_spinlockSet(&pcp->spinlock);
+	LIST_ADD(&pcp->pages, p);
+	pcp->pages = p;
+
+	if (++pcp->count < PAGE_PCPHIGH) {
+		hal_spinlockClear(&pcp->spinlock);
+		return;
+	}
+
+	/* Drain the coldest pages back to the buddy lists */
+	for (i = 0; i < PAGE_PCPBATCH; i++) {
+		p = pcp->pages->prev;
+		LIST_REMOVE(&pcp->pages, p);
+		LIST_ADD(&batch, p);
+	}
+	pcp->count -= PAGE_PCPBATCH;
+	hal_spinlockClear(&pcp->spinlock);
 
 	proc_lockSet(&pages.lock);
-	p = _page_alloc(size, flags);
+	while ((p = batch) != NULL) {
+		LIST_REMOVE(&batch, p);
+		p->flags &= ~PAGE_FREE;
+		p->idx = hal_cpuGetFirstBit(SIZE_PAGE);
+		_page_free(p);
+	}
 	proc_lockClear(&pages.lock);
+}
+
+
+page_t *vm_pageAlloc(size_t size, u8 flags)
+{
+	page_t *p;
+
+	if (size <= SIZE_PAGE && pages.pcp != NULL) {
+		p = page_pcpAlloc(flags);
+	}
+	else {
+		proc_lockSet(&pages.lock);
+		p = _page_alloc(size, flags);
+		proc_lockClear(&pages.lock);
+	}
+
+	/* Kick reclaim once, it clears the wakeup when it starts waiting again */
+	if ((pages.freesz < pages.low) && (pages.reclaimq != (void *)-1) && hal_started())
+		proc_threadWakeup(&pages.reclaimq);
+
 	return p;
 }
 
@@ -152,6 +385,11 @@ void _page_free(page_t *p)
 
 void vm_pageFree(page_t *lh)
 {
+	if (lh->idx == hal_cpuGetFirstBit(SIZE_PAGE) && pages.pcp != NULL) {
+		page_pcpFree(lh);
+		return;
+	}
+
 	proc_lockSet(&pages.lock);
 	_page_free(lh);
 	proc_lockClear(&pages.lock);
@@ -159,6 +397,16 @@ void vm_pageFree(page_t *lh)
 }
 
 
+void vm_pageSplit(page_t *lh)
+{
+	unsigned int i, n = (1 << lh->idx) / SIZE_PAGE;
+
+	/* Allocated pages are off the free lists, freeing them one by one coalesces the block back */
+	for (i = 0; i < n; i++)
+		(lh + i)->idx = hal_cpuGetFirstBit(SIZE_PAGE);
+}
+
+
 static int _page_get_cmp(void *key, void *item)
 {
 	addr_t a = (addr_t)key;
@@ -176,21 +424,31 @@ static int _page_get_cmp(void *key, void *item)
 
 page_t *_page_get(addr_t addr)
 {
-	page_t *p;
-	size_t np = (pages.freesz + pages.allocsz) / SIZE_PAGE;
+	page_section_t *s;
+	size_t n;
 
-	addr =  addr & ~(SIZE_PAGE - 1);
-	p = lib_bsearch((void *)addr, pages.pages, np, sizeof(page_t),  _page_get_cmp);
+	addr = addr & ~(SIZE_PAGE - 1);
 
-	return p;
+	n = addr >> PAGE_SECTIONSHIFT;
+	if ((n < pages.section0) || (n - pages.section0 >= pages.nsections))
+		return NULL;
+
+	s = pages.sections + (n - pages.section0);
+	if ((s->first == NULL) || (addr < s->first->addr))
+		return NULL;
+
+	if (s->holes)
+		return lib_bsearch((void *)addr, s->first, s->count, sizeof(page_t), _page_get_cmp);
+
+	n = (addr - s->first->addr) / SIZE_PAGE;
+
+	return (n < s->count) ? s->first + n : NULL;
 }
 
 
 void vm_pageFreeAt(pmap_t *pmap, void *vaddr)
 {
-	proc_lockSet(&pages.lock);
-	_page_free(_page_get(pmap_resolve(pmap, vaddr)));
-	proc_lockClear(&pages.lock);
+	vm_pageFree(_page_get(pmap_resolve(pmap, vaddr)));
 }
 
 
@@ -230,6 +488,54 @@ void _page_initSizes(void)
 }
 
 
+static void *_page_carve(pmap_t *pmap, void **bss, void **top, size_t size)
+{
+	void *p = (*bss);
+
+	while (p + size >= (*top)) {
+		if (_page_sbrk(pmap, bss, top) < 0)
+			return NULL;
+	}
+
+	(*bss) = p + size;
+
+	return p;
+}
+
+
+static int _page_initSections(pmap_t *pmap, void **bss, void **top)
+{
+	size_t i, n = (pages.freesz + pages.allocsz) / SIZE_PAGE, nsections;
+	page_section_t *s;
+
+	if (n == 0)
+		return EOK;
+
+	pages.section0 = pages.pages[0].addr >> PAGE_SECTIONSHIFT;
+	nsections = (pages.pages[n - 1].addr >> PAGE_SECTIONSHIFT) - pages.section0 + 1;
+
+	if ((pages.sections = _page_carve(pmap, bss, top, nsections * sizeof(page_section_t))) == NULL)
+		return -ENOMEM;
+
+	hal_memset(pages.sections, 0, nsections * sizeof(page_section_t));
+
+	for (i = 0; i < n; i++) {
+		s = pages.sections + (pages.pages[i].addr >> PAGE_SECTIONSHIFT) - pages.section0;
+
+		if (s->first == NULL)
+			s->first = pages.pages + i;
+		else if (pages.pages[i].addr != pages.pages[i - 1].addr + SIZE_PAGE)
+			s->holes = 1;
+
+		s->count++;
+	}
+
+	pages.nsections = nsections;
+
+	return EOK;
+}
+
+
 void _page_showSizes(void)
 {
 	unsigned int i;
@@ -312,6 +618,27 @@ int page_map(pmap_t *pmap, void *vaddr, addr_t pa, int attrs)
 }
 
 
+int page_mapRange(pmap_t *pmap, void *vaddr, addr_t pa, size_t size, int attrs)
+{
+	page_t *ap = NULL;
+	int err = EOK;
+
+	proc_lockSet(&pages.lock);
+
+	/* Each failed pass has consumed the table given to it */
+	while (pmap_enterRange(pmap, pa, vaddr, size, attrs, ap) < 0) {
+		if (vaddr > (void *)VADDR_KERNEL || (ap = _page_alloc(SIZE_PAGE, PAGE_OWNER_KERNEL | PAGE_KERNEL_PTABLE)) == NULL) {
+			err = -ENOMEM;
+			break;
+		}
+	}
+
+	proc_lockClear(&pages.lock);
+
+	return err;
+}
+
+
 int _page_sbrk(pmap_t *pmap, void **start, void **end)
 {
 	page_t *np, *ap = NULL;
@@ -330,9 +657,85 @@ int _page_sbrk(pmap_t *pmap, void **start, void **end)
 }
 
 
+page_t *vm_pageAllocZeroed(u8 flags)
+{
+	page_t *p;
+
+	hal_spinlockSet(&pages.zerospinlock);
+	if ((p = pages.zeroq) != NULL) {
+		LIST_REMOVE(&pages.zeroq, p);
+		pages.nzero--;
+	}
+	hal_spinlockClear(&pages.zerospinlock);
+
+	if (p != NULL)
+		p->flags = flags & ~PAGE_FREE;
+
+	return p;
+}
+
+
+int vm_pageZeroIdle(void)
+{
+	page_t *p;
+
+	if ((pages.zerova == NULL) || (pages.nzero >= PAGE_ZEROMAX) || (pages.freesz < pages.high))
+		return 0;
+
+	/* Only one core zeroes at a time, they share the scratch page */
+	hal_spinlockSet(&pages.zerospinlock);
+	if (pages.zerobusy) {
+		hal_spinlockClear(&pages.zerospinlock);
+		return 0;
+	}
+	pages.zerobusy = 1;
+	hal_spinlockClear(&pages.zerospinlock);
+
+	/* Idle thread can't sleep on the allocator lock */
+	p = NULL;
+	if (proc_lockTry(&pages.lock) == EOK) {
+		p = _page_alloc(SIZE_PAGE, 0);
+		proc_lockClear(&pages.lock);
+	}
+
+	if (p != NULL) {
+		pmap_enter(pages.kpmap, p->addr, pages.zerova, PGHD_WRITE | PGHD_PRESENT, NULL);
+		hal_memclr(pages.zerova, SIZE_PAGE);
+		pmap_remove(pages.kpmap, pages.zerova);
+	}
+
+	hal_spinlockSet(&pages.zerospinlock);
+	if (p != NULL) {
+		LIST_ADD(&pages.zeroq, p);
+		pages.nzero++;
+	}
+	pages.zerobusy = 0;
+	hal_spinlockClear(&pages.zerospinlock);
+
+	return p != NULL;
+}
+
+
 void vm_pageGetStats(size_t *freesz)
 {
-	*freesz = pages.freesz;
+	*freesz = pages.freesz + (page_pcpCount() + pages.nzero) * SIZE_PAGE;
+}
+
+
+void vm_pageReclaimWait(void)
+{
+	hal_spinlockSet(&pages.spinlock);
+	while (pages.freesz >= pages.low)
+		proc_threadWait(&pages.reclaimq, &pages.spinlock, 0);
+	hal_spinlockClear(&pages.spinlock);
+}
+
+
+size_t vm_pageReclaimTarget(void)
+{
+	size_t freesz = pages.freesz;
+
+	return (freesz < pages.high) ? pages.high - freesz : 0;
 }
 
 
@@ -341,11 +744,13 @@ void vm_pageinfo(meminfo_t *info)
 	char c;
 	page_t *p;
 	unsigned int size, rep, i;
+	size_t cached;
 
 	proc_lockSet(&pages.lock);
 
-	info->page.alloc = pages.allocsz;
-	info->page.free = pages.freesz;
+	cached = (page_pcpCount() + pages.nzero) * SIZE_PAGE;
+	info->page.alloc = pages.allocsz - cached;
+	info->page.free = pages.freesz + cached;
 	info->page.boot = pages.bootsz;
 	info->page.sz = sizeof(page_t);
 
@@ -380,11 +785,24 @@ void _page_init(pmap_t *pmap, void **bss, void **top)
 	addr_t addr;
 	unsigned int k;
 	page_t *page, *p;
+	page_pcp_t *pcp;
 	int err;
 	void *vaddr;
 
 	proc_lockInit(&pages.lock);
 
+	pages.pcp = NULL;
+	pages.kpmap = pmap;
+	pages.zeroq = NULL;
+	pages.nzero = 0;
+	pages.zerobusy = 0;
+	pages.zerova = NULL;
+	pages.low = 0;
+	pages.high = 0;
+	pages.sections = NULL;
+	pages.nsections = 0;
+	pages.section0 = 0;
+
 	/* Prepare memory hash */
 	pages.freesz = 0;
 	pages.allocsz = 0;
@@ -431,6 +849,13 @@ void _page_init(pmap_t *pmap, void **bss, void **top)
 
 	(*bss) = page;
 
+	/* Per-CPU page caches and the section index follow the page array */
+	if (((pcp = _page_carve(pmap, bss, top, hal_cpuGetCount() * sizeof(page_pcp_t))) == NULL) ||
+	    (_page_initSections(pmap, bss, top) < 0)) {
+		lib_printf("vm: Kernel heap extension error %p %p!\n", *bss, *top);
+		return;
+	}
+
 	/* Prepare allocation hash */
 	_page_initSizes();
 
@@ -443,6 +868,28 @@ void _page_init(pmap_t *pmap, void **bss, void **top)
 			return;
 	}
 
+	/* Scratch page for zeroing keeps its page table, the page behind it is given back */
+	if (_page_sbrk(pmap, bss, top) == EOK) {
+		pages.zerova = (*top) - SIZE_PAGE;
+		(*bss) = (*top);
+
+		_page_free(_page_get(pmap_resolve(pmap, pages.zerova)));
+		pmap_remove(pmap, pages.zerova);
+	}
+	hal_spinlockCreate(&pages.zerospinlock, "pages.zerospinlock");
+
+	for (k = 0; k < hal_cpuGetCount(); k++) {
+		hal_spinlockCreate(&pcp[k].spinlock, "page.pcp");
+		pcp[k].pages = NULL;
+		pcp[k].count = 0;
+	}
+	pages.pcp = pcp;
+
+	pages.low = (pages.freesz + pages.allocsz) >> PAGE_LOWSHIFT;
+	pages.high = (pages.freesz + pages.allocsz) >> PAGE_HIGHSHIFT;
+	hal_spinlockCreate(&pages.spinlock, "pages.spinlock");
+	pages.reclaimq = NULL;
+
 	/* Show statistics on the console */
 	lib_printf("vm: Initializing page allocator (%d+%d)/%dKB, page_t=%d\n", (pages.allocsz - pages.bootsz) / 1024,
 		pages.bootsz / 1024, (pages.freesz + pages.allocsz ) / 1024, sizeof(page_t));
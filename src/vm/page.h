@@ -33,6 +33,10 @@ extern void _page_free(page_t *lh);
 extern void vm_pageFree(page_t *lh);
 
 
+/* Function makes pages of allocated block freeable one by one */
+extern void vm_pageSplit(page_t *lh);
+
+
 extern page_t *_page_get(addr_t addr);
 
 
@@ -45,12 +49,30 @@ extern void _page_showPages(void);
 extern int page_map(pmap_t *pmap, void *vaddr, addr_t pa, int attr);
 
 
+/* Maps physically contiguous range, page tables are allocated as needed */
+extern int page_mapRange(pmap_t *pmap, void *vaddr, addr_t pa, size_t size, int attr);
+
+
 extern int _page_sbrk(pmap_t *pmap, void **bss, void **top);
 
 
+/* Function returns page zeroed in idle time or NULL when there is none */
+extern page_t *vm_pageAllocZeroed(u8 flags);
+
+
+/* Function zeroes one page for the pool, returns 0 when there is nothing to do */
+extern int vm_pageZeroIdle(void);
+
+
 extern void vm_pageGetStats(size_t *freesz);
 
 
+extern void vm_pageReclaimWait(void);
+
+
+extern size_t vm_pageReclaimTarget(void);
+
+
 extern void vm_pageinfo(meminfo_t *info);
 
 
@@ -0,0 +1,468 @@
+/*
+ * Phoenix-RTOS
+ *
+ * Operating system kernel
+ *
+ * Virtual memory manager - slab object caches
+ *
+ * Copyright 2018 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#include HAL
+#include "../../include/errno.h"
+#include "../lib/lib.h"
+#include "../proc/proc.h"
+#include "page.h"
+#include "map.h"
+#include "kmalloc.h"
+#include "slab.h"
+
+
+#define SLAB_ALIGN(x)  (((x) + 7) & ~7)
+#define SLAB_HDRSZ     ((sizeof(vm_slab_t) + 15) & ~15)
+
+
+struct {
+	vm_map_t *kmap;
+	vm_object_t *kernel;
+
+	vm_cache_t *caches;
+	lock_t lock;
+} slab_common;
+
+
+static vm_slab_t *slab_create(vm_cache_t *cache)
+{
+	page_t *p;
+	vm_slab_t *slab;
+	void *obj;
+	unsigned int i;
+
+	if ((p = vm_pageAlloc(SIZE_PAGE, PAGE_OWNER_KERNEL | PAGE_KERNEL_HEAP)) == NULL)
+		return NULL;
+
+	if (cache->pageMap != NULL)
+		slab = cache->pageMap(p);
+	else
+		slab = vm_mmap(slab_common.kmap, slab_common.kmap->start, p, SIZE_PAGE, PROT_READ | PROT_WRITE, slab_common.kernel, -1, MAP_NONE);
+
+	if (slab == NULL) {
+		vm_pageFree(p);
+		return NULL;
+	}
+
+	slab->cache = cache;
+	slab->page = p;
+	slab->first = NULL;
+	slab->used = 0;
+
+	/* Objects are constructed once, when their slab is created. There is no destructor, ctor must not take resources */
+	for (i = cache->perslab; i-- > 0;) {
+		obj = (void *)slab + SLAB_HDRSZ + i * cache->size;
+
+		if (cache->ctor != NULL)
+			cache->ctor(obj);
+
+		*((void **)(obj + cache->link)) = slab->first;
+		slab->first = obj;
+	}
+
+	cache->slabs++;
+
+	return slab;
+}
+
+
+static void slab_destroy(vm_cache_t *cache, vm_slab_t *slab)
+{
+	page_t *p = slab->page;
+
+	cache->slabs--;
+
+	if (cache->pageUnmap != NULL)
+		cache->pageUnmap(slab);
+	else
+		vm_munmap(slab_common.kmap, slab, SIZE_PAGE);
+	vm_pageFree(p);
+}
+
+
+static void *_slab_alloc(vm_cache_t *cache)
+{
+	vm_slab_t *slab;
+	void *obj;
+
+	if ((slab = cache->partial) == NULL) {
+		if ((slab = cache->empty) != NULL)
+			LIST_REMOVE(&cache->empty, slab);
+		else if ((slab = slab_create(cache)) == NULL)
+			return NULL;
+
+		LIST_ADD(&cache->partial, slab);
+	}
+
+	obj = slab->first;
+	slab->first = *((void **)(obj + cache->link));
+	slab->used++;
+	cache->used++;
+
+	if (slab->used == cache->perslab) {
+		LIST_REMOVE(&cache->partial, slab);
+		LIST_ADD(&cache->full, slab);
+	}
+
+	return obj;
+}
+
+
+static void _slab_free(vm_cache_t *cache, void *obj)
+{
+	vm_slab_t *slab = vm_slabOf(obj);
+
+	if (slab->used == cache->perslab) {
+		LIST_REMOVE(&cache->full, slab);
+		LIST_ADD(&cache->partial, slab);
+	}
+
+	*((void **)(obj + cache->link)) = slab->first;
+	slab->first = obj;
+	slab->used--;
+	cache->used--;
+
+	if (slab->used == 0) {
+		LIST_REMOVE(&cache->partial, slab);
+
+		/* Keep one empty slab around to absorb alloc/free bursts */
+		if (cache->empty == NULL)
+			LIST_ADD(&cache->empty, slab);
+		else
+			slab_destroy(cache, slab);
+	}
+}
+
+
+static unsigned int cache_cached(vm_cache_t *cache)
+{
+	unsigned int i, n = 0;
+
+	if (cache->mags == NULL)
+		return 0;
+
+	for (i = 0; i < hal_cpuGetCount(); i++)
+		n += cache->mags[i].count;
+
+	return n;
+}
+
+
+void *vm_cacheAlloc(vm_cache_t *cache)
+{
+	vm_magazine_t *mag;
+	void *objs[VM_MAGBATCH], *obj;
+	unsigned int i, n;
+
+	/* Objects too large for a slab come straight from kmalloc */
+	if (cache->perslab == 0) {
+		if ((obj = vm_kmalloc(cache->objsz)) == NULL)
+			return NULL;
+
+		if (cache->ctor != NULL)
+			cache->ctor(obj);
+
+		proc_lockSet(&cache->lock);
+		cache->used++;
+		proc_lockClear(&cache->lock);
+		return obj;
+	}
+
+	if (cache->mags == NULL) {
+		proc_lockSet(&cache->lock);
+		obj = _slab_alloc(cache);
+		proc_lockClear(&cache->lock);
+		return obj;
+	}
+
+	mag = cache->mags + hal_cpuGetID();
+
+	hal_spinlockSet(&mag->spinlock);
+	if (mag->count) {
+		obj = mag->objs[--mag->count];
+		hal_spinlockClear(&mag->spinlock);
+		return obj;
+	}
+	hal_spinlockClear(&mag->spinlock);
+
+	/* Refill the magazine with a batch taken from the slabs */
+	proc_lockSet(&cache->lock);
+	for (n = 0; n < VM_MAGBATCH; n++) {
+		if ((objs[n] = _slab_alloc(cache)) == NULL)
+			break;
+	}
+	proc_lockClear(&cache->lock);
+
+	if (n == 0)
+		return NULL;
+
+	obj = objs[--n];
+
+	hal_spinlockSet(&mag->spinlock);
+	for (i = 0; (i < n) && (mag->count < VM_MAGSZ); i++)
+		mag->objs[mag->count++] = objs[i];
+	hal_spinlockClear(&mag->spinlock);
+
+	if (i < n) {
+		proc_lockSet(&cache->lock);
+		for (; i < n; i++)
+			_slab_free(cache, objs[i]);
+		proc_lockClear(&cache->lock);
+	}
+
+	return obj;
+}
+
+
+void vm_cacheFree(vm_cache_t *cache, void *obj)
+{
+	vm_magazine_t *mag;
+	void *objs[VM_MAGBATCH];
+	unsigned int i;
+
+	if (cache->perslab == 0) {
+		proc_lockSet(&cache->lock);
+		cache->used--;
+		proc_lockClear(&cache->lock);
+
+		vm_kfree(obj);
+		return;
+	}
+
+	if (cache->mags == NULL) {
+		proc_lockSet(&cache->lock);
+		_slab_free(cache, obj);
+		proc_lockClear(&cache->lock);
+		return;
+	}
+
+	mag = cache->mags + hal_cpuGetID();
+
+	hal_spinlockSet(&mag->spinlock);
+	if (mag->count < VM_MAGSZ) {
+		mag->objs[mag->count++] = obj;
+		hal_spinlockClear(&mag->spinlock);
+		return;
+	}
+
+	/* Drain the oldest half of the magazine back to the slabs */
+	for (i = 0; i < VM_MAGBATCH; i++)
+		objs[i] = mag->objs[i];
+	for (i = VM_MAGBATCH; i < VM_MAGSZ; i++)
+		mag->objs[i - VM_MAGBATCH] = mag->objs[i];
+
+	mag->count -= VM_MAGBATCH;
+	mag->objs[mag->count++] = obj;
+	hal_spinlockClear(&mag->spinlock);
+
+	proc_lockSet(&cache->lock);
+	for (i = 0; i < VM_MAGBATCH; i++)
+		_slab_free(cache, objs[i]);
+	proc_lockClear(&cache->lock);
+}
+
+
+size_t vm_cacheUsed(vm_cache_t *cache)
+{
+	return cache->used - cache_cached(cache);
+}
+
+
+int _vm_cacheInit(vm_cache_t *cache, const char *name, size_t size, void (*ctor)(void *))
+{
+	if (size == 0)
+		return -EINVAL;
+
+	cache->name = name;
+	cache->objsz = size;
+	cache->ctor = ctor;
+
+	/* Constructed objects keep the free list link behind the object */
+	if (ctor != NULL) {
+		cache->link = SLAB_ALIGN(size);
+		cache->size = SLAB_ALIGN(cache->link + sizeof(void *));
+	}
+	else {
+		cache->link = 0;
+		cache->size = SLAB_ALIGN(max(size, sizeof(void *)));
+	}
+
+	/* Oversized objects fall back to kmalloc, see vm_cacheAlloc() */
+	if (size > VM_SLAB_MAX)
+		cache->perslab = 0;
+	else
+		cache->perslab = (SIZE_PAGE - SLAB_HDRSZ) / cache->size;
+
+	cache->partial = NULL;
+	cache->full = NULL;
+	cache->empty = NULL;
+	cache->slabs = 0;
+	cache->used = 0;
+	cache->mags = NULL;
+	cache->pageMap = NULL;
+	cache->pageUnmap = NULL;
+
+	proc_lockInit(&cache->lock);
+
+	proc_lockSet(&slab_common.lock);
+	LIST_ADD(&slab_common.caches, cache);
+	proc_lockClear(&slab_common.lock);
+
+	return EOK;
+}
+
+
+int _vm_cacheMagazines(vm_cache_t *cache)
+{
+	vm_magazine_t *mags;
+	unsigned int i;
+
+	if ((mags = vm_kmalloc(hal_cpuGetCount() * sizeof(vm_magazine_t))) == NULL)
+		return -ENOMEM;
+
+	for (i = 0; i < hal_cpuGetCount(); i++) {
+		hal_spinlockCreate(&mags[i].spinlock, "cache.mag");
+		mags[i].count = 0;
+	}
+
+	cache->mags = mags;
+
+	return EOK;
+}
+
+
+/* Caches used by the mapper itself can't get their slabs from vm_mmap() */
+void _vm_cacheBackend(vm_cache_t *cache, void *(*pageMap)(page_t *), void (*pageUnmap)(void *))
+{
+	cache->pageMap = pageMap;
+	cache->pageUnmap = pageUnmap;
+}
+
+
+vm_cache_t *vm_cacheCreate(const char *name, size_t size, void (*ctor)(void *))
+{
+	vm_cache_t *cache;
+
+	if ((cache = vm_kmalloc(sizeof(vm_cache_t))) == NULL)
+		return NULL;
+
+	if (_vm_cacheInit(cache, name, size, ctor) < 0) {
+		vm_kfree(cache);
+		return NULL;
+	}
+
+	if (cache->perslab != 0 && _vm_cacheMagazines(cache) < 0) {
+		vm_cacheDestroy(cache);
+		return NULL;
+	}
+
+	return cache;
+}
+
+
+int vm_cacheDestroy(vm_cache_t *cache)
+{
+	vm_magazine_t *mags = cache->mags;
+	vm_slab_t *slab;
+	void *objs[VM_MAGSZ];
+	unsigned int i, n;
+
+	proc_lockSet(&cache->lock);
+
+	for (i = 0; (mags != NULL) && (i < hal_cpuGetCount()); i++) {
+		hal_spinlockSet(&mags[i].spinlock);
+		for (n = 0; mags[i].count; n++)
+			objs[n] = mags[i].objs[--mags[i].count];
+		hal_spinlockClear(&mags[i].spinlock);
+
+		while (n)
+			_slab_free(cache, objs[--n]);
+	}
+
+	if (cache->used) {
+		proc_lockClear(&cache->lock);
+		return -EBUSY;
+	}
+
+	while ((slab = cache->empty) != NULL) {
+		LIST_REMOVE(&cache->empty, slab);
+		slab_destroy(cache, slab);
+	}
+
+	proc_lockClear(&cache->lock);
+
+	proc_lockSet(&slab_common.lock);
+	LIST_REMOVE(&slab_common.caches, cache);
+	proc_lockClear(&slab_common.lock);
+
+	if (mags != NULL) {
+		for (i = 0; i < hal_cpuGetCount(); i++)
+			hal_spinlockDestroy(&mags[i].spinlock);
+		vm_kfree(mags);
+	}
+
+	proc_lockDone(&cache->lock);
+	vm_kfree(cache);
+
+	return EOK;
+}
+
+
+void vm_slabinfo(meminfo_t *info)
+{
+	vm_cache_t *cache;
+	slabinfo_t *si;
+	int size;
+
+	if (info->slab.cachesz == -1)
+		return;
+
+	proc_lockSet(&slab_common.lock);
+
+	size = 0;
+	if ((cache = slab_common.caches) != NULL) {
+		do {
+			if (info->slab.cache != NULL && info->slab.cachesz > size) {
+				si = info->slab.cache + size;
+
+				proc_lockSet(&cache->lock);
+				hal_strncpy(si->name, cache->name, sizeof(si->name) - 1);
+				si->name[sizeof(si->name) - 1] = '\0';
+				si->objsz = cache->objsz;
+				si->perslab = cache->perslab;
+				si->slabs = cache->slabs;
+				si->cached = cache_cached(cache);
+				si->used = cache->used - si->cached;
+				proc_lockClear(&cache->lock);
+			}
+
+			++size;
+			cache = cache->next;
+		} while (cache != slab_common.caches);
+	}
+
+	info->slab.cachesz = size;
+
+	proc_lockClear(&slab_common.lock);
+}
+
+
+void _slab_init(vm_map_t *map, vm_object_t *kernel)
+{
+	slab_common.kmap = map;
+	slab_common.kernel = kernel;
+	slab_common.caches = NULL;
+
+	proc_lockInit(&slab_common.lock);
+}
@@ -0,0 +1,116 @@
+/*
+ * Phoenix-RTOS
+ *
+ * Operating system kernel
+ *
+ * Virtual memory manager - slab object caches
+ *
+ * Copyright 2018 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _VM_SLAB_H_
+#define _VM_SLAB_H_
+
+#include HAL
+#include "../../include/sysinfo.h"
+#include "map.h"
+
+
+/* Largest object served from a slab, slabs are one page long and hold two such objects */
+#define VM_SLAB_MAX   (SIZE_PAGE / 2 - 64)
+
+/* Per-CPU magazine capacity and refill/drain batch */
+#define VM_MAGSZ      16
+#define VM_MAGBATCH   (VM_MAGSZ / 2)
+
+
+struct _vm_cache_t;
+
+
+typedef struct _vm_slab_t {
+	struct _vm_slab_t *next;
+	struct _vm_slab_t *prev;
+
+	struct _vm_cache_t *cache;
+	page_t *page;
+	void *first;
+	unsigned int used;
+} vm_slab_t;
+
+
+typedef struct _vm_magazine_t {
+	spinlock_t spinlock;
+	unsigned int count;
+	void *objs[VM_MAGSZ];
+} vm_magazine_t;
+
+
+typedef struct _vm_cache_t {
+	struct _vm_cache_t *next;
+	struct _vm_cache_t *prev;
+
+	const char *name;
+	size_t objsz;
+	size_t size;
+	size_t link;
+	unsigned int perslab;
+	void (*ctor)(void *);
+
+	vm_slab_t *partial;
+	vm_slab_t *full;
+	vm_slab_t *empty;
+
+	unsigned int slabs;
+	unsigned int used;
+
+	vm_magazine_t *mags;
+	lock_t lock;
+
+	/* Optional page source, slabs are mapped in kmap by default */
+	void *(*pageMap)(page_t *p);
+	void (*pageUnmap)(void *vaddr);
+} vm_cache_t;
+
+
+/* Finds the slab owning an object in O(1), the header starts the object's page */
+static inline vm_slab_t *vm_slabOf(void *obj)
+{
+	return (vm_slab_t *)((unsigned long)obj & ~(SIZE_PAGE - 1));
+}
+
+
+extern vm_cache_t *vm_cacheCreate(const char *name, size_t size, void (*ctor)(void *));
+
+
+extern int vm_cacheDestroy(vm_cache_t *cache);
+
+
+extern void *vm_cacheAlloc(vm_cache_t *cache);
+
+
+extern void vm_cacheFree(vm_cache_t *cache, void *obj);
+
+
+extern int _vm_cacheInit(vm_cache_t *cache, const char *name, size_t size, void (*ctor)(void *));
+
+
+extern int _vm_cacheMagazines(vm_cache_t *cache);
+
+
+extern void _vm_cacheBackend(vm_cache_t *cache, void *(*pageMap)(page_t *), void (*pageUnmap)(void *));
+
+
+extern size_t vm_cacheUsed(vm_cache_t *cache);
+
+
+extern void vm_slabinfo(meminfo_t *info);
+
+
+extern void _slab_init(vm_map_t *map, vm_object_t *kernel);
+
+
+#endif
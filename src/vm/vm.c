@@ -21,6 +21,7 @@
 #include "map.h"
 #include "amap.h"
 #include "zone.h"
+#include "slab.h"
 #include "kmalloc.h"
 
 
@@ -34,6 +35,7 @@ void vm_meminfo(meminfo_t *info)
 {
 	vm_pageinfo(info);
 	vm_mapinfo(info);
+	vm_slabinfo(info);
 }
 
 
@@ -42,10 +44,12 @@ void _vm_init(vm_map_t *kmap, vm_object_t *kernel)
 	_pmap_init(&kmap->pmap, &vm.bss, &vm.top);
 	_page_init(&kmap->pmap, &vm.bss, &vm.top);
 
+	_slab_init(kmap, kernel);
 	_map_init(kmap, kernel, &vm.bss, &vm.top);
 
 	_zone_init(kmap, kernel, &vm.bss, &vm.top);
-	_kmalloc_init();
+	_kmalloc_init(kmap, kernel);
+	_map_initMagazines();
 
 	_object_init(kmap, kernel);
 	_amap_init(kmap, kernel);
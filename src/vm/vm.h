@@ -21,6 +21,7 @@
 #include "page.h"
 #include "map.h"
 #include "zone.h"
+#include "slab.h"
 #include "kmalloc.h"
 #include "object.h"
 #include "amap.h"